@@ -1,9 +1,12 @@
 // XFSM_UPLOAD_ID: 2025-08-23-14-00-native-subscribe
 // jswrap_xfsm.c — Unified JavaScript wrappers for Espruino
-// Exposes 3 classes to JS:
-//   - FSM      (V1 compatibility, state stored on the instance)
+// Exposes 5 classes to JS:
+//   - FSM      (V1 compatibility, state stored on the instance; XFSM_MINIMAL
+//               builds keep only its static methods unless XFSM_ENABLE_V1)
 //   - Machine  (pure, creates state objects and Services)
+//   - State    (state objects returned by Machine/Service; shared native matches())
 //   - Service  (interpreter; runs actions/guards; maintains its own status/context)
+//   - ServicePool (many light instances of one compiled Machine)
 
 #include "jswrapper.h"  
 #include "jswrap_xfsm.h"
@@ -14,8 +17,6 @@
 #include "jsparse.h"
 #include <string.h>
 
-static const char * const K_SSTATE  = "_state";
-
 
 /* ========================================================================== */
 /*                              FSM (V1)                                      */
@@ -31,10 +32,12 @@ static const char * const K_SSTATE  = "_state";
   "type"     : "constructor",
   "class"    : "FSM",
   "name"     : "FSM",
+  "#if"      : "!defined(XFSM_MINIMAL) || defined(XFSM_ENABLE_V1)",
   "generate" : "jswrap_xfsm_constructor",
   "params"   : [["config", "JsVar", "FSM configuration object"]],
   "return"   : ["JsVar", "A new FSM instance"]
 }*/
+#ifdef XFSM_HAS_V1
 JsVar *jswrap_xfsm_constructor(JsVar *config) {
   JsVar *obj = jspNewObject(0, "FSM");
   if (!obj) return 0;
@@ -47,15 +50,18 @@ JsVar *jswrap_xfsm_constructor(JsVar *config) {
   xfsm_init_object(obj);
   return obj;
 }
+#endif
 
 /*JSON{
   "type"     : "method",
   "class"    : "FSM",
   "name"     : "start",
+  "#if"      : "!defined(XFSM_MINIMAL) || defined(XFSM_ENABLE_V1)",
   "generate" : "jswrap_xfsm_start",
   "params"   : [["initialState", "JsVar", "[optional] initial state string"]],
   "return"   : ["JsVar", "Current FSM status string"]
 }*/
+#ifdef XFSM_HAS_V1
 JsVar *jswrap_xfsm_start(JsVar *parent, JsVar *initialState) {
   if (!jsvIsObject(parent)) return jsvNewFromString("NotStarted");
 
@@ -76,27 +82,33 @@ JsVar *jswrap_xfsm_start(JsVar *parent, JsVar *initialState) {
            : (st == XFSM_STATUS_STOPPED ? jsvNewFromString("Stopped")
                                         : jsvNewFromString("NotStarted"));
 }
+#endif
 
 /*JSON{
   "type"     : "method",
   "class"    : "FSM",
   "name"     : "stop",
+  "#if"      : "!defined(XFSM_MINIMAL) || defined(XFSM_ENABLE_V1)",
   "generate" : "jswrap_xfsm_stop",
   "return"   : ["JsVar", "undefined"]
 }*/
+#ifdef XFSM_HAS_V1
 JsVar *jswrap_xfsm_stop(JsVar *parent) {
   if (!jsvIsObject(parent)) return 0;
   xfsm_stop_object(parent);
   return 0; // undefined
 }
+#endif
 
 /*JSON{
   "type"     : "method",
   "class"    : "FSM",
   "name"     : "statusText",
+  "#if"      : "!defined(XFSM_MINIMAL) || defined(XFSM_ENABLE_V1)",
   "generate" : "jswrap_xfsm_statusText",
   "return"   : ["JsVar", "Current FSM status string"]
 }*/
+#ifdef XFSM_HAS_V1
 JsVar *jswrap_xfsm_statusText(JsVar *parent) {
   if (!jsvIsObject(parent)) return jsvNewFromString("NotStarted");
   XfsmStatus st = xfsm_status_object(parent);
@@ -105,27 +117,33 @@ JsVar *jswrap_xfsm_statusText(JsVar *parent) {
            : (st == XFSM_STATUS_STOPPED ? jsvNewFromString("Stopped")
                                         : jsvNewFromString("NotStarted"));
 }
+#endif
 
 /*JSON{
   "type"     : "method",
   "class"    : "FSM",
   "name"     : "current",
+  "#if"      : "!defined(XFSM_MINIMAL) || defined(XFSM_ENABLE_V1)",
   "generate" : "jswrap_xfsm_current",
   "return"   : ["JsVar", "Current FSM state string or undefined"]
 }*/
+#ifdef XFSM_HAS_V1
 JsVar *jswrap_xfsm_current(JsVar *parent) {
   if (!jsvIsObject(parent)) return 0;
   return xfsm_current_state_var(parent); // locked or 0
 }
+#endif
 
 /*JSON{
   "type"     : "method",
   "class"    : "FSM",
   "name"     : "send",
+  "#if"      : "!defined(XFSM_MINIMAL) || defined(XFSM_ENABLE_V1)",
   "generate" : "jswrap_xfsm_send",
   "params"   : [["event", "JsVar", "Event string"]],
   "return"   : ["JsVar", "New state string or undefined if no transition"]
 }*/
+#ifdef XFSM_HAS_V1
 JsVar *jswrap_xfsm_send(JsVar *parent, JsVar *event) {
   if (!jsvIsObject(parent)) return 0;
   if (!event || !jsvIsString(event)) {
@@ -134,6 +152,7 @@ JsVar *jswrap_xfsm_send(JsVar *parent, JsVar *event) {
   }
   return xfsm_send_object(parent, event); // locked or 0
 }
+#endif
 
 /* ========================================================================== */
 /*                              Machine (pure)                                */
@@ -146,16 +165,11 @@ JsVar *jswrap_xfsm_send(JsVar *parent, JsVar *event) {
 /*JSON{
   "type":"constructor","class":"Machine","name":"Machine",
   "generate":"jswrap_machine_constructor",
-  "params":[["config","JsVar","FSM config object"],["options","JsVar","[optional] options (unused yet)"]],
+  "params":[["config","JsVar","FSM config object"],["options","JsVar","[optional] { compile:bool (default true), compact:bool (default false; frees config.states only if the config is passed inline), strip:bool (default false), immutableContext:bool (default false), actions:{...} }"]],
   "return":["JsVar","Machine instance"]
 }*/
 JsVar *jswrap_machine_constructor(JsVar *config, JsVar *options) {
-  if (config && jsvIsObject(config)) {
-    if (!xfsm_validate_no_nested_states(config)) {
-      jsExceptionHere(JSET_ERROR, "Machine: nested states are not supported in this build");
-      return 0;
-    }
-  }
+  bool nested = config && jsvIsObject(config) && xfsm_config_is_nested(config);
   JsVar *obj = jspNewObject(0, "Machine");
   if (!obj) return 0;
   jsvObjectSetChildAndUnLock(obj, "config", (config && jsvIsObject(config)) ? jsvLockAgain(config) : jsvNewObject());
@@ -163,7 +177,15 @@ JsVar *jswrap_machine_constructor(JsVar *config, JsVar *options) {
     jsvObjectSetChildAndUnLock(obj, "_options", jsvLockAgain(options));
   else
     jsvObjectSetChildAndUnLock(obj, "_options", jsvNewObject());
+  /* checked above: initialState()/interpret()/start() won't walk the config again */
+  jsvObjectSetChildAndUnLock(obj, "_valid", jsvNewFromBool(true));
   xfsm_machine_init(obj);
+  /* nested states are flattened by the compiler; the interpretive path is flat-only */
+  if (nested && !xfsm_machine_is_compiled(obj)) {
+    jsvUnLock(obj);
+    jsExceptionHere(JSET_ERROR, "Machine: nested states need a compiled machine (not compile:false, depth up to 8)");
+    return 0;
+  }
   return obj;
 }
 
@@ -179,28 +201,117 @@ JsVar *jswrap_machine_initialState(JsVar *parent) {
 
 /*JSON{
   "type":"method","class":"Machine","name":"transition",
+  "#if":"!defined(XFSM_MINIMAL) || defined(XFSM_ENABLE_PURE_TRANSITION)",
   "generate":"jswrap_machine_transition",
   "params":[["stateOrValue","JsVar","Current state object or value string"],["event","JsVar","Event string"]],
   "return":["JsVar","Next state object or undefined"]
 }*/
+#ifdef XFSM_HAS_PURE_TRANSITION
 JsVar *jswrap_machine_transition(JsVar *parent, JsVar *stateOrValue, JsVar *eventStr) {
   if (!jsvIsObject(parent) || !eventStr || !jsvIsString(eventStr)) return 0;
   return xfsm_machine_transition(parent, stateOrValue, eventStr);
 }
+#endif
+
+/*JSON{
+  "type":"method","class":"Machine","name":"event",
+  "generate":"jswrap_machine_event",
+  "params":[["name","JsVar","Event type string"]],
+  "return":["JsVar","Interned event object {type} (shared; pass to send/transition)"]
+}*/
+JsVar *jswrap_machine_event(JsVar *parent, JsVar *name) {
+  if (!jsvIsObject(parent)) return 0;
+  if (!name || !jsvIsString(name)) {
+    jsExceptionHere(JSET_ERROR, "Machine.event: name must be a string");
+    return 0;
+  }
+  return xfsm_machine_event(parent, name);
+}
 
 /*JSON{
   "type":"method","class":"Machine","name":"interpret",
   "generate":"jswrap_machine_interpret",
+  "params":[["options","JsVar","[optional] { notifyUnchanged:bool (default true), reuseState:bool (default false), coalesce:bool (default false), profile:bool (default false, XFSM_PROFILE builds), trace:int (records kept, default 0), actions:{...} }"]],
   "return":["JsVar","A new Service interpreter"]
 }*/
-JsVar *jswrap_machine_interpret(JsVar *parent) {
+JsVar *jswrap_machine_interpret(JsVar *parent, JsVar *options) {
   if (!jsvIsObject(parent)) return 0;
   JsVar *svc = jspNewObject(0, "Service");
   if (!svc) return 0;
+  if (options && jsvIsObject(options))
+    jsvObjectSetChildAndUnLock(svc, "_options", jsvLockAgain(options));
   xfsm_service_init(svc, parent);
   return svc;
 }
 
+/*JSON{
+  "type":"method","class":"Machine","name":"restore",
+  "generate":"jswrap_machine_restore",
+  "params":[["snapshot","JsVar","A string from service.snapshot() (e.g. require(\"Storage\").read(name))"],
+            ["options","JsVar","[optional] interpret() options for the new service"]],
+  "return":["JsVar","A new Service in the saved state; entry actions are not run"]
+}*/
+JsVar *jswrap_machine_restore(JsVar *parent, JsVar *snapshot, JsVar *options) {
+  if (!jsvIsObject(parent)) return 0;
+  JsVar *svc = jswrap_machine_interpret(parent, options);
+  if (!svc) return 0;
+  if (!xfsm_service_restore(svc, snapshot)) {
+    jsvUnLock(svc);
+    jsExceptionHere(JSET_ERROR, "Machine.restore: not a snapshot of this machine");
+    return 0;
+  }
+  return svc;
+}
+
+/*JSON{
+  "type":"method","class":"Machine","name":"analyze",
+  "generate":"jswrap_machine_analyze",
+  "return":["JsVar","{ states, unreachable, stripped, events, deadEvents, transitions, guards, actions, shadowed, blocks:{ config, table, service } }"]
+}*/
+JsVar *jswrap_machine_analyze(JsVar *parent) {
+  if (!jsvIsObject(parent)) return 0;
+  JsVar *res = xfsm_machine_analyze(parent);
+  if (!res) jsExceptionHere(JSET_ERROR, "Machine.analyze: needs config.states or a compiled table");
+  return res;
+}
+
+/*JSON{
+  "type":"method","class":"Machine","name":"pool",
+  "generate":"jswrap_machine_pool",
+  "params":[["count","int","Number of instances (1..65535)"]],
+  "return":["JsVar","A ServicePool of `count` instances (compiled machines only)"]
+}*/
+JsVar *jswrap_machine_pool(JsVar *parent, int count) {
+  if (!jsvIsObject(parent)) return 0;
+  JsVar *pool = jspNewObject(0, "ServicePool");
+  if (!pool) return 0;
+  if (!xfsm_pool_init(pool, parent, count)) {
+    jsvUnLock(pool);
+    jsExceptionHere(JSET_ERROR, "Machine.pool: needs a compiled machine and 1..65535 instances");
+    return 0;
+  }
+  return pool;
+}
+
+/* ========================================================================== */
+/*                              State                                         */
+/* ========================================================================== */
+
+/*JSON{
+  "type":"class", "class":"State", "name":"State"
+}*/
+
+/*JSON{
+  "type":"method","class":"State","name":"matches",
+  "generate":"jswrap_state_matches",
+  "params":[["value","JsVar","State value to test"]],
+  "return":["bool","true if this state's value equals value"]
+}*/
+bool jswrap_state_matches(JsVar *parent, JsVar *value) {
+  if (!jsvIsObject(parent)) return false;
+  return xfsm_state_matches(parent, value);
+}
+
 /* ========================================================================== */
 /*                              Service (interpreter)                          */
 /* ========================================================================== */
@@ -228,7 +339,8 @@ JsVar *jswrap_service_start(JsVar *parent) {
 }*/
 JsVar *jswrap_service_stop(JsVar *parent) {
   if (!jsvIsObject(parent)) return 0;
-  xfsm_service_stop(parent);
+  JsVar *r = xfsm_service_stop(parent);
+  if (r) jsvUnLock(r);
   return jsvLockAgain(parent); // return a locked 'this'
 }
 
@@ -249,6 +361,22 @@ JsVar *jswrap_service_send(JsVar *parent, JsVar *event) {
   return jsvLockAgain(parent); // always chainable
 }
 
+/*JSON{
+  "type":"method","class":"Service","name":"sendBatch",
+  "generate":"jswrap_service_sendBatch",
+  "params":[["events","JsVar","Array of event strings or objects {type,...}"]],
+  "return":["JsVar","this (chainable)"]
+}*/
+JsVar *jswrap_service_sendBatch(JsVar *parent, JsVar *events) {
+  if (!jsvIsObject(parent)) return 0;
+  if (!events || !jsvIsArray(events)) {
+    jsExceptionHere(JSET_ERROR, "Service.sendBatch: events must be an array");
+    return jsvLockAgain(parent);
+  }
+  xfsm_service_send_batch(parent, events);
+  return jsvLockAgain(parent); // always chainable
+}
+
 /*JSON{
   "type":"property",
   "class":"Service",
@@ -270,26 +398,31 @@ JsVar *jswrap_service_get_state(JsVar *parent) {
 }*/
 int jswrap_service_get_status(JsVar *parent) {
   if (!jsvIsObject(parent)) return 0;
-  int out = 0;
-  JsVar *v = xfsm_service_get_status_num(parent);  // returns a LOCKED integer JsVar
-  if (v) {
-    out = (int)jsvGetInteger(v);
-    jsvUnLock(v);
-  }
-  return out;
+  return (int)xfsm_service_status(parent);  // packed in _flags
 }
 
 
 /*JSON{
   "type":"method","class":"Service","name":"statusText",
   "generate":"jswrap_service_statusText",
-  "return":["JsVar","Current status string"]
+  "return":["JsVar","Current status string (derived from the numeric status)"]
 }*/
 JsVar *jswrap_service_statusText(JsVar *parent) {
   if (!jsvIsObject(parent)) return 0;
   return xfsm_service_get_status(parent);
 }
 
+/*JSON{
+  "type":"method","class":"Service","name":"refreshActions",
+  "generate":"jswrap_service_refreshActions",
+  "return":["JsVar","this"]
+}*/
+JsVar *jswrap_service_refreshActions(JsVar *parent) {
+  if (!jsvIsObject(parent)) return 0;
+  xfsm_service_refresh_actions(parent);
+  return jsvLockAgain(parent);
+}
+
 /*JSON{
   "type"     : "method",
   "class"    : "Service",
@@ -308,39 +441,15 @@ JsVar *jswrap_service_subscribe(JsVar *svc, JsVar *listener) {
     return jsvNewNativeFunction((void (*)(void))0, JSWAT_VOID);
   }
 
-  // Ensure _listeners exists (keep local handle LOCKED)
-  JsVar *listeners = jsvObjectGetChild(svc, "_listeners", 0);
-  if (!listeners) {
-    listeners = jsvNewObject();
-    if (listeners) jsvObjectSetChild(svc, "_listeners", listeners); // NOTE: no 'AndUnLock' here
-  }
-
-  // id++
-  int id = 0;
-  JsVar *vlid = jsvObjectGetChild(svc, "_lid", 0);
-  if (vlid) { id = (int)jsvGetInteger(vlid); jsvUnLock(vlid); }
-  id = id + 1;
-  jsvObjectSetChildAndUnLock(svc, "_lid", jsvNewFromInteger(id));
-
-  // store listener under decimal key
-  if (listeners) {
-    char key[12];
-    itostr((JsVarInt)id, key, 10);
-    jsvObjectSetChildAndUnLock(listeners, key, jsvLockAgain(listener));
-    jsvUnLock(listeners);
-  }
+  int id = xfsm_service_add_listener(svc, listener);
+  if (!id) return jsvNewNativeFunction((void (*)(void))0, JSWAT_VOID);
 
-    // Queue pre-notify (already correct)
-  JsVar *st = jsvObjectGetChild(svc, K_SSTATE, 0);
-  if (!st) st = xfsm_service_get_state(svc);
-  if (st) {
-    JsVar *argv[1] = { st };
-    jsiQueueEvents(svc, listener, argv, 1);
-    jsvUnLock(st);
-  }
+  // Queue pre-notify (counted as pending work until it has run)
+  xfsm_service_prenotify(svc, listener);
 
-  // Return closure-based unsubscribe (NO _svc/_id props, NO callee)
-return xfsm_make_unsubscribe(svc, id); // LOCKED
+  // Native unsubscribe bound to (svc, id): no closure scope, no parser
+  JsVar *un = xfsm_make_unsubscribe(svc, id); // LOCKED
+  return un ? un : jsvNewNativeFunction((void (*)(void))0, JSWAT_VOID);
 }
 
 /*JSON{
@@ -353,67 +462,302 @@ return xfsm_make_unsubscribe(svc, id); // LOCKED
 }*/
 bool jswrap_service_unsubById(JsVar *svc, JsVar *idVar) {
   if (!jsvIsObject(svc) || !idVar) return false;
+  return xfsm_service_remove_listener(svc, (int)jsvGetInteger(idVar));
+}
+
+/*JSON{
+  "type"     : "method",
+  "class"    : "Service",
+  "name"     : "hasPendingWork",
+  "generate" : "jswrap_service_hasPendingWork",
+  "return"   : ["bool","true if events, `after` timers or listener calls are still pending"]
+}*/
+bool jswrap_service_hasPendingWork(JsVar *svc) {
+  if (!jsvIsObject(svc)) return false;
+  return xfsm_service_has_pending_work(svc);
+}
 
-  JsVar *listeners = jsvObjectGetChild(svc, "_listeners", 0);
-  if (!listeners || !jsvIsObject(listeners)) {
-    if (listeners) jsvUnLock(listeners);
-    return false;
+/*JSON{
+  "type"     : "method",
+  "class"    : "Service",
+  "name"     : "snapshot",
+  "generate" : "jswrap_service_snapshot",
+  "return"   : ["JsVar","binary string: state, status, pending `after` timers and context (as JSON)"]
+}*/
+JsVar *jswrap_service_snapshot(JsVar *parent) {
+  if (!jsvIsObject(parent)) return 0;
+  return xfsm_service_snapshot(parent);
+}
+
+/*JSON{
+  "type"     : "method",
+  "class"    : "Service",
+  "name"     : "trace",
+  "generate" : "jswrap_service_trace",
+  "return"   : ["JsVar","the last transitions, oldest first: [{ time, from, event, to, guard }], or undefined without { trace:N }"]
+}*/
+JsVar *jswrap_service_trace(JsVar *parent) {
+  if (!jsvIsObject(parent)) return 0;
+  return xfsm_service_get_trace(parent);
+}
+
+/*JSON{
+  "type"     : "method",
+  "class"    : "Service",
+  "name"     : "profile",
+  "#if"      : "defined(XFSM_PROFILE) || defined(XFSM_ENABLE_PROFILE)",
+  "generate" : "jswrap_service_profile",
+  "params"   : [["enable","bool","true to start counting, false to stop (the counters are kept)"]],
+  "return"   : ["JsVar","this"]
+}*/
+#ifdef XFSM_PROFILE
+JsVar *jswrap_service_profile(JsVar *parent, bool enable) {
+  if (!jsvIsObject(parent)) return 0;
+  xfsm_service_profile(parent, enable);
+  return jsvLockAgain(parent);
+}
+#endif
+
+/*JSON{
+  "type"     : "method",
+  "class"    : "Service",
+  "name"     : "stats",
+  "#if"      : "defined(XFSM_PROFILE) || defined(XFSM_ENABLE_PROFILE)",
+  "generate" : "jswrap_service_stats",
+  "return"   : ["JsVar","{ sends, matched, unmatched, guards, actions, listeners, blocks, time } or undefined if never profiled"]
+}*/
+#ifdef XFSM_PROFILE
+JsVar *jswrap_service_stats(JsVar *parent) {
+  if (!jsvIsObject(parent)) return 0;
+  return xfsm_service_get_stats(parent);
+}
+#endif
+
+/*JSON{
+  "type"     : "method",
+  "class"    : "Service",
+  "name"     : "resetStats",
+  "#if"      : "defined(XFSM_PROFILE) || defined(XFSM_ENABLE_PROFILE)",
+  "generate" : "jswrap_service_resetStats",
+  "return"   : ["JsVar","this"]
+}*/
+#ifdef XFSM_PROFILE
+JsVar *jswrap_service_resetStats(JsVar *parent) {
+  if (!jsvIsObject(parent)) return 0;
+  xfsm_service_reset_stats(parent);
+  return jsvLockAgain(parent);
+}
+#endif
+
+/* ========================================================================== */
+/*                              Low-power idle                                */
+/* ========================================================================== */
+
+/*JSON{
+  "type"     : "staticmethod",
+  "class"    : "FSM",
+  "name"     : "hasPendingWork",
+  "generate" : "jswrap_xfsm_hasPendingWork",
+  "return"   : ["bool","true while any service has `after` timers or queued listener calls"]
+}*/
+bool jswrap_xfsm_hasPendingWork() {
+  return xfsm_has_pending_work();
+}
+
+/*JSON{
+  "type"     : "staticmethod",
+  "class"    : "FSM",
+  "name"     : "idle",
+  "generate" : "jswrap_xfsm_idle_hook",
+  "params"   : [["callback","JsVar","function() called each time FSM work drains, or undefined to remove it"]]
+}*/
+void jswrap_xfsm_idle_hook(JsVar *callback) {
+  if (callback && !jsvIsUndefined(callback) && !jsvIsFunction(callback)) {
+    jsExceptionHere(JSET_ERROR, "FSM.idle: callback must be a function");
+    return;
   }
+  xfsm_set_idle_hook(callback);
+}
 
-  // Normalise the key to a string
-  JsVar *keyVar = jsvAsString(idVar);           // LOCKED
-  if (!keyVar) { jsvUnLock(listeners); return false; }
-
-  char delKey[16];
-  int  delLen = jsvGetString(keyVar, delKey, sizeof(delKey)-1);
-  if (delLen < 0) delLen = 0;
-  delKey[delLen] = 0;
-
-  bool existed = false;
-
-  // Did it exist before?
-  JsVar *existing = jsvObjectGetChild(listeners, delKey, 0);
-  if (existing) { existed = true; jsvUnLock(existing); }
-
-  // Attempt native removal (void return on your build)
-  jsvObjectRemoveChild(listeners, keyVar);
-
-  // Verify if it’s gone
-  JsVar *still = jsvObjectGetChild(listeners, delKey, 0);
-  if (still) {
-    // Rebuild map WITHOUT the key (guaranteed removal for enumeration & callbacks)
-    jsvUnLock(still);
-
-    JsVar *nl = jsvNewObject();
-    if (nl) {
-      JsvObjectIterator it;
-      jsvObjectIteratorNew(&it, listeners);
-      while (jsvObjectIteratorHasValue(&it)) {
-        JsVar *k = jsvObjectIteratorGetKey(&it);    // LOCKED
-        JsVar *v = jsvObjectIteratorGetValue(&it);  // LOCKED
-
-        // Extract key as C string
-        char kbuf[16];
-        int klen = jsvGetString(k, kbuf, sizeof(kbuf)-1);
-        if (klen < 0) klen = 0;
-        kbuf[klen] = 0;
-
-        if (strcmp(kbuf, delKey) != 0) {
-          jsvObjectSetChildAndUnLock(nl, kbuf, jsvLockAgain(v));
-        }
-
-        jsvUnLock(k);
-        jsvUnLock(v);
-        jsvObjectIteratorNext(&it);
-      }
-      jsvObjectIteratorFree(&it);
-
-      // Replace listeners map
-      jsvObjectSetChildAndUnLock(svc, "_listeners", nl);
-    }
+/*JSON{
+  "type"     : "idle",
+  "generate" : "jswrap_xfsm_idle"
+}*/
+bool jswrap_xfsm_idle() {
+  return xfsm_idle(); // never keeps the device awake
+}
+
+/*JSON{
+  "type"     : "kill",
+  "generate" : "jswrap_xfsm_kill"
+}*/
+void jswrap_xfsm_kill() {
+  xfsm_kill();
+}
+
+/* ========================================================================== */
+/*                              ServicePool                                   */
+/* ========================================================================== */
+
+/*JSON{
+  "type":"class", "class":"ServicePool", "name":"ServicePool"
+}*/
+
+static bool jswrap_pool_check(JsVar *pool, int index, const char *fn) {
+  if (index >= 0 && index < xfsm_pool_size(pool)) return true;
+  jsExceptionHere(JSET_ERROR, "ServicePool.%s: index out of range", fn);
+  return false;
+}
+
+/*JSON{
+  "type":"method","class":"ServicePool","name":"start",
+  "generate":"jswrap_pool_start",
+  "params":[["index","JsVar","Instance to start, or undefined for all"]],
+  "return":["JsVar","this"]
+}*/
+JsVar *jswrap_pool_start(JsVar *parent, JsVar *index) {
+  if (!jsvIsObject(parent)) return 0;
+  if (!index || jsvIsUndefined(index)) {
+    int n = xfsm_pool_size(parent);
+    for (int i = 0; i < n; i++) xfsm_pool_start(parent, i);
+  } else {
+    int i = (int)jsvGetInteger(index);
+    if (!jswrap_pool_check(parent, i, "start")) return 0;
+    xfsm_pool_start(parent, i);
+  }
+  return jsvLockAgain(parent);
+}
+
+/*JSON{
+  "type":"method","class":"ServicePool","name":"stop",
+  "generate":"jswrap_pool_stop",
+  "params":[["index","int","Instance to stop"]],
+  "return":["JsVar","this"]
+}*/
+JsVar *jswrap_pool_stop(JsVar *parent, int index) {
+  if (!jsvIsObject(parent) || !jswrap_pool_check(parent, index, "stop")) return 0;
+  xfsm_pool_stop(parent, index);
+  return jsvLockAgain(parent);
+}
+
+/*JSON{
+  "type":"method","class":"ServicePool","name":"send",
+  "generate":"jswrap_pool_send",
+  "params":[["index","int","Instance"],["event","JsVar","Event (string or object)"]],
+  "return":["JsVar","The instance's state value afterwards, or undefined if it isn't running"]
+}*/
+JsVar *jswrap_pool_send(JsVar *parent, int index, JsVar *event) {
+  if (!jsvIsObject(parent) || !jswrap_pool_check(parent, index, "send")) return 0;
+  return xfsm_pool_send(parent, index, event);
+}
+
+/*JSON{
+  "type":"method","class":"ServicePool","name":"value",
+  "generate":"jswrap_pool_value",
+  "params":[["index","int","Instance"]],
+  "return":["JsVar","The instance's current state value"]
+}*/
+JsVar *jswrap_pool_value(JsVar *parent, int index) {
+  if (!jsvIsObject(parent) || !jswrap_pool_check(parent, index, "value")) return 0;
+  return xfsm_pool_value(parent, index);
+}
+
+/*JSON{
+  "type":"method","class":"ServicePool","name":"context",
+  "generate":"jswrap_pool_context",
+  "params":[["index","int","Instance"]],
+  "return":["JsVar","The instance's context (shared with the machine, read-only, until its first assign or action)"]
+}*/
+JsVar *jswrap_pool_context(JsVar *parent, int index) {
+  if (!jsvIsObject(parent) || !jswrap_pool_check(parent, index, "context")) return 0;
+  return xfsm_pool_context(parent, index);
+}
+
+/*JSON{
+  "type":"method","class":"ServicePool","name":"status",
+  "generate":"jswrap_pool_status",
+  "params":[["index","int","Instance"]],
+  "return":["int","NotStarted=0, Running=1, Stopped=2"]
+}*/
+int jswrap_pool_status(JsVar *parent, int index) {
+  if (!jsvIsObject(parent) || !jswrap_pool_check(parent, index, "status")) return 0;
+  return xfsm_pool_status(parent, index);
+}
+
+/*JSON{
+  "type":"property","class":"ServicePool","name":"length",
+  "generate":"jswrap_pool_length",
+  "return":["int","Number of instances"]
+}*/
+int jswrap_pool_length(JsVar *parent) {
+  if (!jsvIsObject(parent)) return 0;
+  return xfsm_pool_size(parent);
+}
+
+/* ========================================================================== */
+/*                              Bus                                           */
+/* ========================================================================== */
+
+/*JSON{
+  "type":"class", "class":"Bus", "name":"Bus"
+}*/
+
+/*JSON{
+  "type":"staticmethod","class":"FSM","name":"Bus",
+  "generate":"jswrap_xfsm_bus",
+  "return":["JsVar","A new, empty Bus (`new FSM.Bus()` works too)"]
+}*/
+JsVar *jswrap_xfsm_bus() {
+  JsVar *bus = jspNewObject(0, "Bus");
+  if (!bus) return 0;
+  if (!xfsm_bus_init(bus)) { jsvUnLock(bus); return 0; }
+  return bus;
+}
+
+/*JSON{
+  "type":"method","class":"Bus","name":"add",
+  "generate":"jswrap_bus_add",
+  "params":[["service","JsVar","A Service; it is indexed by the events its current state handles"]],
+  "return":["JsVar","this"]
+}*/
+JsVar *jswrap_bus_add(JsVar *parent, JsVar *service) {
+  if (!jsvIsObject(parent)) return 0;
+  if (!xfsm_bus_add(parent, service)) {
+    jsExceptionHere(JSET_ERROR, "Bus.add: needs a Service that isn't on another Bus (up to 32 per Bus)");
+    return 0;
   }
+  return jsvLockAgain(parent);
+}
+
+/*JSON{
+  "type":"method","class":"Bus","name":"remove",
+  "generate":"jswrap_bus_remove",
+  "params":[["service","JsVar","A Service added to this Bus"]],
+  "return":["JsVar","this"]
+}*/
+JsVar *jswrap_bus_remove(JsVar *parent, JsVar *service) {
+  if (!jsvIsObject(parent)) return 0;
+  xfsm_bus_remove(parent, service);
+  return jsvLockAgain(parent);
+}
+
+/*JSON{
+  "type":"method","class":"Bus","name":"send",
+  "generate":"jswrap_bus_send",
+  "params":[["event","JsVar","Event (string or object)"]],
+  "return":["int","Number of services the event was sent to"]
+}*/
+int jswrap_bus_send(JsVar *parent, JsVar *event) {
+  if (!jsvIsObject(parent)) return 0;
+  return xfsm_bus_send(parent, event);
+}
 
-  jsvUnLock(keyVar);
-  jsvUnLock(listeners);
-  return existed; // true if we removed or neutralised an existing entry
+/*JSON{
+  "type":"property","class":"Bus","name":"length",
+  "generate":"jswrap_bus_length",
+  "return":["int","Number of registered services"]
+}*/
+int jswrap_bus_length(JsVar *parent) {
+  if (!jsvIsObject(parent)) return 0;
+  return xfsm_bus_size(parent);
 }
@@ -1,5 +1,6 @@
 // XFSM_UPLOAD_ID: 2025-08-23-14-00-native-subscribe
 // jswrap_xfsm.h — Unified wrapper header for FSM + Machine + Service
+// Tests the raw XFSM_* build flags (see xfsm.h): it is included without xfsm.h.
 
 #ifndef JSWRAP_XFSM_H
 #define JSWRAP_XFSM_H
@@ -11,28 +12,71 @@ extern "C" {
 #endif
 
 /* -------- FSM (V1 compatibility class) -------- */
+#if !defined(XFSM_MINIMAL) || defined(XFSM_ENABLE_V1)
 JsVar *jswrap_xfsm_constructor(JsVar *config);
 JsVar *jswrap_xfsm_start(JsVar *parent, JsVar *initialState);
 JsVar *jswrap_xfsm_stop(JsVar *parent);
 JsVar *jswrap_xfsm_statusText(JsVar *parent);
 JsVar *jswrap_xfsm_current(JsVar *parent);
 JsVar *jswrap_xfsm_send(JsVar *parent, JsVar *event);
+#endif
 
 /* -------- Machine (pure) -------- */
 JsVar *jswrap_machine_constructor(JsVar *config, JsVar *options);
 JsVar *jswrap_machine_initialState(JsVar *parent);
+#if !defined(XFSM_MINIMAL) || defined(XFSM_ENABLE_PURE_TRANSITION)
 JsVar *jswrap_machine_transition(JsVar *parent, JsVar *stateOrValue, JsVar *eventStr);
-JsVar *jswrap_machine_interpret(JsVar *parent);
+#endif
+JsVar *jswrap_machine_event(JsVar *parent, JsVar *name);
+JsVar *jswrap_machine_interpret(JsVar *parent, JsVar *options);
+JsVar *jswrap_machine_restore(JsVar *parent, JsVar *snapshot, JsVar *options);
+JsVar *jswrap_machine_analyze(JsVar *parent);
+JsVar *jswrap_machine_pool(JsVar *parent, int count);
+
+/* -------- State (returned by Machine/Service) -------- */
+bool jswrap_state_matches(JsVar *parent, JsVar *value);
 
 /* -------- Service (interpreter) -------- */
 JsVar *jswrap_service_start(JsVar *parent);
 JsVar *jswrap_service_stop(JsVar *parent);
 JsVar *jswrap_service_send(JsVar *parent, JsVar *eventStr);
+JsVar *jswrap_service_sendBatch(JsVar *parent, JsVar *events);
 JsVar *jswrap_service_get_state(JsVar *parent);
 int jswrap_service_get_status(JsVar *parent);
 JsVar *jswrap_service_statusText(JsVar *parent);
+JsVar *jswrap_service_refreshActions(JsVar *parent);
 JsVar *jswrap_service_subscribe(JsVar *parent, JsVar *listener);
 bool jswrap_service_unsubById(JsVar *svc, JsVar *idVar);
+bool jswrap_service_hasPendingWork(JsVar *svc);
+JsVar *jswrap_service_trace(JsVar *parent);
+JsVar *jswrap_service_snapshot(JsVar *parent);
+#if defined(XFSM_PROFILE) || defined(XFSM_ENABLE_PROFILE)
+JsVar *jswrap_service_profile(JsVar *parent, bool enable);
+JsVar *jswrap_service_stats(JsVar *parent);
+JsVar *jswrap_service_resetStats(JsVar *parent);
+#endif
+
+/* -------- Low-power idle -------- */
+bool jswrap_xfsm_hasPendingWork();
+void jswrap_xfsm_idle_hook(JsVar *callback);
+bool jswrap_xfsm_idle();
+void jswrap_xfsm_kill();
+
+/* -------- ServicePool -------- */
+JsVar *jswrap_pool_start(JsVar *parent, JsVar *index);
+JsVar *jswrap_pool_stop(JsVar *parent, int index);
+JsVar *jswrap_pool_send(JsVar *parent, int index, JsVar *event);
+JsVar *jswrap_pool_value(JsVar *parent, int index);
+JsVar *jswrap_pool_context(JsVar *parent, int index);
+int jswrap_pool_status(JsVar *parent, int index);
+int jswrap_pool_length(JsVar *parent);
+
+/* -------- Bus -------- */
+JsVar *jswrap_xfsm_bus();
+JsVar *jswrap_bus_add(JsVar *parent, JsVar *service);
+JsVar *jswrap_bus_remove(JsVar *parent, JsVar *service);
+int jswrap_bus_send(JsVar *parent, JsVar *event);
+int jswrap_bus_length(JsVar *parent);
 
 
 #ifdef __cplusplus
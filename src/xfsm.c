@@ -6,17 +6,39 @@
 //   * { type:"xstate.assign", assignment: fn|object }  // preferred
 //   * { type:"assign", assignment: fn|object }         // alias
 //   * shorthand: { key: valueOrFn, ... }               // treated as assignment spec
+//   * map values { $inc:n } { $dec:n } { $set:v } { $event:"key" } are applied in C
 //   Semantics: produces a patch (object) which is shallow-merged into context.
 // - Actions list items may be: function, string (resolved via config.actions then global), or assign object.
-// - Guards (cond) are functions or strings; truthiness via jsvGetBool.
+// - Guards (cond) are functions (truthiness via jsvGetBool) or declarative
+//   comparisons such as { lt:["ctx.count", 10] }, evaluated in C.
 // - Context persistence happens ONCE after executing a group of actions.
+// - Machines are compiled once into a flat transition table (machine._table);
+//   { compile:false } keeps the interpretive config walk, { compact:true }
+//   releases config.states once the table is built.
+// - Nested states (compiled machines): flattened to leaf states named by dotted
+//   path, with exit/entry lists precomputed from the least common ancestor.
+// - Delayed transitions: `after: { ms: target }` on a state, driven by native
+//   timers that are cancelled in C on exit and on stop().
+// - Profiling: built with XFSM_PROFILE, services created with { profile:true }
+//   count sends, guards, actions and listener calls (service.stats()).
+// - Snapshot: service.snapshot() packs state, status, pending timers and
+//   context into one binary string; machine.restore(blob) resumes it
+//   without running entry actions.
+// - Pools: machine.pool(n) runs n instances of a compiled machine from one
+//   packed record array instead of n Service objects.
+// - Analysis: machine.analyze() reports reachable states, per-state events and
+//   size estimates from the compiled table; { strip:true } drops dead states.
+// - Trace: { trace:N } keeps the last N transitions of a compiled service in
+//   a native ring buffer, decoded only by service.trace().
+// - Build options (xfsm.h): XFSM_MINIMAL compiles out the V1 FSM and the pure
+//   Machine.transition() unless XFSM_ENABLE_V1 / XFSM_ENABLE_PURE_TRANSITION.
 // - No C++ features; strict JsVar lock/unlock discipline.
 //
 // Public API (declared in xfsm.h):
 //   V1 FSM (single-object): xfsm_init_object, xfsm_start_object, xfsm_stop_object,
 //                           xfsm_status_object, xfsm_current_state_var, xfsm_send_object
-//   Machine (pure): xfsm_machine_init, xfsm_machine_initial_state,
-//                   xfsm_machine_transition
+//   Machine (pure): xfsm_machine_init, xfsm_machine_compile, xfsm_machine_initial_state,
+//                   xfsm_machine_transition, xfsm_state_matches
 //   Service/Interpreter (stateful): xfsm_service_init, xfsm_service_start, xfsm_service_stop,
 //                                   xfsm_service_send, xfsm_service_get_state, xfsm_service_get_status
 //
@@ -25,8 +47,11 @@
 
 #include "jsutils.h"
 #include "jsinteractive.h"
-#include "jsparse.h"  // jspEvaluateVar
+#include "jsparse.h"
 #include "jsvar.h"
+#include "jswrap_interactive.h"
+#include "jswrap_json.h"
+#include "jshardware.h"
 
 #include "xfsm.h"
 #include <string.h>
@@ -35,56 +60,63 @@
 #include <jswrapper.h>
 
 
-// --- One-time unsubscribe factory (closure-based, strong delete) ---
-
-static JsVar *xfsm_unsub_factory = 0;
-
-void xfsm_ensure_unsub_factory(void) {
-  if (xfsm_unsub_factory && jsvIsFunction(xfsm_unsub_factory)) return;
-
-  // (function(m,i){ i=''+i; return function(){ try{ return m._unsubById(i); }catch(e){ return false; } }; })
-  JsVar *src = jsvNewFromString(
-    "(function(m,i){"
-      "i = ''+i;"
-      "return function(){"
-        "try { return m._unsubById(i); }"
-        "catch(e){ return false; }"
-      "};"
-    "})"
-  );
-  if (!src) return;
+/* ---------------- Struct-backed flat strings ----------------
+ * The table, guard programs, pool records, trace ring and profiling
+ * counters are C structs inside flat strings. Flat string data starts right
+ * after the JsVar header, so it is only as aligned as the JsVar size (not at
+ * all on builds with 13- or 15-byte vars). xfsm_new_flat() allocates
+ * XFSM_FLAT_ALIGN spare bytes and keeps the struct data at the first aligned
+ * address after the first byte, which records that offset. The offset moves
+ * with the bytes, so a var relocated by E.defrag() still reads correctly. */
+#define XFSM_FLAT_ALIGN 4
 
-  JsVar *fn = jspEvaluateVar(src, 0 /*global*/, "xfsm.unsubFactory");
-  jsvUnLock(src);
-
-  if (fn && jsvIsFunction(fn)) xfsm_unsub_factory = fn;
-  else { if (fn) jsvUnLock(fn); xfsm_unsub_factory = 0; }
+/* New zeroed flat string with `len` usable, aligned bytes (LOCKED), or 0 */
+static JsVar *xfsm_new_flat(size_t len) {
+  JsVar *v = jsvNewFlatStringOfLength((unsigned int)(len + XFSM_FLAT_ALIGN));
+  if (!v) return 0;
+  char *base = jsvGetFlatStringPointer(v);
+  size_t off = XFSM_FLAT_ALIGN - ((size_t)base % XFSM_FLAT_ALIGN);   /* 1..XFSM_FLAT_ALIGN */
+  memset(base, 0, len + XFSM_FLAT_ALIGN);
+  base[0] = (char)off;
+  return v;
 }
 
-
-// Create a fresh unsubscribe() that closes over svc + id (stringified inside the factory).
-// Returns a LOCKED function.
-JsVar *xfsm_make_unsubscribe(JsVar *svc, int id) {
-  if (!(xfsm_unsub_factory && jsvIsFunction(xfsm_unsub_factory)))
-    return jsvNewNativeFunction((void (*)(void))0, JSWAT_VOID);
-
-  JsVar *factory = jsvLockAgain(xfsm_unsub_factory);
-  JsVar *a0 = jsvLockAgain(svc);
-  JsVar *a1 = jsvNewFromInteger(id);
-  JsVar *argv[2] = { a0, a1 };
-
-  JsVar *fn = jspExecuteFunction(factory, 0 /*this*/, 2, argv);
-
-  jsvUnLock(a0);
-  jsvUnLock(a1);
-  jsvUnLock(factory);
-
-  if (fn && jsvIsFunction(fn)) return fn; // LOCKED
-  if (fn) jsvUnLock(fn);
-  return jsvNewNativeFunction((void (*)(void))0, JSWAT_VOID);
+/* Struct data of a flat string made by xfsm_new_flat(), or 0 */
+static void *xfsm_flat_ptr(JsVar *v) {
+  if (!v || !jsvIsFlatString(v) || jsvGetStringLength(v) <= XFSM_FLAT_ALIGN) return 0;
+  char *base = jsvGetFlatStringPointer(v);
+  return base + (unsigned char)base[0];
 }
 
+/* Usable bytes of a flat string made by xfsm_new_flat() */
+static size_t xfsm_flat_len(JsVar *v) {
+  if (!xfsm_flat_ptr(v)) return 0;
+  return jsvGetStringLength(v) - (unsigned char)jsvGetFlatStringPointer(v)[0];
+}
 
+/* ---------------- Profiling (XFSM_PROFILE) ----------------
+ * Counters of the service whose send is being processed. xfsm_prof points
+ * at its XfsmStats (kept in the service's `_stats` flat string) for the
+ * duration of the send, so guard and action code can count without being
+ * handed the service. Without XFSM_PROFILE the counting macro is empty.
+ * The 64-bit time is kept as bytes and accessed with memcpy, since flat
+ * string data need not be aligned for it. */
+#ifdef XFSM_PROFILE
+typedef struct {
+  uint32_t sends;       /* events processed (queued ones included) */
+  uint32_t matched;     /* sends that applied a transition */
+  uint32_t unmatched;   /* sends that left the state unchanged */
+  uint32_t guards;      /* cond functions called */
+  uint32_t actions;     /* actions executed (assigns included) */
+  uint32_t listeners;   /* listener calls */
+  int32_t  blocks;      /* net JsVar blocks allocated during sends */
+  uint8_t  time[sizeof(JsSysTime)]; /* cumulative time inside send() (a JsSysTime) */
+} XfsmStats;
+static XfsmStats *xfsm_prof = 0;
+#define XFSM_PROF_COUNT(field) do { if (xfsm_prof) xfsm_prof->field++; } while (0)
+#else
+#define XFSM_PROF_COUNT(field) do { } while (0)
+#endif
 
 /* ---------------- Event normalization ---------------- */
 // Enable events to be recieved as strings or objects.  
@@ -117,29 +149,47 @@ JsVar *xfsm_normalize_event(JsVar *event) {
 }
 
 /* ---------------- Key strings ---------------- */
-static const char * const K_STATUS  = "status";
+#ifdef XFSM_HAS_V1
+static const char * const K_STATUS  = "status";   /* V1 FSM fields */
 static const char * const K_STATE   = "state";
+#endif
 static const char * const K_CFG     = "config";
 
 static const char * const K_STATES  = "states";
 static const char * const K_ON      = "on";
+static const char * const K_AFTER   = "after";
 static const char * const K_ENTRY   = "entry";
 static const char * const K_EXIT    = "exit";
 static const char * const K_TARGET  = "target";
 static const char * const K_ACTIONS = "actions";
 static const char * const K_CONTEXT = "context";
 static const char * const K_COND    = "cond";
+static const char * const K_ANY     = "*";        /* wildcard event key in `on` */
+static const char * const K_EVID    = JS_HIDDEN_CHAR_STR"ei"; /* interned event id */
+static const char * const K_CKEEP   = JS_HIDDEN_CHAR_STR"k";  /* flattened candidate: ancestor levels kept */
+static const char * const K_CTIMERS = JS_HIDDEN_CHAR_STR"t";  /* flattened leaf: its chain's after list */
+
+/* Machine fields */
+static const char * const K_MVALID  = "_valid";     /* set once config passed validation */
+static const char * const K_MINIT   = "_init";      /* cached initial State (compiled machines) */
+static const char * const K_MEVENTS = "_events";    /* interned events not in the table */
 
 /* Machine state object fields */
 static const char * const S_VALUE   = "value";
 static const char * const S_CTX     = "context";
 static const char * const S_ACTS    = "actions";
+static const char * const S_NESTED  = JS_HIDDEN_CHAR_STR"n"; /* set on states of nested machines */
 
 /* Service fields */
 static const char * const K_MACHINE = "_machine";
 static const char * const K_SSTATE  = "_state";
 static const char * const K_SCTX    = "_context";
-static const char * const K_SSTATUS = "_status";
+static const char * const K_SACTS   = "_actsMap";   /* cached actions map (null = none) */
+static const char * const K_SQUEUE  = "_queue";     /* events sent while processing */
+static const char * const K_SLISTENERS = "_listeners"; /* array: listener id -> fn (null = removed) */
+static const char * const K_STIMERS = "_timers";    /* pending `after` timers: event name -> timer id */
+static const char * const K_STARM   = "_tarm";      /* [ms] per state depth: when its timers were armed */
+static const char * const K_SPRE    = "_pre";       /* subscribe() pre-notifications still queued */
 
 /* ---------------- Function invocation helper ---------------- */
 static JsVar *xfsm_callJsFunction(JsVar *fn, JsVar *thisArg, JsVar **argv, int argc) {
@@ -150,109 +200,71 @@ static JsVar *xfsm_callJsFunction(JsVar *fn, JsVar *thisArg, JsVar **argv, int a
   return res;
 }
 
-/** Notify all registered listeners with the current state (argument 0). */
-#include "jsutils.h"
-#include "jsinteractive.h"
-#include "jsparse.h"
-#include "jsvar.h"
-#include "xfsm.h"
-
-/** Notify all registered listeners with the current state (argument 0). */
-void xfsm_notify_listeners(JsVar *service) {
-  if (!service || !jsvIsObject(service)) return;
-
-  JsVar *listeners = jsvObjectGetChild(service, "_listeners", 0);
-  if (!listeners || !jsvIsObject(listeners)) { if (listeners) jsvUnLock(listeners); return; }
-
-  // Prefer backing state; fall back to getter if missing
-  JsVar *st = jsvObjectGetChild(service, K_SSTATE, 0);
-  if (!st) st = xfsm_service_get_state(service); // LOCKED or 0
-
-  JsvObjectIterator it;
-  jsvObjectIteratorNew(&it, listeners);
-  while (jsvObjectIteratorHasValue(&it)) {
-    JsVar *k  = jsvObjectIteratorGetKey(&it);
-    JsVar *fn = jsvObjectIteratorGetValue(&it);
-    jsvUnLock(k);
-    if (fn && jsvIsFunction(fn) && st) {
-      JsVar *argv[1] = { st };
-      JsVar *res = jspExecuteFunction(fn, service, 1, argv);
-      if (res) jsvUnLock(res);
-    }
-    if (fn) jsvUnLock(fn);
-    jsvObjectIteratorNext(&it);
-  }
-  jsvObjectIteratorFree(&it);
-
-  if (st) jsvUnLock(st);
-  jsvUnLock(listeners);
-}
-
-
 /* ---------------- Flat machine validation (reject nested states) ---------- */
+/* Native walk over config.states. Nested configs are only accepted by the
+ * compiled path (see "Nested states"); the constructor checks once and marks
+ * the Machine with _valid, so initialState()/interpret()/start() skip it. */
 bool xfsm_validate_no_nested_states(JsVar *machineConfig) {
   if (!machineConfig || !jsvIsObject(machineConfig)) return true;
-
-  JsVar *src = jsvNewFromString(
-    "(function(cfg){"
-      "if (!cfg || !cfg.states) return '';"
-      "var s = cfg.states, k;"
-      "for (k in s) { if (s[k] && s[k].states) return k || '<unknown>'; }"
-      "return '';"
-    "})"
-  );
-  if (!src) return true;
-
-  JsVar *fn = jspEvaluateVar(src, 0, "xfsm.validate.flat");
-  jsvUnLock(src);
-  if (!fn) return true;
+  JsVar *states = jsvObjectGetChild(machineConfig, "states", 0);
+  if (!states) return true;
 
   bool ok = true;
-  if (jsvIsFunction(fn)) {
-    JsVar *argv[1] = { machineConfig };
-    JsVar *res = jspExecuteFunction(fn, 0 /*this*/, 1, argv);
-    if (res) {
-      if (jsvIsString(res) && jsvGetStringLength(res) > 0) {
-        /* Convert to a plain string var */
-        JsVar *s = jsvAsString(res);
-        char buf[64];
-        size_t i = 0;
-
-        JsvStringIterator it;
-        jsvStringIteratorNew(&it, s, 0);
-        while (jsvStringIteratorHasChar(&it) && i < sizeof(buf) - 1) {
-          buf[i++] = (char)jsvStringIteratorGetChar(&it);
-          jsvStringIteratorNext(&it);
-        }
-        buf[i] = 0;
-        jsvStringIteratorFree(&it);
-        jsvUnLock(s);
-
-        if (buf[0]) {
+  if (jsvHasChildren(states)) {
+    JsvObjectIterator it;
+    jsvObjectIteratorNew(&it, states);
+    while (ok && jsvObjectIteratorHasValue(&it)) {
+      JsVar *st = jsvObjectIteratorGetValue(&it);
+      if (st && jsvHasChildren(st)) {
+        JsVar *sub = jsvObjectGetChild(st, "states", 0);
+        if (sub && jsvGetBool(sub)) {
+          JsVar *k = jsvObjectIteratorGetKey(&it);
           jsDebug(DBG_INFO,
-                  "XFSM: Nested states not supported (found nested under state \"%s\").\n",
-                  buf);
+                  "XFSM: Nested states need a compiled machine (found nested under state \"%v\").\n",
+                  k);
+          jsvUnLock(k);
           ok = false;
         }
+        if (sub) jsvUnLock(sub);
       }
-      jsvUnLock(res);
+      if (st) jsvUnLock(st);
+      jsvObjectIteratorNext(&it);
     }
+    jsvObjectIteratorFree(&it);
   }
-  jsvUnLock(fn);
+  jsvUnLock(states);
+  return ok;
+}
+
+/* Validate once per Machine: checks the _valid mark, validating and setting it if absent */
+static bool xfsm_machine_validated(JsVar *machine, JsVar *cfg) {
+  JsVar *v = jsvObjectGetChild(machine, K_MVALID, 0);
+  bool done = v && jsvGetBool(v);
+  if (v) jsvUnLock(v);
+  if (done) return true;
+  bool ok = xfsm_validate_no_nested_states(cfg);
+  if (ok) jsvObjectSetChildAndUnLock(machine, K_MVALID, jsvNewFromBool(true));
   return ok;
 }
 
 
 /* ---------------- Utilities ---------------- */
+#ifdef XFSM_HAS_V1
 static void set_status(JsVar *obj, const char *txt) {
   JsVar *v = jsvNewFromString(txt);
   jsvObjectSetChildAndUnLock(obj, K_STATUS, v);
 }
-static int str_from_jsv(JsVar *s, char *buf, size_t bufSize) {
-  if (!s || !jsvIsString(s) || bufSize == 0) return 0;
-  size_t n = jsvGetString(s, buf, bufSize-1);
-  buf[n] = 0;
-  return (int)n;
+#endif
+/* Child access keyed by a JsVar string/name rather than a C buffer, so
+ * state, event and key names are never truncated. */
+static JsVar *get_child_v(JsVar *o, JsVar *name) {
+  if (!o || !name) return 0;
+  return jsvSkipNameAndUnLock(jsvFindChildFromVar(o, name, false)); /* LOCKED or 0 */
+}
+static void set_child_v_and_unlock(JsVar *o, JsVar *name, JsVar *value) {
+  JsVar *n = jsvFindChildFromVar(o, name, true);
+  if (n) { jsvSetValueOfName(n, value); jsvUnLock(n); }
+  if (value) jsvUnLock(value);
 }
 static JsVar *getChildObj(JsVar *o, const char *k) {
   JsVar *v = jsvObjectGetChild(o, k, 0);
@@ -270,54 +282,90 @@ static JsVar *getChildObj(JsVar *o, const char *k) {
  *   context : copy/lock of the context object (if provided)
  *   actions : array of actions to execute (if provided)
  *   changed : bool (true if state value changed, false otherwise)
+ *
+ * The object is a `State` instance: `matches(s)` is the native
+ * State.prototype.matches (see xfsm_state_matches), shared by every state.
  */
-/* Build state object { value, context, actions, changed, matches } */
-static JsVar *new_state_obj(const char *value, JsVar *ctx /*locked or 0*/, JsVar *acts /*locked or 0*/, bool changed) {
-  JsVar *st = jsvNewObject();
+static JsVar *new_state_obj_v(JsVar *value /*locked string or 0*/, JsVar *ctx /*locked or 0*/, JsVar *acts /*locked or 0*/, bool changed) {
+  JsVar *st = jspNewObject(0, "State");
   if (!st) return 0;
 
-  if (value && value[0]) {
-    JsVar *sv = jsvNewFromString(value);
-    if (sv) jsvObjectSetChildAndUnLock(st, S_VALUE, sv);
-  }
+  if (value) jsvObjectSetChildAndUnLock(st, S_VALUE, jsvLockAgain(value));
   if (ctx) jsvObjectSetChildAndUnLock(st, S_CTX, jsvLockAgain(ctx));
   if (acts) jsvObjectSetChildAndUnLock(st, S_ACTS, jsvLockAgain(acts));
   jsvObjectSetChildAndUnLock(st, "changed", jsvNewFromBool(changed));
 
-/* Attach JS matches(stateName) per state (avoid shared instance issues) */
-{
-  JsVar *src = jsvNewFromString("(function(s){return this.value===s;})");
-  if (src) {
-    JsVar *fn = jspEvaluateVar(src, 0 /*global scope*/, "xfsm.matches");
-    jsvUnLock(src);
-    if (fn && jsvIsFunction(fn)) {
-      jsvObjectSetChildAndUnLock(st, "matches", fn); // fn still locked
-    } else if (fn) {
-      jsvUnLock(fn);
-    }
-  }
+  return st; /* LOCKED */
 }
 
-  return st; /* LOCKED */
+/* Update a service-owned state object in place ({ reuseState:true }).
+ * `changed` is only rewritten when it differs, so nothing is allocated. */
+static void reuse_state_obj(JsVar *st, JsVar *value, JsVar *ctx, JsVar *acts, bool changed) {
+  if (value) jsvObjectSetChildAndUnLock(st, S_VALUE, jsvLockAgain(value));
+  if (ctx) jsvObjectSetChildAndUnLock(st, S_CTX, jsvLockAgain(ctx));
+  if (acts) jsvObjectSetChildAndUnLock(st, S_ACTS, jsvLockAgain(acts));
+  JsVar *ch = jsvObjectGetChild(st, "changed", 0);
+  bool was = ch && jsvGetBool(ch);
+  if (ch) jsvUnLock(ch);
+  if (!ch || was != changed) jsvObjectSetChildAndUnLock(st, "changed", jsvNewFromBool(changed));
+}
+
+/* Mark a state object as belonging to a nested machine (leaf values are
+ * dotted paths). Flat machines' states carry nothing. */
+static void state_obj_set_nested(JsVar *st, bool nested) {
+  if (st && nested) jsvObjectSetChildAndUnLock(st, S_NESTED, jsvNewFromBool(true));
+}
+static bool state_obj_nested(JsVar *st) {
+  JsVar *v = jsvObjectGetChild(st, S_NESTED, 0);
+  bool nested = v && jsvGetBool(v);
+  if (v) jsvUnLock(v);
+  return nested;
+}
+
+/* state.matches(s): true if state.value equals s, or for nested machines
+ * if s is an ancestor of it. Flat machines compare exactly, so the flat
+ * states "sensor" and "sensor.imu" stay distinct. */
+bool xfsm_state_matches(JsVar *stateObj, JsVar *value) {
+  if (!stateObj || !value || !jsvIsString(value)) return false;
+  JsVar *sv = jsvObjectGetChild(stateObj, S_VALUE, 0);
+  bool eq = sv && jsvIsString(sv) && jsvCompareString(sv, value, 0, 0, false) == 0;
+  /* nested: "parent" also matches "parent.child" */
+  size_t n = jsvGetStringLength(value);
+  if (!eq && sv && jsvIsString(sv) && n && jsvGetStringLength(sv) > n && state_obj_nested(stateObj)) {
+    JsvStringIterator a, b;
+    jsvStringIteratorNew(&a, sv, 0);
+    jsvStringIteratorNew(&b, value, 0);
+    size_t i = 0;
+    while (i < n && jsvStringIteratorGetChar(&a) == jsvStringIteratorGetChar(&b)) {
+      jsvStringIteratorNext(&a); jsvStringIteratorNext(&b); i++;
+    }
+    eq = i == n && jsvStringIteratorGetChar(&a) == '.';
+    jsvStringIteratorFree(&a);
+    jsvStringIteratorFree(&b);
+  }
+  if (sv) jsvUnLock(sv);
+  return eq;
 }
 
 
-/* ---------------- Named function resolution ---------------- */
-static JsVar *resolveNamedFromConfig(JsVar *owner, const char *name) {
+/* ---------------- Named function resolution ----------------
+ * V1 guards only: config.actions, then the global scope. */
+#ifdef XFSM_HAS_V1
+static JsVar *resolveNamedFromConfig(JsVar *owner, JsVar *name) {
   JsVar *cfg = jsvObjectGetChild(owner, K_CFG, 0);
   if (!cfg || !jsvIsObject(cfg)) { if (cfg) jsvUnLock(cfg); return 0; }
   JsVar *cfgActs = getChildObj(cfg, K_ACTIONS);
   jsvUnLock(cfg);
   if (!cfgActs) return 0;
-  JsVar *fn = jsvObjectGetChild(cfgActs, name, 0); // locked or 0
+  JsVar *fn = get_child_v(cfgActs, name); // locked or 0
   jsvUnLock(cfgActs);
   if (fn && !jsvIsFunction(fn)) { jsvUnLock(fn); fn = 0; }
   return fn;
 }
-static JsVar *resolveNamedFromGlobal(const char *name) {
+static JsVar *resolveNamedFromGlobal(JsVar *name) {
   JsVar *root = jsvLockAgain(execInfo.root);
   if (!root) return 0;
-  JsVar *fn = jsvObjectGetChild(root, name, 0);
+  JsVar *fn = get_child_v(root, name);
   jsvUnLock(root);
   if (fn && !jsvIsFunction(fn)) { jsvUnLock(fn); fn = 0; }
   return fn; // locked or 0
@@ -326,25 +374,63 @@ static JsVar *resolveFunc(JsVar *owner, JsVar *item /*locked*/) {
   if (!item) return 0;
   if (jsvIsFunction(item)) return jsvLockAgain(item);
   if (jsvIsString(item)) {
-    char name[48]; str_from_jsv(item, name, sizeof(name));
-    if (!name[0]) return 0;
-    JsVar *fn = resolveNamedFromConfig(owner, name);
-    if (!fn) fn = resolveNamedFromGlobal(name);
+    if (!jsvGetStringLength(item)) return 0;
+    JsVar *fn = resolveNamedFromConfig(owner, item);
+    if (!fn) fn = resolveNamedFromGlobal(item);
     return fn; // locked or 0
   }
   return 0;
 }
+#endif
 
 /* ---------------- Built-in 'assign' support ---------------- */
 static bool is_string_eq(JsVar *v, const char *s) {
-  if (!v || !jsvIsString(v)) return false;
-  char buf[32]; size_t n = jsvGetString(v, buf, sizeof(buf)-1); buf[n] = 0;
-  return 0 == strcmp(buf, s);
+  return v && jsvIsString(v) && jsvIsStringEqual(v, s);
+}
+
+static void xfsm_service_claim_context(JsVar *svc, JsVar **pCtx);
+
+/* Native assign ops: a map value { $inc:n } | { $dec:n } | { $set:v } | { $event:"key" }
+ * is computed in C from the current ctx[key] / the event, without a JS call.
+ * Returns true if `spec` is an op (*pOut = new value, LOCKED, or 0 to leave
+ * the key unchanged), false if it is an ordinary value. */
+static bool apply_assign_op(JsVar *ctx, JsVar *key, JsVar *spec, JsVar *eventObj, JsVar **pOut) {
+  if (!jsvIsObject(spec) || jsvGetChildren(spec) != 1) return false;
+  JsvObjectIterator it;
+  jsvObjectIteratorNew(&it, spec);
+  JsVar *op = jsvObjectIteratorGetKey(&it);
+  JsVar *arg = jsvObjectIteratorGetValue(&it);
+  jsvObjectIteratorFree(&it);
+  bool isOp = true;
+  *pOut = 0;
+  if (jsvIsStringEqual(op, "$inc") || jsvIsStringEqual(op, "$dec")) {
+    bool dec = jsvIsStringEqual(op, "$dec");
+    JsVar *cur = jsvSkipNameAndUnLock(jsvFindChildFromVar(ctx, key, false));
+    if ((!cur || jsvIsInt(cur)) && jsvIsInt(arg)) {
+      JsVarInt n = cur ? jsvGetInteger(cur) : 0, d = jsvGetInteger(arg);
+      *pOut = jsvNewFromInteger(dec ? n - d : n + d);
+    } else {
+      JsVarFloat n = cur ? jsvGetFloat(cur) : 0, d = arg ? jsvGetFloat(arg) : 0;
+      *pOut = jsvNewFromFloat(dec ? n - d : n + d);
+    }
+    if (cur) jsvUnLock(cur);
+  } else if (jsvIsStringEqual(op, "$set")) {
+    *pOut = arg ? jsvLockAgain(arg) : 0;
+  } else if (jsvIsStringEqual(op, "$event")) {
+    if (eventObj && jsvHasChildren(eventObj) && arg && jsvIsString(arg))
+      *pOut = jsvSkipNameAndUnLock(jsvFindChildFromVar(eventObj, arg, false));
+  } else {
+    isOp = false;
+  }
+  if (arg) jsvUnLock(arg);
+  jsvUnLock(op);
+  return isOp;
 }
 
 /* Apply an 'assignment' spec (function or object) to produce a patch and merge */
 static void apply_assignment(JsVar *svc, JsVar **pCtx, JsVar *assignAction, JsVar *eventObj) {
   if (!pCtx) return;
+  xfsm_service_claim_context(svc, pCtx);
 
   /* Ensure we have a context object to write to */
   if (!*pCtx || !jsvIsObject(*pCtx)) {
@@ -375,13 +461,7 @@ static void apply_assignment(JsVar *svc, JsVar **pCtx, JsVar *assignAction, JsVa
       while (jsvObjectIteratorHasValue(&it)) {
         JsVar *k = jsvObjectIteratorGetKey(&it);
         JsVar *v = jsvObjectIteratorGetValue(&it);
-        if (k && v) {
-          /* Coerce key safely */
-          JsVar *kstr = jsvAsString(k);
-          char keybuf[64] = "";
-          if (kstr) { jsvGetString(kstr, keybuf, sizeof(keybuf)); jsvUnLock(kstr); }
-          if (keybuf[0]) jsvObjectSetChildAndUnLock(*pCtx, keybuf, jsvLockAgain(v));
-        }
+        if (k && v) set_child_v_and_unlock(*pCtx, k, jsvLockAgain(v));
         if (k) jsvUnLock(k);
         if (v) jsvUnLock(v);
         jsvObjectIteratorNext(&it);
@@ -393,7 +473,7 @@ static void apply_assignment(JsVar *svc, JsVar **pCtx, JsVar *assignAction, JsVa
     return;
   }
 
-  /* Case 2: object map { key: const | fn(ctx,evt) } */
+  /* Case 2: object map { key: const | fn(ctx,evt) | { $op: arg } } */
   if (jsvIsObject(payload)) {
     JsvObjectIterator it;
     jsvObjectIteratorNew(&it, payload);
@@ -401,22 +481,19 @@ static void apply_assignment(JsVar *svc, JsVar **pCtx, JsVar *assignAction, JsVa
       JsVar *k = jsvObjectIteratorGetKey(&it);
       JsVar *v = jsvObjectIteratorGetValue(&it);
       if (k) {
-        JsVar *kstr = jsvAsString(k);
-        char keybuf[64] = "";
-        if (kstr) { jsvGetString(kstr, keybuf, sizeof(keybuf)); jsvUnLock(kstr); }
-        if (keybuf[0]) {
-          JsVar *out = 0;
-          if (v && jsvIsFunction(v)) {
-            JsVar *args[2] = { jsvLockAgain(*pCtx), eventObj ? jsvLockAgain(eventObj) : jsvNewObject() };
-            JsVar *res = xfsm_callJsFunction(v, 0, args, 2);
-            if (args[0]) jsvUnLock(args[0]);
-            if (args[1]) jsvUnLock(args[1]);
-            if (res) { out = jsvLockAgain(res); jsvUnLock(res); }
-          } else if (v) {
-            out = jsvLockAgain(v);
-          }
-          if (out) jsvObjectSetChildAndUnLock(*pCtx, keybuf, out);
+        JsVar *out = 0;
+        if (v && jsvIsFunction(v)) {
+          JsVar *args[2] = { jsvLockAgain(*pCtx), eventObj ? jsvLockAgain(eventObj) : jsvNewObject() };
+          JsVar *res = xfsm_callJsFunction(v, 0, args, 2);
+          if (args[0]) jsvUnLock(args[0]);
+          if (args[1]) jsvUnLock(args[1]);
+          if (res) { out = jsvLockAgain(res); jsvUnLock(res); }
+        } else if (v && apply_assign_op(*pCtx, k, v, eventObj, &out)) {
+          /* native op: `out` computed in C (0 = leave the key unchanged) */
+        } else if (v) {
+          out = jsvLockAgain(v);
         }
+        if (out) set_child_v_and_unlock(*pCtx, k, out);
       }
       if (k) jsvUnLock(k);
       if (v) jsvUnLock(v);
@@ -427,7 +504,155 @@ static void apply_assignment(JsVar *svc, JsVar **pCtx, JsVar *assignAction, JsVa
   jsvUnLock(payload);
 }
 
-/* ---------------- Raw actions accessors ---------------- */
+/* ---------------- Guards (function or declarative) ----------------
+ * A cond is either a function (ctx, evt) or a declarative object such as
+ *   { lt:["ctx.count", 10] }   { eq:["evt.mode", "fast"] }   { in:["evt.key", [1,2]] }
+ * Operand 0 is a "ctx.<key>" / "evt.<key>" path; operand 1 is a path of the
+ * same form or a literal. Several ops in one object must all pass. Declarative
+ * guards are compared in C: no JS call and nothing allocated on compiled
+ * machines, which pre-split the paths once at compile time. */
+#define XFSM_GOP_EQ   0
+#define XFSM_GOP_NE   1
+#define XFSM_GOP_LT   2
+#define XFSM_GOP_LTE  3
+#define XFSM_GOP_GT   4
+#define XFSM_GOP_GTE  5
+#define XFSM_GOP_IN   6
+
+#define XFSM_GSRC_LIT 0   /* literal operand */
+#define XFSM_GSRC_CTX 1   /* ctx.<key> */
+#define XFSM_GSRC_EVT 2   /* evt.<key> */
+
+static const char * const xfsm_guard_ops[] = { "eq", "ne", "lt", "lte", "gt", "gte", "in" };
+
+/* Op code for a guard key, or -1 if unknown */
+static int xfsm_guard_op(JsVar *name) {
+  for (int i = 0; i < (int)(sizeof(xfsm_guard_ops) / sizeof(xfsm_guard_ops[0])); i++)
+    if (jsvIsStringEqual(name, xfsm_guard_ops[i])) return i;
+  return -1;
+}
+
+/* Split a "ctx.<key>" / "evt.<key>" operand: LOCKED key string and *pSrc, or 0 (a literal) */
+static JsVar *xfsm_guard_path(JsVar *v, int *pSrc) {
+  if (!v || !jsvIsString(v) || jsvGetStringLength(v) <= 4) return 0;
+  if (jsvIsStringEqualOrStartsWith(v, "ctx.", true)) *pSrc = XFSM_GSRC_CTX;
+  else if (jsvIsStringEqualOrStartsWith(v, "evt.", true)) *pSrc = XFSM_GSRC_EVT;
+  else return 0;
+  return jsvNewFromStringVar(v, 4, JSVAPPENDSTRINGVAR_MAXLENGTH);
+}
+
+/* ctx/evt property named by key (LOCKED) or 0 */
+static JsVar *xfsm_guard_read(int src, JsVar *key, JsVar *ctx, JsVar *evt) {
+  JsVar *obj = src == XFSM_GSRC_CTX ? ctx : evt;
+  if (!obj || !key || !jsvHasChildren(obj)) return 0;
+  return jsvSkipNameAndUnLock(jsvFindChildFromVar(obj, key, false));
+}
+
+/* Strict comparison: -1/0/1, or -2 when the values are of different kinds (or NaN) */
+static int xfsm_guard_cmp(JsVar *a, JsVar *b) {
+  bool aNum = jsvIsInt(a) || jsvIsFloat(a), bNum = jsvIsInt(b) || jsvIsFloat(b);
+  if (aNum && bNum) {
+    if (jsvIsInt(a) && jsvIsInt(b)) {
+      JsVarInt x = jsvGetInteger(a), y = jsvGetInteger(b);
+      return x < y ? -1 : (x > y ? 1 : 0);
+    }
+    JsVarFloat x = jsvGetFloat(a), y = jsvGetFloat(b);
+    return x < y ? -1 : (x > y ? 1 : (x == y ? 0 : -2));
+  }
+  if (jsvIsString(a) && jsvIsString(b)) {
+    int c = jsvCompareString(a, b, 0, 0, false);
+    return c < 0 ? -1 : (c > 0 ? 1 : 0);
+  }
+  if (jsvIsBoolean(a) && jsvIsBoolean(b)) return (int)jsvGetBool(a) - (int)jsvGetBool(b);
+  bool aNone = !a || jsvIsUndefined(a), bNone = !b || jsvIsUndefined(b);
+  if (aNone || bNone) return (aNone && bNone) ? 0 : -2;
+  if (jsvIsNull(a) && jsvIsNull(b)) return 0;
+  return -2;
+}
+
+static bool xfsm_guard_test(int op, JsVar *a, JsVar *b) {
+  if (op == XFSM_GOP_IN) {
+    if (!b || !jsvIsArray(b)) return false;
+    bool found = false;
+    JsvObjectIterator it;
+    jsvObjectIteratorNew(&it, b);
+    while (!found && jsvObjectIteratorHasValue(&it)) {
+      JsVar *v = jsvObjectIteratorGetValue(&it);
+      found = xfsm_guard_cmp(a, v) == 0;
+      if (v) jsvUnLock(v);
+      jsvObjectIteratorNext(&it);
+    }
+    jsvObjectIteratorFree(&it);
+    return found;
+  }
+  int c = xfsm_guard_cmp(a, b);
+  switch (op) {
+    case XFSM_GOP_EQ:  return c == 0;
+    case XFSM_GOP_NE:  return c != 0;
+    case XFSM_GOP_LT:  return c == -1;
+    case XFSM_GOP_LTE: return c == -1 || c == 0;
+    case XFSM_GOP_GT:  return c == 1;
+    case XFSM_GOP_GTE: return c == 1 || c == 0;
+  }
+  return false;
+}
+
+/* Interpretive evaluation of a declarative guard object (paths split per call) */
+static bool xfsm_guard_eval(JsVar *cond, JsVar *ctx, JsVar *evt) {
+  bool pass = true;
+  JsvObjectIterator it;
+  jsvObjectIteratorNew(&it, cond);
+  while (pass && jsvObjectIteratorHasValue(&it)) {
+    JsVar *k = jsvObjectIteratorGetKey(&it);
+    JsVar *args = jsvObjectIteratorGetValue(&it);
+    int op = xfsm_guard_op(k);
+    JsVar *pa = (op >= 0 && args && jsvIsArray(args)) ? jsvGetArrayItem(args, 0) : 0;
+    JsVar *pb = pa ? jsvGetArrayItem(args, 1) : 0;
+    int srcA = XFSM_GSRC_LIT, srcB = XFSM_GSRC_LIT;
+    JsVar *keyA = xfsm_guard_path(pa, &srcA);
+    JsVar *keyB = keyA ? xfsm_guard_path(pb, &srcB) : 0;
+    pass = false;                                  /* unknown op or bad operand: fails */
+    if (keyA) {
+      JsVar *a = xfsm_guard_read(srcA, keyA, ctx, evt);
+      JsVar *b = keyB ? xfsm_guard_read(srcB, keyB, ctx, evt) : (pb ? jsvLockAgain(pb) : 0);
+      pass = xfsm_guard_test(op, a, b);
+      if (a) jsvUnLock(a);
+      if (b) jsvUnLock(b);
+    }
+    if (keyA) jsvUnLock(keyA);
+    if (keyB) jsvUnLock(keyB);
+    if (pa) jsvUnLock(pa);
+    if (pb) jsvUnLock(pb);
+    if (args) jsvUnLock(args);
+    jsvUnLock(k);
+    jsvObjectIteratorNext(&it);
+  }
+  jsvObjectIteratorFree(&it);
+  return pass;
+}
+
+/* Call a guard function with (ctx, evt); ctx defaults to a fresh {} */
+static bool xfsm_guard_call(JsVar *fn, JsVar *ctx, JsVar *evt) {
+  JsVar *args[2] = { ctx ? jsvLockAgain(ctx) : jsvNewObject(), jsvLockAgain(evt) };
+  XFSM_PROF_COUNT(guards);
+  JsVar *res = xfsm_callJsFunction(fn, 0, args, 2);
+  if (args[0]) jsvUnLock(args[0]);
+  if (args[1]) jsvUnLock(args[1]);
+  bool pass = res ? jsvGetBool(res) : false;  /* truthiness via jsvGetBool */
+  if (res) jsvUnLock(res);
+  return pass;
+}
+
+/* Interpretive guard of a candidate: function, declarative object, or none */
+static bool xfsm_cond_passes(JsVar *cond, JsVar *ctx, JsVar *evt) {
+  if (!cond) return true;
+  if (jsvIsFunction(cond)) return xfsm_guard_call(cond, ctx, evt);
+  if (jsvIsObject(cond)) return xfsm_guard_eval(cond, ctx, evt);
+  return true;
+}
+
+/* ---------------- Raw actions accessors (V1) ---------------- */
+#ifdef XFSM_HAS_V1
 static JsVar *getActionListRaw(JsVar *node, const char *key) {
   JsVar *v = jsvObjectGetChild(node, key, 0); // locked or 0
   if (!v) return 0;
@@ -441,6 +666,7 @@ static JsVar *getTransitionActionsRaw(JsVar *transitionObj) {
   /* may be array or single item; caller handles both forms */
   return acts; // locked
 }
+#endif
 
 /* Detect if an action item is 'assign'-like (xstate.assign/assign or shorthand object)
  * Rules:
@@ -453,12 +679,9 @@ static bool is_assign_like(JsVar *item) {
   JsVar *typ = jsvObjectGetChild(item, "type", 0);
   if (typ) {
     if (jsvIsString(typ)) {
-      char tbuf[32];
-      int tlen = jsvGetString(typ, tbuf, sizeof(tbuf)-1);
-      if (tlen < 0) tlen = 0;
-      tbuf[tlen] = 0;
+      bool assign = jsvIsStringEqual(typ, "xstate.assign") || jsvIsStringEqual(typ, "assign");
       jsvUnLock(typ);
-      if (!strcmp(tbuf, "xstate.assign") || !strcmp(tbuf, "assign")) return true;
+      if (assign) return true;
       // has a non-assign type => not assign-like
       return false;
     }
@@ -471,6 +694,170 @@ static bool is_assign_like(JsVar *item) {
   return true;
 }
 
+/* Machine-level actions map (LOCKED or 0):
+ *   machine._options.actions, then config.options.actions, then config.actions */
+static JsVar *xfsm_machine_actions_map(JsVar *mach) {
+  if (!mach) return 0;
+  JsVar *actsMap = 0;
+  JsVar *mopts = jsvObjectGetChild(mach, "_options", 0);
+  if (mopts) {
+    actsMap = jsvObjectGetChild(mopts, "actions", 0);
+    jsvUnLock(mopts);
+  }
+  if (!actsMap) {
+    JsVar *cfg = jsvObjectGetChild(mach, "config", 0);
+    if (cfg) {
+      JsVar *copt = jsvObjectGetChild(cfg, "options", 0);
+      if (copt) {
+        actsMap = jsvObjectGetChild(copt, "actions", 0);
+        jsvUnLock(copt);
+      }
+      if (!actsMap)
+        actsMap = jsvObjectGetChild(cfg, "actions", 0);
+      jsvUnLock(cfg);
+    }
+  }
+  if (actsMap && !jsvIsObject(actsMap)) { jsvUnLock(actsMap); actsMap = 0; }
+  return actsMap;
+}
+
+/* --- Resolve actions map (preferred -> fallbacks) ---
+ * 1) service._options.actions
+ * 2) service._machine._options.actions
+ * 3) service._machine.config.options.actions
+ * 4) service._machine.config.actions
+ * LOCKED or 0. Services cache the result in _actsMap. */
+static JsVar *xfsm_actions_map(JsVar *service) {
+  JsVar *actsMap = 0;
+  JsVar *opts = jsvObjectGetChild(service, "_options", 0);
+  if (opts) {
+    actsMap = jsvObjectGetChild(opts, "actions", 0);
+    jsvUnLock(opts);
+  }
+  if (actsMap && !jsvIsObject(actsMap)) { jsvUnLock(actsMap); actsMap = 0; }
+  if (!actsMap) {
+    JsVar *mach = jsvObjectGetChild(service, "_machine", 0);
+    actsMap = xfsm_machine_actions_map(mach);
+    if (mach) jsvUnLock(mach);
+  }
+  return actsMap;
+}
+
+/* Is this action looked up by name ("name" or non-assign { type:"name" })? */
+static bool is_named_action(JsVar *item) {
+  if (jsvIsString(item)) return true;
+  if (!jsvIsObject(item) || is_assign_like(item)) return false;
+  JsVar *exec = jsvObjectGetChild(item, "exec", 0);
+  bool hasExec = exec && jsvIsFunction(exec);
+  if (exec) jsvUnLock(exec);
+  return !hasExec;
+}
+
+/* Function a named action resolves to in actsMap (LOCKED or 0) */
+static JsVar *resolve_named_action(JsVar *actsMap, JsVar *item) {
+  if (!actsMap) return 0;
+  JsVar *name = jsvIsString(item) ? jsvLockAgain(item) : jsvObjectGetChild(item, "type", 0);
+  JsVar *fn = 0;
+  if (name && jsvIsString(name)) {
+    JsVar *n = jsvFindChildFromVar(actsMap, name, false);
+    fn = n ? jsvSkipNameAndUnLock(n) : 0;
+    if (fn && !jsvIsFunction(fn)) { jsvUnLock(fn); fn = 0; }
+  }
+  if (name) jsvUnLock(name);
+  return fn;
+}
+
+/* Partition helpers for compiled lists (see run_actions_split).
+ * fill_effects: dst[j] = the j-th non-assign item of src, with each named
+ * action that resolves in actsMap replaced by its function. Unresolved names
+ * are kept and looked up at run time as before. Safe to repeat on the same
+ * dst (items are overwritten in place). */
+static void fill_effects(JsVar *dst, JsVar *src, JsVar *actsMap) {
+  JsVarInt j = 0;
+  JsvObjectIterator it;
+  jsvObjectIteratorNew(&it, src);
+  while (jsvObjectIteratorHasValue(&it)) {
+    JsVar *a = jsvObjectIteratorGetValue(&it);
+    if (a && !(jsvIsObject(a) && is_assign_like(a))) {
+      JsVar *fn = is_named_action(a) ? resolve_named_action(actsMap, a) : 0;
+      jsvSetArrayItem(dst, j++, fn ? fn : a);
+      if (fn) jsvUnLock(fn);
+    }
+    if (a) jsvUnLock(a);
+    jsvObjectIteratorNext(&it);
+  }
+  jsvObjectIteratorFree(&it);
+}
+
+/* Count the assign-like items of a list */
+static int count_assigns(JsVar *list) {
+  int n = 0;
+  JsvObjectIterator it;
+  jsvObjectIteratorNew(&it, list);
+  while (jsvObjectIteratorHasValue(&it)) {
+    JsVar *a = jsvObjectIteratorGetValue(&it);
+    if (a && jsvIsObject(a) && is_assign_like(a)) n++;
+    if (a) jsvUnLock(a);
+    jsvObjectIteratorNext(&it);
+  }
+  jsvObjectIteratorFree(&it);
+  return n;
+}
+
+/* Call an action function as fn(ctx, evt) with this = service */
+static void call_action_fn(JsVar *service, JsVar *fn, JsVar *ctx, JsVar *eventObj) {
+  JsVar *argv[2] = {ctx ? jsvLockAgain(ctx) : jsvNewObject(),
+                    eventObj ? jsvLockAgain(eventObj) : jsvNewObject()};
+  JsVar *res = jspExecuteFunction(fn, service, 2, argv);
+  if (res)
+    jsvUnLock(res);
+  if (argv[0])
+    jsvUnLock(argv[0]);
+  if (argv[1])
+    jsvUnLock(argv[1]);
+}
+
+/* Execute one non-assign action:
+ *   - function(ctx,evt)
+ *   - { exec:function(ctx,evt) }
+ *   - "name" / { type:"name" } -> lookup in actsMap (unknown names are ignored)
+ */
+static void exec_effect(JsVar *service, JsVar *ctx, JsVar *item, JsVar *eventObj, JsVar *actsMap) {
+  /* A) direct function */
+  if (jsvIsFunction(item)) {
+    call_action_fn(service, item, ctx, eventObj);
+    return;
+  }
+
+  /* B1) { exec:function } */
+  if (jsvIsObject(item)) {
+    JsVar *exec = jsvObjectGetChild(item, "exec", 0);
+    bool isFn = exec && jsvIsFunction(exec);
+    if (isFn) call_action_fn(service, exec, ctx, eventObj);
+    if (exec)
+      jsvUnLock(exec);
+    if (isFn) return;
+  }
+
+  /* B2) { type:"..." } (non-assign) and C) "name" -> resolve via actions map */
+  if (jsvIsObject(item) || jsvIsString(item)) {
+    JsVar *fn = resolve_named_action(actsMap, item);
+    if (fn) {
+      call_action_fn(service, fn, ctx, eventObj);
+      jsvUnLock(fn);
+    }
+  }
+}
+
+/* Actions map for a service (LOCKED or 0): cached on Services by
+ * xfsm_service_init (null = none), otherwise the fallback chain. */
+static JsVar *xfsm_cached_actions_map(JsVar *service) {
+  JsVar *actsMap = jsvObjectGetChild(service, K_SACTS, 0);
+  if (!actsMap) actsMap = xfsm_actions_map(service);
+  else if (!jsvIsObject(actsMap)) { jsvUnLock(actsMap); actsMap = 0; }
+  return actsMap;
+}
+
 /* Execute an array of actions against (ctx,event).
  * Call sites (kept compatible):
  *   run_actions_raw(service, &ctx, exitActs,  event, fromName, toName);
@@ -483,6 +870,11 @@ static bool is_assign_like(JsVar *item) {
  *   - "name"                -> lookup in actions map(s)
  *   - { type:"name" }       -> lookup in actions map(s)
  *   - xstate.assign family  -> apply_assignment(...) (updates *pCtx)
+ *
+ * Assigns are applied first, then the other actions run in listed order.
+ * Both passes use object iterators; the first pass remembers which of the
+ * first 32 items were assigns so the second does not re-test them.
+ * Compiled machines pre-split their lists instead (see run_actions_split).
  */
 void run_actions_raw(JsVar *service, JsVar **pCtx, JsVar *actionsArr,
                             JsVar *eventObj, const char *fromName,
@@ -492,181 +884,104 @@ void run_actions_raw(JsVar *service, JsVar **pCtx, JsVar *actionsArr,
   if (!actionsArr)
     return;
 
-  /* --- Resolve actions map (preferred -> fallbacks) ---
-   * 1) service._options.actions
-   * 2) service._machine._options.actions
-   * 3) service._machine.config.options.actions
-   * 4) service._machine.config.actions
-   */
-  JsVar *actsMap = 0;
-  {
-    JsVar *opts = jsvObjectGetChild(service, "_options", 0);
-    if (opts) {
-      actsMap = jsvObjectGetChild(opts, "actions", 0);
-      jsvUnLock(opts);
-    }
-    if (!actsMap) {
-      JsVar *mach = jsvObjectGetChild(service, "_machine", 0);
-      if (mach) {
-        JsVar *mopts = jsvObjectGetChild(mach, "_options", 0);
-        if (mopts) {
-          actsMap = jsvObjectGetChild(mopts, "actions", 0);
-          jsvUnLock(mopts);
-        }
-        if (!actsMap) {
-          JsVar *cfg = jsvObjectGetChild(mach, "config", 0);
-          if (cfg) {
-            JsVar *copt = jsvObjectGetChild(cfg, "options", 0);
-            if (copt) {
-              actsMap = jsvObjectGetChild(copt, "actions", 0);
-              jsvUnLock(copt);
-            }
-            if (!actsMap)
-              actsMap = jsvObjectGetChild(cfg, "actions", 0);
-            jsvUnLock(cfg);
-          }
-        }
-        jsvUnLock(mach);
-      }
-    }
+  JsVar *actsMap = xfsm_cached_actions_map(service);
+
+  if (!jsvIsArray(actionsArr)) {
+    /* single (non-array) item */
+    if (jsvIsObject(actionsArr) && is_assign_like(actionsArr))
+      apply_assignment(service, pCtx, actionsArr, eventObj);
+    else
+      exec_effect(service, *pCtx, actionsArr, eventObj, actsMap);
+    XFSM_PROF_COUNT(actions);
+    if (actsMap)
+      jsvUnLock(actsMap);
+    return;
   }
 
-  bool isArr = jsvIsArray(actionsArr);
-  unsigned int len = isArr ? (unsigned int)jsvGetArrayLength(actionsArr) : (unsigned int)1;
-
   /* PASS 1: apply all assign-like items to update *pCtx before other actions */
-  for (unsigned int i = 0; i < len; i++) {
-    JsVar *item = isArr ? jsvGetArrayItem(actionsArr, (JsVarInt)i)
-                        : jsvLockAgain(actionsArr); // LOCKED
-    if (!item) continue;
-
-    if (jsvIsObject(item) && is_assign_like(item)) {
+  uint32_t assignMask = 0;
+  unsigned int i = 0;
+  JsvObjectIterator it;
+  jsvObjectIteratorNew(&it, actionsArr);
+  while (jsvObjectIteratorHasValue(&it)) {
+    JsVar *item = jsvObjectIteratorGetValue(&it); // LOCKED
+    if (item && jsvIsObject(item) && is_assign_like(item)) {
+      if (i < 32) assignMask |= (uint32_t)1 << i;
       apply_assignment(service, pCtx, item, eventObj);
-      jsvUnLock(item);
-      continue;
+      XFSM_PROF_COUNT(actions);
     }
-
-    jsvUnLock(item);
+    if (item)
+      jsvUnLock(item);
+    jsvObjectIteratorNext(&it);
+    i++;
   }
+  jsvObjectIteratorFree(&it);
 
   /* PASS 2: execute non-assign actions in listed order */
-  for (unsigned int i = 0; i < len; i++) {
-    JsVar *item = isArr ? jsvGetArrayItem(actionsArr, (JsVarInt)i)
-                        : jsvLockAgain(actionsArr); // LOCKED
-    if (!item) continue;
-
-    /* Skip assign-like items here (already applied) */
-    if (jsvIsObject(item) && is_assign_like(item)) {
-      jsvUnLock(item);
-      continue;
-    }
-
-    bool handled = false;
-
-    /* A) direct function */
-    if (!handled && jsvIsFunction(item)) {
-      JsVar *argv[2] = {*pCtx ? jsvLockAgain(*pCtx) : jsvNewObject(),
-                        eventObj ? jsvLockAgain(eventObj) : jsvNewObject()};
-      JsVar *res = jspExecuteFunction(item, service, 2, argv);
-      if (res)
-        jsvUnLock(res);
-      if (argv[0])
-        jsvUnLock(argv[0]);
-      if (argv[1])
-        jsvUnLock(argv[1]);
-      handled = true;
-    }
-
-    /* B) object action */
-    if (!handled && jsvIsObject(item)) {
-      /* B1) { exec:function } */
-      JsVar *exec = jsvObjectGetChild(item, "exec", 0);
-      if (exec && jsvIsFunction(exec)) {
-        JsVar *argv[2] = {*pCtx ? jsvLockAgain(*pCtx) : jsvNewObject(),
-                          eventObj ? jsvLockAgain(eventObj) : jsvNewObject()};
-        JsVar *res = jspExecuteFunction(exec, service, 2, argv);
-        if (res)
-          jsvUnLock(res);
-        if (argv[0])
-          jsvUnLock(argv[0]);
-        if (argv[1])
-          jsvUnLock(argv[1]);
-        handled = true;
-      }
-      if (exec)
-        jsvUnLock(exec);
-
-      /* B2) { type:"..." } (non-assign) */
-      if (!handled) {
-        JsVar *typ = jsvObjectGetChild(item, "type", 0);
-        if (typ && jsvIsString(typ)) {
-          char tbuf[32];
-          int tlen = jsvGetString(typ, tbuf, sizeof(tbuf) - 1);
-          if (tlen < 0)
-            tlen = 0;
-          tbuf[tlen] = 0;
-
-          if (actsMap && jsvIsObject(actsMap)) {
-            /* NEW: object-form named action via actions map(s) */
-            JsVar *fn = jsvObjectGetChild(actsMap, tbuf, 0);
-            if (fn && jsvIsFunction(fn)) {
-              JsVar *argv[2] = {*pCtx ? jsvLockAgain(*pCtx) : jsvNewObject(),
-                                eventObj ? jsvLockAgain(eventObj)
-                                         : jsvNewObject()};
-              JsVar *res = jspExecuteFunction(fn, service, 2, argv);
-              if (res)
-                jsvUnLock(res);
-              if (argv[0])
-                jsvUnLock(argv[0]);
-              if (argv[1])
-                jsvUnLock(argv[1]);
-              handled = true;
-            }
-            if (fn)
-              jsvUnLock(fn);
-          }
-        }
-        if (typ)
-          jsvUnLock(typ);
-      }
-
-      /* B3) (removed) shorthand assign handled in PASS 1 */
-    }
-
-    /* C) "name" -> resolve via actions map(s) */
-    if (!handled && jsvIsString(item) && actsMap && jsvIsObject(actsMap)) {
-      char nbuf[32];
-      int nlen = jsvGetString(item, nbuf, sizeof(nbuf) - 1);
-      if (nlen < 0)
-        nlen = 0;
-      nbuf[nlen] = 0;
-      JsVar *fn = jsvObjectGetChild(actsMap, nbuf, 0);
-      if (fn && jsvIsFunction(fn)) {
-        JsVar *argv[2] = {*pCtx ? jsvLockAgain(*pCtx) : jsvNewObject(),
-                          eventObj ? jsvLockAgain(eventObj) : jsvNewObject()};
-        JsVar *res = jspExecuteFunction(fn, service, 2, argv);
-        if (res)
-          jsvUnLock(res);
-        if (argv[0])
-          jsvUnLock(argv[0]);
-        if (argv[1])
-          jsvUnLock(argv[1]);
-        handled = true;
-      }
-      if (fn)
-        jsvUnLock(fn);
+  i = 0;
+  jsvObjectIteratorNew(&it, actionsArr);
+  while (jsvObjectIteratorHasValue(&it)) {
+    bool isAssign = (i < 32) ? ((assignMask >> i) & 1) != 0 : false;
+    JsVar *item = jsvObjectIteratorGetValue(&it); // LOCKED
+    if (item && i >= 32) isAssign = jsvIsObject(item) && is_assign_like(item);
+    if (item && !isAssign) {
+      exec_effect(service, *pCtx, item, eventObj, actsMap);
+      XFSM_PROF_COUNT(actions);
     }
-
-    jsvUnLock(item);
+    if (item)
+      jsvUnLock(item);
+    jsvObjectIteratorNext(&it);
+    i++;
   }
+  jsvObjectIteratorFree(&it);
 
   if (actsMap)
     jsvUnLock(actsMap);
 }
 
+/* Execute a pre-partitioned action list: every item of `assigns` is an
+ * assign, `effects` holds the rest in order (named ones usually already
+ * resolved to functions). Either may be 0. */
+static void run_actions_split(JsVar *service, JsVar **pCtx, JsVar *assigns,
+                              JsVar *effects, JsVar *eventObj) {
+  JsvObjectIterator it;
+  if (assigns) {
+    jsvObjectIteratorNew(&it, assigns);
+    while (jsvObjectIteratorHasValue(&it)) {
+      JsVar *item = jsvObjectIteratorGetValue(&it);
+      if (item) { apply_assignment(service, pCtx, item, eventObj); XFSM_PROF_COUNT(actions); jsvUnLock(item); }
+      jsvObjectIteratorNext(&it);
+    }
+    jsvObjectIteratorFree(&it);
+  }
+  if (effects) {
+    JsVar *actsMap = 0;
+    bool haveMap = false;
+    jsvObjectIteratorNew(&it, effects);
+    while (jsvObjectIteratorHasValue(&it)) {
+      JsVar *item = jsvObjectIteratorGetValue(&it);
+      if (item && jsvIsFunction(item)) {
+        call_action_fn(service, item, *pCtx, eventObj);
+        XFSM_PROF_COUNT(actions);
+      } else if (item) {
+        if (!haveMap) { actsMap = xfsm_cached_actions_map(service); haveMap = true; }
+        exec_effect(service, *pCtx, item, eventObj, actsMap);
+        XFSM_PROF_COUNT(actions);
+      }
+      if (item)
+        jsvUnLock(item);
+      jsvObjectIteratorNext(&it);
+    }
+    jsvObjectIteratorFree(&it);
+    if (actsMap)
+      jsvUnLock(actsMap);
+  }
+}
+
 /* ========================================================================== */
 /*                         V1: Single-object FSM                              */
 /* ========================================================================== */
+#ifdef XFSM_HAS_V1
 void xfsm_init_object(JsVar *fsmObject) {
   if (!fsmObject) return;
   JsVar *v = jsvObjectGetChild(fsmObject, K_STATUS, 0);
@@ -697,13 +1012,12 @@ XfsmStatus xfsm_start_object(JsVar *fsmObject, JsVar *initialState /*locked or 0
   JsVar *ctx   = cfg ? jsvObjectGetChild(cfg, K_CONTEXT, 0) : 0;
   JsVar *states= cfg ? getChildObj(cfg, K_STATES) : 0;
 
-  char toBuf[64]={0}; JsVar *stateVal = jsvObjectGetChild(fsmObject, K_STATE, 0);
-  if (stateVal){ str_from_jsv(stateVal,toBuf,sizeof(toBuf)); jsvUnLock(stateVal); }
-
-  JsVar *node = (states && toBuf[0]) ? jsvObjectGetChild(states, toBuf, 0) : 0;
+  JsVar *stateVal = jsvObjectGetChild(fsmObject, K_STATE, 0);
+  JsVar *node = (states && stateVal && jsvIsString(stateVal)) ? get_child_v(states, stateVal) : 0;
+  if (stateVal) jsvUnLock(stateVal);
   JsVar *entryActs = (node && jsvIsObject(node)) ? getActionListRaw(node, K_ENTRY) : 0;
 
-  run_actions_raw(fsmObject, &ctx, entryActs, 0, 0, toBuf);
+  run_actions_raw(fsmObject, &ctx, entryActs, 0, 0, 0);
 
   if (entryActs) jsvUnLock(entryActs);
   if (node) jsvUnLock(node);
@@ -726,9 +1040,8 @@ XfsmStatus xfsm_status_object(JsVar *fsmObject) {
   if (!v) return XFSM_STATUS_NOTSTARTED;
   XfsmStatus st = XFSM_STATUS_NOTSTARTED;
   if (jsvIsString(v)) {
-    char sbuf[16]; str_from_jsv(v,sbuf,sizeof(sbuf));
-    if (!strcmp(sbuf,"Running")) st=XFSM_STATUS_RUNNING;
-    else if (!strcmp(sbuf,"Stopped")) st=XFSM_STATUS_STOPPED;
+    if (jsvIsStringEqual(v,"Running")) st=XFSM_STATUS_RUNNING;
+    else if (jsvIsStringEqual(v,"Stopped")) st=XFSM_STATUS_STOPPED;
   }
   jsvUnLock(v);
   return st;
@@ -747,20 +1060,18 @@ JsVar *xfsm_send_object(JsVar *fsmObject, JsVar *event /* string */) {
 
   JsVar *cur = jsvObjectGetChild(fsmObject, K_STATE, 0);
   if (!cur || !jsvIsString(cur)) { if (cur) jsvUnLock(cur); return 0; }
-  char fromBuf[64]; str_from_jsv(cur, fromBuf, sizeof(fromBuf));
 
   JsVar *cfg    = getChildObj(fsmObject, K_CFG);
   JsVar *states = cfg ? getChildObj(cfg, K_STATES) : 0;
   if (!cfg || !states) { if(states) jsvUnLock(states); if(cfg) jsvUnLock(cfg); jsvUnLock(cur); return 0; }
 
-  JsVar *srcNode = jsvObjectGetChild(states, fromBuf, 0);
+  JsVar *srcNode = get_child_v(states, cur);
   if (!srcNode || !jsvIsObject(srcNode)) { if(srcNode) jsvUnLock(srcNode); jsvUnLock(states); jsvUnLock(cfg); jsvUnLock(cur); return 0; }
 
   JsVar *onObj = getChildObj(srcNode, K_ON);
   if (!onObj) { jsvUnLock(srcNode); jsvUnLock(states); jsvUnLock(cfg); jsvUnLock(cur); return 0; }
 
-  char evKey[64]; str_from_jsv(event, evKey, sizeof(evKey));
-  JsVar *trans = jsvObjectGetChild(onObj, evKey, 0);
+  JsVar *trans = (event && jsvIsString(event)) ? get_child_v(onObj, event) : 0;
   if (!trans){ jsvUnLock(onObj); jsvUnLock(srcNode); jsvUnLock(states); jsvUnLock(cfg); jsvUnLock(cur); return 0; }
 
   /* guard */
@@ -771,7 +1082,7 @@ JsVar *xfsm_send_object(JsVar *fsmObject, JsVar *event /* string */) {
       if (fn) {
         JsVar *ctxg = jsvObjectGetChild(cfg, K_CONTEXT, 0); if (!ctxg||!jsvIsObject(ctxg)){ if(ctxg)jsvUnLock(ctxg); ctxg=jsvNewObject(); }
         JsVar *meta = jsvNewObject();
-        if (fromBuf[0]) { JsVar *fs=jsvNewFromString(fromBuf); jsvObjectSetChildAndUnLock(meta,"state",fs); }
+        if (jsvGetStringLength(cur)) jsvObjectSetChildAndUnLock(meta,"state",jsvLockAgain(cur));
         JsVar *argv[3] = { jsvLockAgain(ctxg), jsvLockAgain(event), meta };
         JsVar *res = xfsm_callJsFunction(fn,0,argv,3);
         jsvUnLock(argv[0]); jsvUnLock(argv[1]); jsvUnLock(meta);
@@ -784,150 +1095,1778 @@ JsVar *xfsm_send_object(JsVar *fsmObject, JsVar *event /* string */) {
   }
 
   /* resolve target + raw actions */
-  char toBuf[64]; toBuf[0]=0;
+  JsVar *toVal = 0;
   JsVar *exitActs = 0, *transActs = 0, *entryActs = 0;
 
   if (jsvIsString(trans)) {
-    str_from_jsv(trans, toBuf, sizeof(toBuf));
+    toVal = jsvLockAgain(trans);
   } else if (jsvIsObject(trans)) {
     JsVar *tgt = jsvObjectGetChild(trans, K_TARGET, 0);
-    if (tgt && jsvIsString(tgt)) str_from_jsv(tgt, toBuf, sizeof(toBuf));
+    if (tgt && jsvIsString(tgt)) toVal = jsvLockAgain(tgt);
     if (tgt) jsvUnLock(tgt);
     transActs = getTransitionActionsRaw(trans);
   }
 
-  if (!toBuf[0]) { jsvUnLock(trans); jsvUnLock(onObj); jsvUnLock(srcNode); jsvUnLock(states); jsvUnLock(cfg); jsvUnLock(cur); return 0; }
+  if (toVal && !jsvGetStringLength(toVal)) { jsvUnLock(toVal); toVal = 0; }
+  if (!toVal) { if (transActs) jsvUnLock(transActs); jsvUnLock(trans); jsvUnLock(onObj); jsvUnLock(srcNode); jsvUnLock(states); jsvUnLock(cfg); jsvUnLock(cur); return 0; }
 
   exitActs = getActionListRaw(srcNode, K_EXIT);
-  JsVar *dstNode = jsvObjectGetChild(states, toBuf, 0);
+  JsVar *dstNode = get_child_v(states, toVal);
   if (dstNode && jsvIsObject(dstNode)) entryActs = getActionListRaw(dstNode, K_ENTRY);
   if (dstNode) jsvUnLock(dstNode);
 
   JsVar *ctx = jsvObjectGetChild(cfg, K_CONTEXT, 0);
 
-  run_actions_raw(fsmObject, &ctx, exitActs,  event, fromBuf, toBuf);
-  run_actions_raw(fsmObject, &ctx, transActs, event, fromBuf, toBuf);
-  run_actions_raw(fsmObject, &ctx, entryActs, event, fromBuf, toBuf);
+  run_actions_raw(fsmObject, &ctx, exitActs,  event, 0, 0);
+  run_actions_raw(fsmObject, &ctx, transActs, event, 0, 0);
+  run_actions_raw(fsmObject, &ctx, entryActs, event, 0, 0);
 
   if (exitActs) jsvUnLock(exitActs);
   if (transActs) jsvUnLock(transActs);
   if (entryActs) jsvUnLock(entryActs);
 
-  jsvObjectSetChildAndUnLock(fsmObject, K_STATE, jsvNewFromString(toBuf));
+  jsvObjectSetChildAndUnLock(fsmObject, K_STATE, jsvLockAgain(toVal));
   if (ctx) { jsvObjectSetChildAndUnLock(cfg, K_CONTEXT, jsvLockAgain(ctx)); jsvUnLock(ctx); }
 
   jsvUnLock(trans); jsvUnLock(onObj); jsvUnLock(srcNode); jsvUnLock(states); jsvUnLock(cfg); jsvUnLock(cur);
 
-  return jsvNewFromString(toBuf);
+  return toVal; // locked
+}
+#endif /* XFSM_HAS_V1 */
+
+/* ---------------- Delayed transitions (after) ----------------
+ * `after: { 500: "B" }` on a state is a transition taken on the internal
+ * event "xstate.after(500)#<state>", sent by a native timer that the service
+ * arms when it enters the state and cancels when it leaves it (or stops).
+ * Values have the same forms as `on` values. In nested machines <state> is
+ * the dotted path of the state that declares the delay, so an ancestor's
+ * timer keeps running while transitions stay inside it. */
+static const char * const XFSM_AFTER_PREFIX = "xstate.after(";
+
+/* Event name for delay key `key` of state `stateName` (LOCKED), or 0 if the
+ * key is not a delay in ms. *pDelay receives the delay. */
+static JsVar *xfsm_after_name(JsVar *stateName, JsVar *key, JsVarFloat *pDelay) {
+  JsVar *ks = jsvAsString(key);
+  if (!ks) return 0;
+  JsVarFloat d = jsvGetFloat(ks);
+  if (!jsvGetStringLength(ks) || !(d >= 0)) { jsvUnLock(ks); return 0; }
+  JsVar *ss = jsvAsString(stateName);
+  JsVar *name = ss ? jsvNewFromString(XFSM_AFTER_PREFIX) : 0;
+  if (name) {
+    jsvAppendStringVarComplete(name, ks);
+    jsvAppendString(name, ")#");
+    jsvAppendStringVarComplete(name, ss);
+  }
+  if (ss) jsvUnLock(ss);
+  jsvUnLock(ks);
+  if (pDelay) *pDelay = d;
+  return name;
 }
 
-/* ========================================================================== */
-/*                                Machine                                     */
-/* ========================================================================== */
-void xfsm_machine_init(JsVar *m) { (void)m; }
-
-/**
- * xfsm_machine_initial_state
- * Build the initial state object: { value, context, actions, changed:false }
- * Note: returns actions = state's entry[] (if any). Service.start() will execute them.
- */
-JsVar *xfsm_machine_initial_state(JsVar *machine) {
-  if (!machine || !jsvIsObject(machine)) return 0;
-
-  JsVar *cfg = jsvObjectGetChild(machine, K_CFG, 0);
-  if (!cfg) return 0;
-
-  /* Flat-only validation (dev-time aid).
-   * This logs if nested states are found; we continue safely.
-   * If you ever want to hard-fail, check the boolean and return/throw here.
-   */
-  (void)xfsm_validate_no_nested_states(cfg);
+/* Append a state's timers to the flat [delay, depth, eventName, ...] array
+ * *pList (created on the first one). `depth` is the state's nesting level
+ * (1 = top level): a transition that stays inside that many levels leaves
+ * the timer running. */
+static void xfsm_after_push(JsVar **pList, JsVar *stateName, JsVar *afterObj, int depth) {
+  if (!afterObj || !jsvIsObject(afterObj)) return;
+  JsvObjectIterator it;
+  jsvObjectIteratorNew(&it, afterObj);
+  while (jsvObjectIteratorHasValue(&it)) {
+    JsVar *k = jsvObjectIteratorGetKey(&it);
+    JsVarFloat d = 0;
+    JsVar *name = xfsm_after_name(stateName, k, &d);
+    if (name) {
+      if (!*pList) *pList = jsvNewEmptyArray();
+      if (*pList) {
+        jsvArrayPushAndUnLock(*pList, jsvNewFromFloat(d));
+        jsvArrayPushAndUnLock(*pList, jsvNewFromInteger(depth));
+        jsvArrayPush(*pList, name);
+      }
+      jsvUnLock(name);
+    }
+    jsvUnLock(k);
+    jsvObjectIteratorNext(&it);
+  }
+  jsvObjectIteratorFree(&it);
+}
 
-  char initBuf[64] = "";
-  JsVar *initial = jsvObjectGetChild(cfg, "initial", 0);
-  if (initial && jsvIsString(initial)) str_from_jsv(initial, initBuf, sizeof(initBuf));
-  if (initial) jsvUnLock(initial);
+/* A top-level state's timers as an after list (LOCKED), or 0 if its `after`
+ * has no delays */
+static JsVar *xfsm_after_list(JsVar *stateName, JsVar *afterObj) {
+  JsVar *list = 0;
+  xfsm_after_push(&list, stateName, afterObj, 1);
+  return list;
+}
 
-  if (!initBuf[0]) {
-    jsvUnLock(cfg);
-    return 0;
+/* Nesting level of the entry named `name` in an after list, or 0 */
+static int xfsm_after_depth(JsVar *list, JsVar *name) {
+  int depth = 0, i = 0;
+  JsVar *d = 0;
+  JsvObjectIterator it;
+  jsvObjectIteratorNew(&it, list);
+  while (!depth && jsvObjectIteratorHasValue(&it)) {
+    JsVar *v = jsvObjectIteratorGetValue(&it);
+    if (i % 3 == 1) { if (d) jsvUnLock(d); d = v; v = 0; }
+    else if (i % 3 == 2 && v && jsvCompareString(v, name, 0, 0, false) == 0) depth = d ? (int)jsvGetInteger(d) : 0;
+    if (v) jsvUnLock(v);
+    jsvObjectIteratorNext(&it);
+    i++;
+  }
+  jsvObjectIteratorFree(&it);
+  if (d) jsvUnLock(d);
+  return depth;
+}
+
+/* Interpretive lookup of an after event: the `after` value of srcNode whose
+ * event name equals evName (LOCKED), or 0 */
+static JsVar *xfsm_after_cands(JsVar *srcNode, JsVar *stateName, JsVar *evName) {
+  JsVar *afterObj = getChildObj(srcNode, K_AFTER);
+  if (!afterObj) return 0;
+  JsVar *found = 0;
+  JsvObjectIterator it;
+  jsvObjectIteratorNew(&it, afterObj);
+  while (!found && jsvObjectIteratorHasValue(&it)) {
+    JsVar *k = jsvObjectIteratorGetKey(&it);
+    JsVar *name = xfsm_after_name(stateName, k, 0);
+    if (name) {
+      if (jsvCompareString(name, evName, 0, 0, false) == 0) found = jsvObjectIteratorGetValue(&it);
+      jsvUnLock(name);
+    }
+    jsvUnLock(k);
+    jsvObjectIteratorNext(&it);
+  }
+  jsvObjectIteratorFree(&it);
+  jsvUnLock(afterObj);
+  return found;
+}
+
+/* ========================================================================== */
+/*                         Compiled machine table                             */
+/* ========================================================================== */
+/*
+ * At construction the config graph is compiled into one flat string stored as
+ * machine._table. State and event names are interned to small integer ids.
+ *
+ *   XfsmTable       header
+ *   XfsmTState      states[stateCount]   name/entry/exit/after handles + edge row (+ "*" edge)
+ *   XfsmTEdge       edges[edgeCount]     (event id -> candidate range), rows sorted by event
+ *   XfsmTCand       cands[candCount]     target id, guard + merged action list handles
+ *                                        (raw, plus assigns / resolved effects split)
+ *                                        a declarative guard is a flat XfsmGuardOp[]
+ *   uint16_t        evNames[eventCount]  event name handles
+ *   uint16_t        evObjs[eventCount]   interned { type } event object handles
+ *   uint16_t        stHash[hashSize]     open-addressed name -> id+1
+ *   uint16_t        evHash[hashSize]
+ *   JsVarRef        handles[handleCount] (4-byte aligned)
+ *
+ * A "handle" is a 1-based index into handles[]; 0 means none. The referenced
+ * JsVars are pinned by machine._refs so the raw refs stay valid for the
+ * lifetime of the Machine (changes made to config after construction are not
+ * seen: build the Machine with { compile:false } for the interpretive path).
+ * Limitation: handles[] (and the handles inside guard ops, evObjs and the
+ * candidates) are raw JsVarRefs stored as bytes in a flat string. E.defrag()
+ * (jsvDefragment) moves vars and rewrites only real JsVar links, so after a
+ * defrag they are stale. Rebuild compiled machines after calling it.
+ */
+#define XFSM_TABLE_MAGIC    0x5846   /* 'XF' */
+#define XFSM_TABLE_VERSION  9
+#define XFSM_NONE           0xFFFF
+#define XFSM_NOEVENT        0xFFFE   /* event object without a usable type */
+
+#define XFSM_CAND_HAS_ACTIONS 0x0001
+#define XFSM_CAND_NATIVE_COND 0x0002   /* cond is an XfsmGuardOp[] flat string (0 = never passes) */
+#define XFSM_CAND_KEEP_SHIFT  12       /* ancestor levels a targeted candidate stays inside */
+#define XFSM_CAND_KEEP_MASK   0xF000   /* (their `after` timers keep running) */
+
+#define XFSM_TBL_NESTED       0x0001   /* states were flattened from a nested config */
+
+typedef struct {
+  uint16_t magic, version;
+  uint16_t stateCount, eventCount, edgeCount, candCount;
+  uint16_t initial;
+  uint16_t hashMask;      /* hashSize-1 (hashSize is a power of 2) */
+  uint16_t handleCount;
+  uint16_t emptyActs;     /* handle of the shared empty actions array */
+  uint16_t flags;         /* XFSM_TBL_* */
+  uint32_t handleOffset;  /* byte offset of handles[] */
+} XfsmTable;
+
+typedef struct {
+  uint16_t name, entry, exit;
+  uint16_t after;         /* [delay, depth, eventName, ...] timers of the state's chain, or 0 */
+  uint16_t edgeStart, edgeCount;
+  uint16_t any;           /* edge index of the "*" row (event XFSM_NONE, last in the row), or XFSM_NONE */
+} XfsmTState;
+
+typedef struct {
+  uint16_t event, cand, candCount;
+} XfsmTEdge;
+
+typedef struct {
+  uint16_t target;        /* state id, or XFSM_NONE when targetless */
+  uint16_t cond;          /* guard function (or XfsmGuardOp[]) handle, or 0 */
+  uint16_t actions;       /* action list handle (exit + transition + entry) */
+  uint16_t assigns;       /* the list's assign actions, or 0 */
+  uint16_t effects;       /* the other actions in order, names pre-resolved to functions, or 0 */
+  uint16_t flags;
+} XfsmTCand;
+
+/* One comparison of a declarative guard: operand handles are a key string
+ * for ctx/evt sources, or the literal itself */
+typedef struct {
+  uint8_t  op;            /* XFSM_GOP_* */
+  uint8_t  src;           /* operand 0 source (low nibble), operand 1 source (high nibble) */
+  uint16_t a, b;
+} XfsmGuardOp;
+
+static XfsmTState *tbl_states(XfsmTable *t) { return (XfsmTState*)(t + 1); }
+static XfsmTEdge  *tbl_edges(XfsmTable *t)  { return (XfsmTEdge*)(tbl_states(t) + t->stateCount); }
+static XfsmTCand  *tbl_cands(XfsmTable *t)  { return (XfsmTCand*)(tbl_edges(t) + t->edgeCount); }
+static uint16_t   *tbl_evNames(XfsmTable *t){ return (uint16_t*)(tbl_cands(t) + t->candCount); }
+static uint16_t   *tbl_evObjs(XfsmTable *t) { return tbl_evNames(t) + t->eventCount; }
+static uint16_t   *tbl_stHash(XfsmTable *t) { return tbl_evObjs(t) + t->eventCount; }
+static uint16_t   *tbl_evHash(XfsmTable *t) { return tbl_stHash(t) + t->hashMask + 1; }
+static JsVarRef   *tbl_handles(XfsmTable *t){ return (JsVarRef*)(((char*)t) + t->handleOffset); }
+
+/* LOCKED var for a handle, or 0 */
+static JsVar *tbl_handle(XfsmTable *t, uint16_t h) {
+  if (!h || h > t->handleCount) return 0;
+  JsVarRef r = tbl_handles(t)[h-1];
+  return r ? jsvLock(r) : 0;
+}
+
+/* Get the compiled table of a machine (LOCKED flat string) and its data pointer */
+static JsVar *xfsm_machine_table(JsVar *machine, XfsmTable **pt) {
+  JsVar *tv = jsvObjectGetChild(machine, "_table", 0);
+  if (!tv) return 0;
+  XfsmTable *t = xfsm_flat_len(tv) >= sizeof(XfsmTable) ? (XfsmTable*)xfsm_flat_ptr(tv) : 0;
+  if (!t || t->magic != XFSM_TABLE_MAGIC || t->version != XFSM_TABLE_VERSION) { jsvUnLock(tv); return 0; }
+  *pt = t;
+  return tv;
+}
+
+/* 16-bit FNV-1a over the characters of a string var */
+static uint16_t xfsm_hash_str(JsVar *s) {
+  uint32_t h = 2166136261u;
+  JsvStringIterator it;
+  jsvStringIteratorNew(&it, s, 0);
+  while (jsvStringIteratorHasChar(&it)) {
+    h = (h ^ (unsigned char)jsvStringIteratorGetChar(&it)) * 16777619u;
+    jsvStringIteratorNext(&it);
+  }
+  jsvStringIteratorFree(&it);
+  return (uint16_t)(h ^ (h >> 16));
+}
+
+/* Look up a name in one of the hash indexes. Returns id or XFSM_NONE. */
+static uint16_t tbl_lookup(XfsmTable *t, uint16_t *hash, bool isEvent, JsVar *name) {
+  if (!name || !jsvIsString(name)) return XFSM_NONE;
+  uint16_t mask = t->hashMask;
+  uint16_t i = xfsm_hash_str(name) & mask;
+  uint16_t n;
+  while ((n = hash[i]) != 0) {
+    uint16_t id = (uint16_t)(n - 1);
+    JsVar *nv = tbl_handle(t, isEvent ? tbl_evNames(t)[id] : tbl_states(t)[id].name);
+    bool eq = nv && jsvCompareString(nv, name, 0, 0, false) == 0;
+    if (nv) jsvUnLock(nv);
+    if (eq) return id;
+    i = (uint16_t)((i + 1) & mask);
+  }
+  return XFSM_NONE;
+}
+static uint16_t tbl_state_id(XfsmTable *t, JsVar *name) { return tbl_lookup(t, tbl_stHash(t), false, name); }
+static uint16_t tbl_event_id(XfsmTable *t, JsVar *name) { return tbl_lookup(t, tbl_evHash(t), true, name); }
+
+/* Edge row binary search: returns edge or 0 */
+static XfsmTEdge *tbl_find_edge(XfsmTable *t, uint16_t stateId, uint16_t evId) {
+  if (stateId >= t->stateCount || evId == XFSM_NONE) return 0;
+  XfsmTState *s = &tbl_states(t)[stateId];
+  XfsmTEdge *row = tbl_edges(t) + s->edgeStart;
+  int lo = 0, hi = (int)s->edgeCount - 1;
+  while (lo <= hi) {
+    int mid = (lo + hi) >> 1;
+    if (row[mid].event == evId) return &row[mid];
+    if (row[mid].event < evId) lo = mid + 1; else hi = mid - 1;
+  }
+  return 0;
+}
+
+/* Operand of a compiled guard op (LOCKED) or 0 */
+static JsVar *tbl_guard_operand(XfsmTable *t, int src, uint16_t h, JsVar *ctx, JsVar *evt) {
+  if (src == XFSM_GSRC_LIT) return tbl_handle(t, h);
+  JsVar *key = tbl_handle(t, h);
+  JsVar *v = xfsm_guard_read(src, key, ctx, evt);
+  if (key) jsvUnLock(key);
+  return v;
+}
+
+/* Run a compiled declarative guard: every op must pass */
+static bool tbl_native_guard(XfsmTable *t, uint16_t h, JsVar *ctx, JsVar *evt) {
+  JsVar *prog = tbl_handle(t, h);
+  if (!prog) return false;
+  const XfsmGuardOp *ops = (const XfsmGuardOp*)xfsm_flat_ptr(prog);
+  size_t n = ops ? xfsm_flat_len(prog) / sizeof(XfsmGuardOp) : 0;
+  bool pass = true;
+  for (size_t i = 0; pass && i < n; i++) {
+    JsVar *a = tbl_guard_operand(t, ops[i].src & 0x0F, ops[i].a, ctx, evt);
+    JsVar *b = tbl_guard_operand(t, ops[i].src >> 4, ops[i].b, ctx, evt);
+    pass = xfsm_guard_test(ops[i].op, a, b);
+    if (a) jsvUnLock(a);
+    if (b) jsvUnLock(b);
+  }
+  jsvUnLock(prog);
+  return pass;
+}
+
+/* Edge for (stateId, evId), else the state's "*" edge for any typed event, or 0 */
+static XfsmTEdge *tbl_edge_for(XfsmTable *t, uint16_t stateId, uint16_t evId) {
+  XfsmTEdge *e = tbl_find_edge(t, stateId, evId);
+  if (e || stateId >= t->stateCount || evId == XFSM_NOEVENT) return e;
+  uint16_t any = tbl_states(t)[stateId].any;
+  return any != XFSM_NONE ? &tbl_edges(t)[any] : 0;
+}
+
+/* Evaluate a candidate's guard against (ctx, evt) */
+static bool tbl_guard_passes(XfsmTable *t, XfsmTCand *c, JsVar *ctx, JsVar *evt) {
+  if (c->flags & XFSM_CAND_NATIVE_COND) return tbl_native_guard(t, c->cond, ctx, evt);
+  if (!c->cond) return true;
+  JsVar *cond = tbl_handle(t, c->cond);
+  if (!cond) return true;
+  bool pass = xfsm_guard_call(cond, ctx, evt);
+  jsvUnLock(cond);
+  return pass;
+}
+
+/* First candidate for (stateId, evId) whose guard passes, or XFSM_NONE.
+ * NOTE: guards run JS, which may allocate; callers must re-read `t` from the
+ * locked table var afterwards (flat strings never move, so the pointer holds). */
+static uint16_t tbl_select(XfsmTable *t, uint16_t stateId, uint16_t evId, JsVar *ctx, JsVar *evt) {
+  XfsmTEdge *e = tbl_edge_for(t, stateId, evId);
+  if (!e) return XFSM_NONE;
+  for (uint16_t i = 0; i < e->candCount; i++) {
+    uint16_t ci = (uint16_t)(e->cand + i);
+    if (tbl_guard_passes(t, &tbl_cands(t)[ci], ctx, evt)) return ci;
+  }
+  return XFSM_NONE;
+}
+
+/* ---- compile helpers (temporary name -> id maps) ---- */
+static int cmap_get(JsVar *map, JsVar *key) {
+  JsVar *n = jsvFindChildFromVar(map, key, false);
+  if (!n) return -1;
+  JsVar *v = jsvSkipNameAndUnLock(n);
+  int id = v ? (int)jsvGetInteger(v) : -1;
+  if (v) jsvUnLock(v);
+  return id;
+}
+static int cmap_intern(JsVar *map, JsVar *key, int *pCount) {
+  int id = cmap_get(map, key);
+  if (id >= 0) return id;
+  JsVar *n = jsvFindChildFromVar(map, key, true);
+  if (!n) return -1;
+  id = (*pCount)++;
+  JsVar *v = jsvNewFromInteger(id);
+  jsvSetValueOfName(n, v);
+  jsvUnLock(v);
+  jsvUnLock(n);
+  return id;
+}
+
+typedef struct {
+  XfsmTable *t;
+  JsVar     *refs;     /* pins every handle var */
+  uint16_t   cap;      /* handles reserved */
+  uint16_t   cands;    /* candidates emitted so far */
+  JsVar     *actsMap;  /* machine-level actions map used to pre-resolve names, or 0 */
+} XfsmCompiler;
+
+/* Pin a var and return its handle (0 on failure / null var) */
+static uint16_t cc_handle(XfsmCompiler *cc, JsVar *v) {
+  if (!v || cc->t->handleCount >= cc->cap) return 0;
+  jsvArrayPush(cc->refs, v);
+  tbl_handles(cc->t)[cc->t->handleCount] = jsvGetRef(v);
+  return ++cc->t->handleCount;
+}
+
+/* Normalised copy of an entry/exit value as an array (LOCKED) or 0 */
+static JsVar *cc_as_list(JsVar *v) {
+  if (!v || jsvIsUndefined(v) || jsvIsNull(v)) return 0;
+  if (jsvIsArray(v)) return jsvLockAgain(v);
+  JsVar *arr = jsvNewEmptyArray();
+  if (arr) jsvArrayPush(arr, v);
+  return arr;
+}
+
+static void cc_push_all(JsVar *dst, JsVar *list) {
+  if (!list) return;
+  JsvObjectIterator it;
+  jsvObjectIteratorNew(&it, list);
+  while (jsvObjectIteratorHasValue(&it)) {
+    JsVar *a = jsvObjectIteratorGetValue(&it);
+    if (a) { jsvArrayPush(dst, a); jsvUnLock(a); }
+    jsvObjectIteratorNext(&it);
+  }
+  jsvObjectIteratorFree(&it);
+}
+
+static void cc_hash_insert(uint16_t *hash, uint16_t mask, JsVar *name, uint16_t id) {
+  uint16_t i = xfsm_hash_str(name) & mask;
+  while (hash[i]) i = (uint16_t)((i + 1) & mask);
+  hash[i] = (uint16_t)(id + 1);
+}
+
+/* Target name of a candidate value (string or { target }) — LOCKED string or 0 */
+static JsVar *cc_cand_target(JsVar *c) {
+  if (jsvIsString(c)) return jsvLockAgain(c);
+  if (!jsvIsObject(c)) return 0;
+  JsVar *t = jsvObjectGetChild(c, K_TARGET, 0);
+  if (t && !jsvIsString(t)) { jsvUnLock(t); t = 0; }
+  return t;
+}
+
+/* Pass 1 over one candidate: intern its target as a (possibly phantom) state,
+ * and count its declarative guard ops (two operand handles each) */
+static void cc_count_cand(JsVar *c, JsVar *stIds, int *pStates, int *pCands, int *pGuardOps) {
+  if (!jsvIsString(c) && !jsvIsObject(c)) return;
+  (*pCands)++;
+  JsVar *tg = cc_cand_target(c);
+  if (tg) { if (jsvGetStringLength(tg)) cmap_intern(stIds, tg, pStates); jsvUnLock(tg); }
+  JsVar *cond = jsvIsObject(c) ? jsvObjectGetChild(c, K_COND, 0) : 0;
+  if (cond && jsvIsObject(cond)) *pGuardOps += jsvGetChildren(cond);
+  if (cond) jsvUnLock(cond);
+}
+
+/* Pre-split a declarative guard into an XfsmGuardOp[] flat string. Returns its
+ * handle, or 0 (the guard never passes) if an op or operand is not understood. */
+static uint16_t cc_guard_program(XfsmCompiler *cc, JsVar *cond) {
+  int n = jsvGetChildren(cond);
+  JsVar *prog = n > 0 ? xfsm_new_flat((size_t)n * sizeof(XfsmGuardOp)) : 0;
+  if (!prog) return 0;
+  XfsmGuardOp *ops = (XfsmGuardOp*)xfsm_flat_ptr(prog);
+  bool ok = true;
+  int i = 0;
+  JsvObjectIterator it;
+  jsvObjectIteratorNew(&it, cond);
+  while (ok && jsvObjectIteratorHasValue(&it)) {
+    JsVar *k = jsvObjectIteratorGetKey(&it);
+    JsVar *args = jsvObjectIteratorGetValue(&it);
+    int op = xfsm_guard_op(k);
+    JsVar *pa = (op >= 0 && args && jsvIsArray(args)) ? jsvGetArrayItem(args, 0) : 0;
+    JsVar *pb = pa ? jsvGetArrayItem(args, 1) : 0;
+    int srcA = XFSM_GSRC_LIT, srcB = XFSM_GSRC_LIT;
+    JsVar *keyA = xfsm_guard_path(pa, &srcA);
+    JsVar *keyB = keyA ? xfsm_guard_path(pb, &srcB) : 0;
+    ok = keyA != 0 && i < n;
+    if (ok) {
+      ops[i].op = (uint8_t)op;
+      ops[i].src = (uint8_t)(srcA | (srcB << 4));
+      ops[i].a = cc_handle(cc, keyA);
+      ops[i].b = cc_handle(cc, keyB ? keyB : pb);
+      i++;
+    } else {
+      jsDebug(DBG_INFO, "XFSM: guard op \"%v\" not understood; the guard will not pass.\n", k);
+    }
+    if (keyA) jsvUnLock(keyA);
+    if (keyB) jsvUnLock(keyB);
+    if (pa) jsvUnLock(pa);
+    if (pb) jsvUnLock(pb);
+    if (args) jsvUnLock(args);
+    jsvUnLock(k);
+    jsvObjectIteratorNext(&it);
+  }
+  jsvObjectIteratorFree(&it);
+  uint16_t h = ok ? cc_handle(cc, prog) : 0;
+  jsvUnLock(prog);
+  return h;
+}
+
+/* Pass 2: emit one candidate */
+static void cc_emit_cand(XfsmCompiler *cc, JsVar *c, JsVar *stIds, JsVar *exitList,
+                         JsVar *statesObj) {
+  XfsmTable *t = cc->t;
+  XfsmTCand *cand = &tbl_cands(t)[cc->cands++];
+  cand->target = XFSM_NONE;
+  cand->cond = 0;
+  cand->actions = 0;
+  cand->assigns = 0;
+  cand->effects = 0;
+  cand->flags = 0;
+
+  JsVar *tg = cc_cand_target(c);
+  if (tg) {
+    if (jsvGetStringLength(tg)) {
+      int id = cmap_get(stIds, tg);
+      if (id >= 0) cand->target = (uint16_t)id;
+    }
+    jsvUnLock(tg);
+  }
+
+  JsVar *transActs = 0;
+  if (jsvIsObject(c)) {
+    JsVar *keep = jsvObjectGetChild(c, K_CKEEP, 0);
+    if (keep) cand->flags |= (uint16_t)((jsvGetInteger(keep) << XFSM_CAND_KEEP_SHIFT) & XFSM_CAND_KEEP_MASK);
+    if (keep) jsvUnLock(keep);
+    JsVar *cond = jsvObjectGetChild(c, K_COND, 0);
+    if (cond && jsvIsFunction(cond)) cand->cond = cc_handle(cc, cond);
+    else if (cond && jsvIsObject(cond) && jsvGetChildren(cond) > 0) {
+      cand->flags |= XFSM_CAND_NATIVE_COND;
+      cand->cond = cc_guard_program(cc, cond);
+    }
+    if (cond) jsvUnLock(cond);
+    JsVar *a = jsvObjectGetChild(c, K_ACTIONS, 0);
+    transActs = cc_as_list(a);
+    if (a) jsvUnLock(a);
+  }
+
+  /* Merged list: targeted => exit + actions + entry; targetless => actions only */
+  JsVar *entryList = 0;
+  if (cand->target != XFSM_NONE) {
+    JsVar *nameV = tbl_handle(t, tbl_states(t)[cand->target].name);
+    JsVar *dst = nameV ? jsvSkipNameAndUnLock(jsvFindChildFromVar(statesObj, nameV, false)) : 0;
+    if (nameV) jsvUnLock(nameV);
+    if (dst && jsvIsObject(dst)) {
+      JsVar *e = jsvObjectGetChild(dst, K_ENTRY, 0);
+      entryList = cc_as_list(e);
+      if (e) jsvUnLock(e);
+    }
+    if (dst) jsvUnLock(dst);
+  }
+
+  JsVar *merged = jsvNewEmptyArray();
+  if (merged) {
+    if (cand->target != XFSM_NONE) cc_push_all(merged, exitList);
+    cc_push_all(merged, transActs);
+    if (cand->target != XFSM_NONE) cc_push_all(merged, entryList);
+    if (jsvGetArrayLength(merged) > 0) {
+      cand->flags |= XFSM_CAND_HAS_ACTIONS;
+      cand->actions = cc_handle(cc, merged);
+      /* partition once: assigns run first, effects keep their order */
+      int nAssign = count_assigns(merged);
+      if (nAssign > 0) {
+        JsVar *as = jsvNewEmptyArray();
+        if (as) {
+          JsvObjectIterator it;
+          jsvObjectIteratorNew(&it, merged);
+          while (jsvObjectIteratorHasValue(&it)) {
+            JsVar *a = jsvObjectIteratorGetValue(&it);
+            if (a && jsvIsObject(a) && is_assign_like(a)) jsvArrayPush(as, a);
+            if (a) jsvUnLock(a);
+            jsvObjectIteratorNext(&it);
+          }
+          jsvObjectIteratorFree(&it);
+          cand->assigns = cc_handle(cc, as);
+          jsvUnLock(as);
+        }
+      }
+      if (nAssign < jsvGetArrayLength(merged)) {
+        JsVar *fx = jsvNewEmptyArray();
+        if (fx) {
+          fill_effects(fx, merged, cc->actsMap);
+          cand->effects = cc_handle(cc, fx);
+          jsvUnLock(fx);
+        }
+      }
+    }
+    jsvUnLock(merged);
+  }
+  if (transActs) jsvUnLock(transActs);
+  if (entryList) jsvUnLock(entryList);
+}
+
+/* Pass 1 over one `on`/`after` value: one edge plus its candidates */
+static void cc_count_edge(JsVar *ev, JsVar *stIds, int *pStates, int *pEdges, int *pCands, int *pGuardOps) {
+  (*pEdges)++;
+  if (jsvIsArray(ev)) {
+    JsvObjectIterator cit;
+    jsvObjectIteratorNew(&cit, ev);
+    while (jsvObjectIteratorHasValue(&cit)) {
+      JsVar *c = jsvObjectIteratorGetValue(&cit);
+      if (c) { cc_count_cand(c, stIds, pStates, pCands, pGuardOps); jsvUnLock(c); }
+      jsvObjectIteratorNext(&cit);
+    }
+    jsvObjectIteratorFree(&cit);
+  } else if (ev) {
+    cc_count_cand(ev, stIds, pStates, pCands, pGuardOps);
+  }
+}
+
+/* Pass 2: emit the edge for event evId of the current state */
+static void cc_emit_edge(XfsmCompiler *cc, uint16_t evId, JsVar *ev, JsVar *stIds, JsVar *exitList,
+                         JsVar *statesObj, uint16_t *pEdgeCount) {
+  XfsmTEdge *edge = &tbl_edges(cc->t)[(*pEdgeCount)++];
+  edge->event = evId;
+  edge->cand = cc->cands;
+  if (jsvIsArray(ev)) {
+    JsvObjectIterator cit;
+    jsvObjectIteratorNew(&cit, ev);
+    while (jsvObjectIteratorHasValue(&cit)) {
+      JsVar *c = jsvObjectIteratorGetValue(&cit);
+      if (c && (jsvIsString(c) || jsvIsObject(c)))
+        cc_emit_cand(cc, c, stIds, exitList, statesObj);
+      if (c) jsvUnLock(c);
+      jsvObjectIteratorNext(&cit);
+    }
+    jsvObjectIteratorFree(&cit);
+  } else if (ev && (jsvIsString(ev) || jsvIsObject(ev))) {
+    cc_emit_cand(cc, ev, stIds, exitList, statesObj);
+  }
+  edge->candCount = (uint16_t)(cc->cands - edge->cand);
+}
+
+/* ---------------- Nested states (compile-time flattening) ----------------
+ * A nested config is rewritten into an equivalent flat one before compiling,
+ * so the table is built by the flat compiler and a send stays one row lookup
+ * plus one flat action list. Only atomic (leaf) states become table states,
+ * named by their dotted path ("active.idle"). A leaf's row carries its own
+ * candidates followed by those of each ancestor (nearest first), so an event
+ * bubbles to the parent when the leaf has no candidate whose guard passes.
+ * Each targeted candidate gets its exit and entry actions precomputed from
+ * the least common ancestor of the defining state and the target:
+ *   exit leaf .. child of LCA,  transition actions,  entry child of LCA .. target leaf
+ * A compound target is entered through its `initial` chain (first child if
+ * none). Targets resolve as ".child" of the defining state, then a sibling
+ * (or sibling path "b.x"), then an absolute dotted path from the root.
+ * Wildcard handlers (on: { "*": ... }) follow each level's explicit ones in
+ * every row, and also make up the leaf's "*" row: the per-state fallback edge
+ * (XfsmTState.any) taken by events the leaf has no row for. Flat configs
+ * using "*" are flattened the same way. */
+#define XFSM_MAX_DEPTH 8
+
+typedef struct {
+  JsVar *root;                        /* config.states (not locked by the chain) */
+  int    depth;
+  JsVar *key[XFSM_MAX_DEPTH];         /* LOCKED state keys, outermost first */
+  JsVar *node[XFSM_MAX_DEPTH];        /* LOCKED state nodes */
+} XfsmChain;
+
+static void chain_trunc(XfsmChain *c, int depth) {
+  while (c->depth > depth) { c->depth--; jsvUnLock(c->key[c->depth]); jsvUnLock(c->node[c->depth]); }
+}
+
+static bool chain_push(XfsmChain *c, JsVar *key, JsVar *node) {
+  if (c->depth >= XFSM_MAX_DEPTH) return false;
+  c->key[c->depth] = jsvLockAgain(key);
+  c->node[c->depth] = jsvLockAgain(node);
+  c->depth++;
+  return true;
+}
+
+/* dst = the first `depth` levels of src (dst must be empty) */
+static void chain_copy(XfsmChain *dst, XfsmChain *src, int depth) {
+  dst->root = src->root;
+  dst->depth = 0;
+  for (int i = 0; i < depth && i < src->depth; i++) chain_push(dst, src->key[i], src->node[i]);
+}
+
+/* Substates object of a node (LOCKED) if it has any, else 0 */
+static JsVar *node_substates(JsVar *node) {
+  JsVar *s = (node && jsvIsObject(node)) ? getChildObj(node, K_STATES) : 0;
+  if (s && !jsvHasChildren(s)) { jsvUnLock(s); s = 0; }
+  return s;
+}
+
+/* Push the child `name` of the chain's current level */
+static bool chain_step(XfsmChain *c, JsVar *name) {
+  JsVar *states = c->depth ? node_substates(c->node[c->depth-1]) : jsvLockAgain(c->root);
+  JsVar *node = states ? get_child_v(states, name) : 0;
+  bool ok = node && jsvIsObject(node) && chain_push(c, name, node);
+  if (node) jsvUnLock(node);
+  if (states) jsvUnLock(states);
+  return ok;
+}
+
+/* Push the states named by path[start..] ("a" or "a.b.c"); a key containing
+ * dots is tried whole first */
+static bool chain_walk(XfsmChain *c, JsVar *path, size_t start) {
+  size_t len = jsvGetStringLength(path);
+  if (start >= len) return false;
+  JsVar *whole = start ? jsvNewFromStringVar(path, start, JSVAPPENDSTRINGVAR_MAXLENGTH) : jsvLockAgain(path);
+  bool ok = whole && chain_step(c, whole);
+  if (whole) jsvUnLock(whole);
+  if (ok) return true;
+  size_t seg = start, i = start;
+  JsvStringIterator it;
+  jsvStringIteratorNew(&it, path, start);
+  ok = true;
+  while (ok && i <= len) {
+    char ch = i < len ? jsvStringIteratorGetChar(&it) : '.';
+    if (ch == '.') {
+      JsVar *name = i > seg ? jsvNewFromStringVar(path, seg, i - seg) : 0;
+      ok = name && chain_step(c, name);
+      if (name) jsvUnLock(name);
+      seg = i + 1;
+    }
+    jsvStringIteratorNext(&it);
+    i++;
+  }
+  jsvStringIteratorFree(&it);
+  return ok;
+}
+
+/* Enter compound states through their initial child until a leaf */
+static bool chain_descend(XfsmChain *c) {
+  JsVar *sub;
+  while (c->depth && (sub = node_substates(c->node[c->depth-1])) != 0) {
+    JsVar *initial = jsvObjectGetChild(c->node[c->depth-1], "initial", 0);
+    bool ok = initial && jsvIsString(initial) && chain_step(c, initial);
+    if (!ok) {
+      JsvObjectIterator it;
+      jsvObjectIteratorNew(&it, sub);
+      JsVar *k = jsvObjectIteratorHasValue(&it) ? jsvObjectIteratorGetKey(&it) : 0;
+      jsvObjectIteratorFree(&it);
+      ok = k && chain_step(c, k);
+      if (k) jsvUnLock(k);
+    }
+    if (initial) jsvUnLock(initial);
+    jsvUnLock(sub);
+    if (!ok) return false;
+  }
+  return true;
+}
+
+/* Dotted path of the chain's first `depth` levels (LOCKED) */
+static JsVar *chain_path_n(XfsmChain *c, int depth) {
+  if (depth == 1) return jsvAsString(c->key[0]);
+  JsVar *p = jsvNewFromEmptyString();
+  for (int i = 0; p && i < depth; i++) {
+    if (i) jsvAppendString(p, ".");
+    JsVar *k = jsvAsString(c->key[i]);
+    if (k) { jsvAppendStringVarComplete(p, k); jsvUnLock(k); }
+  }
+  return p;
+}
+
+/* Dotted path of the chain (LOCKED) */
+static JsVar *chain_path(XfsmChain *c) {
+  return chain_path_n(c, c->depth);
+}
+
+/* Does any top-level state have an on: { "*": ... } handler? */
+static bool xfsm_states_any(JsVar *states) {
+  bool any = false;
+  JsvObjectIterator it;
+  jsvObjectIteratorNew(&it, states);
+  while (!any && jsvObjectIteratorHasValue(&it)) {
+    JsVar *st = jsvObjectIteratorGetValue(&it);
+    JsVar *on = (st && jsvIsObject(st)) ? getChildObj(st, K_ON) : 0;
+    JsVar *h = on ? jsvObjectGetChild(on, K_ANY, 0) : 0;
+    any = h != 0;
+    if (h) jsvUnLock(h);
+    if (on) jsvUnLock(on);
+    if (st) jsvUnLock(st);
+    jsvObjectIteratorNext(&it);
+  }
+  jsvObjectIteratorFree(&it);
+  return any;
+}
+
+/* Does any top-level state have substates? */
+static bool xfsm_states_nested(JsVar *states) {
+  bool nested = false;
+  JsvObjectIterator it;
+  jsvObjectIteratorNew(&it, states);
+  while (!nested && jsvObjectIteratorHasValue(&it)) {
+    JsVar *st = jsvObjectIteratorGetValue(&it);
+    JsVar *sub = node_substates(st);
+    nested = sub != 0;
+    if (sub) jsvUnLock(sub);
+    if (st) jsvUnLock(st);
+    jsvObjectIteratorNext(&it);
+  }
+  jsvObjectIteratorFree(&it);
+  return nested;
+}
+
+bool xfsm_config_is_nested(JsVar *machineConfig) {
+  JsVar *states = (machineConfig && jsvIsObject(machineConfig)) ? getChildObj(machineConfig, K_STATES) : 0;
+  bool nested = states && xfsm_states_nested(states);
+  if (states) jsvUnLock(states);
+  return nested;
+}
+
+/* Push the items of a node's entry/exit value onto dst */
+static void cc_push_hook(JsVar *dst, JsVar *node, const char *key) {
+  JsVar *v = jsvObjectGetChild(node, key, 0);
+  JsVar *list = cc_as_list(v);
+  if (v) jsvUnLock(v);
+  if (list) { cc_push_all(dst, list); jsvUnLock(list); }
+}
+
+/* Rewrite one candidate of the state at depth d of `leaf` for the flat table
+ * and push it onto dst. Targetless and unresolvable candidates are kept as-is. */
+static bool cc_nested_cand(XfsmChain *leaf, int d, JsVar *c, JsVar *dst) {
+  JsVar *target = cc_cand_target(c);
+  XfsmChain t;
+  bool found = false;
+  int tn = 0;
+  if (target && jsvGetStringLength(target)) {
+    if (jsvIsStringEqualOrStartsWith(target, ".", true)) {
+      chain_copy(&t, leaf, d);
+      found = chain_walk(&t, target, 1);
+    } else {
+      chain_copy(&t, leaf, d - 1);
+      found = chain_walk(&t, target, 0);
+      if (!found) { chain_trunc(&t, 0); found = chain_walk(&t, target, 0); }
+    }
+    tn = t.depth;
+    if (found && !chain_descend(&t)) { chain_trunc(&t, 0); if (target) jsvUnLock(target); return false; }
+    if (!found) chain_trunc(&t, 0);
+  }
+  if (target) jsvUnLock(target);
+  if (!found) { jsvArrayPush(dst, c); return true; }
+
+  /* k = depth of the LCA: the deepest state that is a proper ancestor of both */
+  int k = 0;
+  while (k < d && k < tn && leaf->node[k] == t.node[k]) k++;
+  if (k >= d || k >= tn) k = (d < tn ? d : tn) - 1;
+
+  JsVar *acts = jsvNewEmptyArray();
+  JsVar *obj = acts ? jsvNewObject() : 0;
+  if (obj) {
+    for (int i = leaf->depth - 1; i >= k; i--) cc_push_hook(acts, leaf->node[i], K_EXIT);
+    if (jsvIsObject(c)) {
+      JsVar *a = jsvObjectGetChild(c, K_ACTIONS, 0);
+      JsVar *list = cc_as_list(a);
+      if (a) jsvUnLock(a);
+      if (list) { cc_push_all(acts, list); jsvUnLock(list); }
+      JsVar *cond = jsvObjectGetChild(c, K_COND, 0);
+      if (cond) jsvObjectSetChildAndUnLock(obj, K_COND, cond);
+    }
+    for (int i = k; i < t.depth; i++) cc_push_hook(acts, t.node[i], K_ENTRY);
+    jsvObjectSetChildAndUnLock(obj, K_TARGET, chain_path(&t));
+    if (k) jsvObjectSetChildAndUnLock(obj, K_CKEEP, jsvNewFromInteger(k));
+    jsvObjectSetChild(obj, K_ACTIONS, acts);
+    jsvArrayPush(dst, obj);
+    jsvUnLock(obj);
+  }
+  if (acts) jsvUnLock(acts);
+  chain_trunc(&t, 0);
+  return obj != 0;
+}
+
+/* Append the candidates of one handler value (string, object or array) */
+static bool cc_nested_append(XfsmChain *leaf, int d, JsVar *v, JsVar *list) {
+  bool ok = true;
+  if (jsvIsArray(v)) {
+    JsvObjectIterator cit;
+    jsvObjectIteratorNew(&cit, v);
+    while (ok && jsvObjectIteratorHasValue(&cit)) {
+      JsVar *c = jsvObjectIteratorGetValue(&cit);
+      if (c && (jsvIsString(c) || jsvIsObject(c))) ok = cc_nested_cand(leaf, d, c, list);
+      if (c) jsvUnLock(c);
+      jsvObjectIteratorNext(&cit);
+    }
+    jsvObjectIteratorFree(&cit);
+  } else if (v && (jsvIsString(v) || jsvIsObject(v))) {
+    ok = cc_nested_cand(leaf, d, v, list);
+  }
+  return ok;
+}
+
+/* Make sure dst[key] is an array (for every key of src when src is given) */
+static bool cc_nested_rows(JsVar *src, JsVar *dst, JsVar *key) {
+  if (key) {
+    JsVar *list = get_child_v(dst, key);
+    if (!list) {
+      list = jsvNewEmptyArray();
+      if (list) set_child_v_and_unlock(dst, key, jsvLockAgain(list));
+    }
+    if (list) jsvUnLock(list);
+    return list != 0;
+  }
+  bool ok = true;
+  JsvObjectIterator it;
+  jsvObjectIteratorNew(&it, src);
+  while (ok && jsvObjectIteratorHasValue(&it)) {
+    JsVar *k = jsvObjectIteratorGetKey(&it);
+    ok = cc_nested_rows(0, dst, k);
+    jsvUnLock(k);
+    jsvObjectIteratorNext(&it);
+  }
+  jsvObjectIteratorFree(&it);
+  return ok;
+}
+
+/* Append the handlers of the state at depth d to every row of the leaf's map:
+ * src[row] first, then the state's own "*" candidates (they outrank the
+ * ancestors' handlers, but not the state's explicit ones) */
+static bool cc_nested_merge(XfsmChain *leaf, int d, JsVar *src, JsVar *dst, bool wildcard) {
+  JsVar *any = wildcard ? jsvObjectGetChild(src, K_ANY, 0) : 0;
+  bool ok = true;
+  JsvObjectIterator it;
+  jsvObjectIteratorNew(&it, dst);
+  while (ok && jsvObjectIteratorHasValue(&it)) {
+    JsVar *k = jsvObjectIteratorGetKey(&it);
+    JsVar *list = jsvObjectIteratorGetValue(&it);
+    JsVar *v = (wildcard && is_string_eq(k, K_ANY)) ? 0 : get_child_v(src, k);
+    if (v) ok = cc_nested_append(leaf, d, v, list);
+    if (ok && any) ok = cc_nested_append(leaf, d, any, list);
+    if (v) jsvUnLock(v);
+    if (list) jsvUnLock(list);
+    jsvUnLock(k);
+    jsvObjectIteratorNext(&it);
+  }
+  jsvObjectIteratorFree(&it);
+  if (any) jsvUnLock(any);
+  return ok;
+}
+
+/* Rows of the `after` of the state at depth d (path `owner`) into the leaf's
+ * `on` map, and its timers onto the leaf's after list *pTimers */
+static bool cc_nested_after(XfsmChain *leaf, int d, JsVar *owner, JsVar *src, JsVar *on, JsVar **pTimers) {
+  bool ok = true;
+  JsvObjectIterator it;
+  jsvObjectIteratorNew(&it, src);
+  while (ok && jsvObjectIteratorHasValue(&it)) {
+    JsVar *k = jsvObjectIteratorGetKey(&it);
+    JsVar *name = xfsm_after_name(owner, k, 0);
+    JsVar *list = name ? jsvNewEmptyArray() : 0;
+    if (list) {
+      JsVar *v = jsvObjectIteratorGetValue(&it);
+      ok = cc_nested_append(leaf, d, v, list);
+      if (v) jsvUnLock(v);
+      set_child_v_and_unlock(on, name, list);
+    }
+    if (name) jsvUnLock(name);
+    jsvUnLock(k);
+    jsvObjectIteratorNext(&it);
+  }
+  jsvObjectIteratorFree(&it);
+  if (ok) xfsm_after_push(pTimers, owner, src, d);
+  return ok;
+}
+
+/* Add flat[path] = { on, timers } for the chain's leaf, or recurse into its children */
+static bool cc_flatten_node(JsVar *flat, XfsmChain *c) {
+  JsVar *sub = node_substates(c->node[c->depth-1]);
+  bool ok = true;
+  if (sub) {
+    JsvObjectIterator it;
+    jsvObjectIteratorNew(&it, sub);
+    while (ok && jsvObjectIteratorHasValue(&it)) {
+      JsVar *k = jsvObjectIteratorGetKey(&it);
+      JsVar *v = jsvObjectIteratorGetValue(&it);
+      int depth = c->depth;
+      if (v && jsvIsObject(v)) ok = chain_push(c, k, v) && cc_flatten_node(flat, c);
+      chain_trunc(c, depth);
+      if (v) jsvUnLock(v);
+      jsvUnLock(k);
+      jsvObjectIteratorNext(&it);
+    }
+    jsvObjectIteratorFree(&it);
+    jsvUnLock(sub);
+    return ok;
+  }
+  JsVar *on = jsvNewObject(), *node = jsvNewObject();
+  JsVar *timers = 0;
+  ok = on && node;
+  /* one row per event handled anywhere on the chain, then fill nearest first */
+  for (int d = c->depth; ok && d >= 1; d--) {
+    JsVar *src = getChildObj(c->node[d-1], K_ON);
+    if (src) { ok = cc_nested_rows(src, on, 0); jsvUnLock(src); }
+  }
+  for (int d = c->depth; ok && d >= 1; d--) {
+    JsVar *src = getChildObj(c->node[d-1], K_ON);
+    if (src) { ok = cc_nested_merge(c, d, src, on, true); jsvUnLock(src); }
+  }
+  /* after: each state on the chain keeps its own timers, on events named by
+   * its own path; the leaf's after list covers the whole chain */
+  for (int d = 1; ok && d <= c->depth; d++) {
+    JsVar *src = getChildObj(c->node[d-1], K_AFTER);
+    JsVar *owner = src ? chain_path_n(c, d) : 0;
+    if (owner) ok = cc_nested_after(c, d, owner, src, on, &timers);
+    if (owner) jsvUnLock(owner);
+    if (src) jsvUnLock(src);
+  }
+  if (ok) {
+    jsvObjectSetChild(node, K_ON, on);
+    if (timers) jsvObjectSetChild(node, K_CTIMERS, timers);
+    JsVar *path = chain_path(c);
+    if (path) set_child_v_and_unlock(flat, path, jsvLockAgain(node));
+    ok = path != 0;
+    if (path) jsvUnLock(path);
+  }
+  if (on) jsvUnLock(on);
+  if (timers) jsvUnLock(timers);
+  if (node) jsvUnLock(node);
+  return ok;
+}
+
+/* Flat leaf-path -> { on, timers } equivalent of a nested states object (LOCKED), or 0 */
+static JsVar *cc_flatten_states(JsVar *states) {
+  JsVar *flat = jsvNewObject();
+  XfsmChain c;
+  c.root = states;
+  c.depth = 0;
+  bool ok = flat != 0;
+  JsvObjectIterator it;
+  jsvObjectIteratorNew(&it, states);
+  while (ok && jsvObjectIteratorHasValue(&it)) {
+    JsVar *k = jsvObjectIteratorGetKey(&it);
+    JsVar *v = jsvObjectIteratorGetValue(&it);
+    if (v && jsvIsObject(v)) ok = chain_push(&c, k, v) && cc_flatten_node(flat, &c);
+    chain_trunc(&c, 0);
+    if (v) jsvUnLock(v);
+    jsvUnLock(k);
+    jsvObjectIteratorNext(&it);
+  }
+  jsvObjectIteratorFree(&it);
+  if (!ok && flat) { jsvUnLock(flat); flat = 0; }
+  return flat;
+}
+
+/* Resolve config.initial through the initial chain of a states object; the
+ * chain is left holding the path (caller truncates). */
+static bool chain_initial(XfsmChain *c, JsVar *states, JsVar *initial) {
+  c->root = states;
+  c->depth = 0;
+  if (!initial || !jsvIsString(initial) || !jsvGetStringLength(initial)) return false;
+  return chain_walk(c, initial, 0) && chain_descend(c);
+}
+
+/* The states of a (flattened) states object whose names aren't keys of skip (LOCKED), or 0 */
+static JsVar *cc_states_without(JsVar *states, JsVar *skip) {
+  JsVar *kept = jsvNewObject();
+  if (!kept) return 0;
+  JsvObjectIterator it;
+  jsvObjectIteratorNew(&it, states);
+  while (jsvObjectIteratorHasValue(&it)) {
+    JsVar *k = jsvObjectIteratorGetKey(&it);
+    JsVar *drop = get_child_v(skip, k);
+    if (drop) jsvUnLock(drop);
+    else set_child_v_and_unlock(kept, k, jsvObjectIteratorGetValue(&it));
+    jsvUnLock(k);
+    jsvObjectIteratorNext(&it);
+  }
+  jsvObjectIteratorFree(&it);
+  return kept;
+}
+
+/* Compile machine.config into machine._table / machine._refs, leaving out
+ * the (leaf) states named by the keys of skip, if given.
+ * Returns false (leaving the Machine on the interpretive path) if the config
+ * has no states or memory is short. */
+static bool xfsm_machine_compile_ex(JsVar *machine, JsVar *skip) {
+  if (!machine || !jsvIsObject(machine)) return false;
+  JsVar *cfg = jsvObjectGetChild(machine, K_CFG, 0);
+  JsVar *statesObj = cfg ? getChildObj(cfg, K_STATES) : 0;
+  if (!statesObj) { if (cfg) jsvUnLock(cfg); return false; }
+
+  /* nested or wildcard: compile the flattened leaf states, from the initial leaf */
+  JsVar *initial = jsvObjectGetChild(cfg, "initial", 0);
+  bool nested = xfsm_states_nested(statesObj);
+  if (nested || xfsm_states_any(statesObj)) {
+    XfsmChain ic;
+    JsVar *leaf = chain_initial(&ic, statesObj, initial) ? chain_path(&ic) : 0;
+    chain_trunc(&ic, 0);
+    JsVar *flat = leaf ? cc_flatten_states(statesObj) : 0;
+    jsvUnLock(statesObj);
+    if (initial) jsvUnLock(initial);
+    statesObj = flat;
+    initial = leaf;
+    if (!flat) { if (leaf) jsvUnLock(leaf); jsvUnLock(cfg); return false; }
+  }
+  if (skip) {
+    JsVar *kept = cc_states_without(statesObj, skip);
+    jsvUnLock(statesObj);
+    statesObj = kept;
+    if (!kept) { if (initial) jsvUnLock(initial); jsvUnLock(cfg); return false; }
+  }
+
+  /* ---- pass 1: intern names and count ---- */
+  JsVar *stIds = jsvNewObject();
+  JsVar *evIds = jsvNewObject();
+  int nStates = 0, nEvents = 0, nEdges = 0, nCands = 0, nGuardOps = 0;
+  if (stIds && evIds) {
+    JsvObjectIterator it;
+    jsvObjectIteratorNew(&it, statesObj);
+    while (jsvObjectIteratorHasValue(&it)) {
+      JsVar *k = jsvObjectIteratorGetKey(&it);
+      cmap_intern(stIds, k, &nStates);
+      jsvUnLock(k);
+      jsvObjectIteratorNext(&it);
+    }
+    jsvObjectIteratorFree(&it);
+
+    jsvObjectIteratorNew(&it, statesObj);
+    while (jsvObjectIteratorHasValue(&it)) {
+      JsVar *node = jsvObjectIteratorGetValue(&it);
+      JsVar *on = (node && jsvIsObject(node)) ? getChildObj(node, K_ON) : 0;
+      if (on) {
+        JsvObjectIterator eit;
+        jsvObjectIteratorNew(&eit, on);
+        while (jsvObjectIteratorHasValue(&eit)) {
+          JsVar *ek = jsvObjectIteratorGetKey(&eit);
+          JsVar *ev = jsvObjectIteratorGetValue(&eit);
+          if (jsvIsStringEqual(ek, K_ANY)) {
+            cc_count_edge(ev, stIds, &nStates, &nEdges, &nCands, &nGuardOps); /* no event id */
+          } else if (jsvGetStringLength(ek)) {
+            cmap_intern(evIds, ek, &nEvents);
+            cc_count_edge(ev, stIds, &nStates, &nEdges, &nCands, &nGuardOps);
+          }
+          if (ev) jsvUnLock(ev);
+          jsvUnLock(ek);
+          jsvObjectIteratorNext(&eit);
+        }
+        jsvObjectIteratorFree(&eit);
+        jsvUnLock(on);
+      }
+      /* after: { delay: value } edges on their internal event names */
+      JsVar *after = (node && jsvIsObject(node)) ? getChildObj(node, K_AFTER) : 0;
+      if (after) {
+        JsVar *sk = jsvObjectIteratorGetKey(&it);
+        JsvObjectIterator ait;
+        jsvObjectIteratorNew(&ait, after);
+        while (jsvObjectIteratorHasValue(&ait)) {
+          JsVar *ak = jsvObjectIteratorGetKey(&ait);
+          JsVar *name = xfsm_after_name(sk, ak, 0);
+          if (name) {
+            JsVar *av = jsvObjectIteratorGetValue(&ait);
+            cmap_intern(evIds, name, &nEvents);
+            cc_count_edge(av, stIds, &nStates, &nEdges, &nCands, &nGuardOps);
+            if (av) jsvUnLock(av);
+            jsvUnLock(name);
+          }
+          jsvUnLock(ak);
+          jsvObjectIteratorNext(&ait);
+        }
+        jsvObjectIteratorFree(&ait);
+        jsvUnLock(sk);
+        jsvUnLock(after);
+      }
+      if (node) jsvUnLock(node);
+      jsvObjectIteratorNext(&it);
+    }
+    jsvObjectIteratorFree(&it);
+  }
+
+  bool ok = stIds && evIds && nStates > 0 && nStates < XFSM_NONE && nEvents < XFSM_NOEVENT &&
+            nEdges < XFSM_NONE && nCands < XFSM_NONE;
+
+  /* ---- size + allocate ---- */
+  unsigned int hashSize = 4;
+  while (ok && hashSize < (unsigned int)(2 * (nStates > nEvents ? nStates : nEvents))) hashSize <<= 1;
+  unsigned int maxHandles = (unsigned int)(4 * nStates + 2 * nEvents + 4 * nCands + 2 * nGuardOps + 1);
+  unsigned int handleOffset = (unsigned int)(sizeof(XfsmTable) + nStates * sizeof(XfsmTState) +
+                              nEdges * sizeof(XfsmTEdge) + nCands * sizeof(XfsmTCand) +
+                              (2 * nEvents + 2 * hashSize) * sizeof(uint16_t));
+  handleOffset = (handleOffset + 3u) & ~3u;
+  unsigned int size = handleOffset + maxHandles * (unsigned int)sizeof(JsVarRef);
+  ok = ok && maxHandles < XFSM_NONE;
+
+  JsVar *tv = ok ? xfsm_new_flat(size) : 0;
+  JsVar *refs = tv ? jsvNewEmptyArray() : 0;
+  if (!refs) ok = false;
+
+  if (ok) {
+    XfsmTable *t = (XfsmTable*)xfsm_flat_ptr(tv);
+    t->magic = XFSM_TABLE_MAGIC;
+    t->version = XFSM_TABLE_VERSION;
+    t->stateCount = (uint16_t)nStates;
+    t->eventCount = (uint16_t)nEvents;
+    t->edgeCount = (uint16_t)nEdges;
+    t->candCount = (uint16_t)nCands;
+    t->hashMask = (uint16_t)(hashSize - 1);
+    t->handleOffset = handleOffset;
+    t->flags = nested ? XFSM_TBL_NESTED : 0;
+    t->initial = XFSM_NONE;
+    XfsmCompiler cc = { t, refs, (uint16_t)maxHandles, 0, xfsm_machine_actions_map(machine) };
+
+    JsVar *empty = jsvNewEmptyArray();
+    t->emptyActs = cc_handle(&cc, empty);
+    if (empty) jsvUnLock(empty);
+
+    /* names (copied out of the key vars so they can be shared as values) */
+    JsvObjectIterator it;
+    jsvObjectIteratorNew(&it, stIds);
+    while (jsvObjectIteratorHasValue(&it)) {
+      JsVar *k = jsvObjectIteratorGetKey(&it);
+      JsVar *v = jsvObjectIteratorGetValue(&it);
+      uint16_t id = (uint16_t)jsvGetInteger(v);
+      JsVar *name = jsvAsString(k);
+      tbl_states(t)[id].name = cc_handle(&cc, name);
+      tbl_states(t)[id].any = XFSM_NONE;
+      if (name) { cc_hash_insert(tbl_stHash(t), t->hashMask, name, id); jsvUnLock(name); }
+      jsvUnLock(v); jsvUnLock(k);
+      jsvObjectIteratorNext(&it);
+    }
+    jsvObjectIteratorFree(&it);
+    jsvObjectIteratorNew(&it, evIds);
+    while (jsvObjectIteratorHasValue(&it)) {
+      JsVar *k = jsvObjectIteratorGetKey(&it);
+      JsVar *v = jsvObjectIteratorGetValue(&it);
+      uint16_t id = (uint16_t)jsvGetInteger(v);
+      JsVar *name = jsvAsString(k);
+      tbl_evNames(t)[id] = cc_handle(&cc, name);
+      if (name) {
+        cc_hash_insert(tbl_evHash(t), t->hashMask, name, id);
+        /* interned event object: { type } sharing the name, plus a hidden id */
+        JsVar *ev = jsvNewObject();
+        if (ev) {
+          jsvObjectSetChildAndUnLock(ev, "type", jsvLockAgain(name));
+          jsvObjectSetChildAndUnLock(ev, K_EVID, jsvNewFromInteger(id));
+          tbl_evObjs(t)[id] = cc_handle(&cc, ev);
+          jsvUnLock(ev);
+        }
+        jsvUnLock(name);
+      }
+      jsvUnLock(v); jsvUnLock(k);
+      jsvObjectIteratorNext(&it);
+    }
+    jsvObjectIteratorFree(&it);
+
+    if (initial && jsvIsString(initial)) {
+      int id = cmap_get(stIds, initial);
+      if (id >= 0) t->initial = (uint16_t)id;
+    }
+
+    /* ---- pass 2: per state rows (config order == id order for real states) ---- */
+    uint16_t edgeCount = 0;
+    jsvObjectIteratorNew(&it, statesObj);
+    while (jsvObjectIteratorHasValue(&it)) {
+      JsVar *k = jsvObjectIteratorGetKey(&it);
+      JsVar *node = jsvObjectIteratorGetValue(&it);
+      int sid = cmap_get(stIds, k);
+      if (sid >= 0 && node && jsvIsObject(node)) {
+        XfsmTState *st = &tbl_states(t)[sid];
+        JsVar *e = jsvObjectGetChild(node, K_ENTRY, 0);
+        JsVar *x = jsvObjectGetChild(node, K_EXIT, 0);
+        JsVar *entryList = cc_as_list(e);
+        JsVar *exitList = cc_as_list(x);
+        if (e) jsvUnLock(e);
+        if (x) jsvUnLock(x);
+        st->entry = cc_handle(&cc, entryList);
+        st->exit = cc_handle(&cc, exitList);
+        st->edgeStart = edgeCount;
+
+        JsVar *on = getChildObj(node, K_ON);
+        if (on) {
+          JsvObjectIterator eit;
+          jsvObjectIteratorNew(&eit, on);
+          while (jsvObjectIteratorHasValue(&eit)) {
+            JsVar *ek = jsvObjectIteratorGetKey(&eit);
+            JsVar *ev = jsvObjectIteratorGetValue(&eit);
+            int evId = jsvIsStringEqual(ek, K_ANY) ? XFSM_NONE :
+                       jsvGetStringLength(ek) ? cmap_get(evIds, ek) : -1;
+            if (evId >= 0)
+              cc_emit_edge(&cc, (uint16_t)evId, ev, stIds, exitList, statesObj, &edgeCount);
+            if (ev) jsvUnLock(ev);
+            jsvUnLock(ek);
+            jsvObjectIteratorNext(&eit);
+          }
+          jsvObjectIteratorFree(&eit);
+          jsvUnLock(on);
+        }
+        JsVar *after = getChildObj(node, K_AFTER);
+        if (after) {
+          JsVar *timers = xfsm_after_list(k, after);
+          st->after = cc_handle(&cc, timers);
+          JsvObjectIterator ait;
+          jsvObjectIteratorNew(&ait, after);
+          while (jsvObjectIteratorHasValue(&ait)) {
+            JsVar *ak = jsvObjectIteratorGetKey(&ait);
+            JsVar *name = xfsm_after_name(k, ak, 0);
+            int evId = name ? cmap_get(evIds, name) : -1;
+            if (evId >= 0) {
+              JsVar *av = jsvObjectIteratorGetValue(&ait);
+              cc_emit_edge(&cc, (uint16_t)evId, av, stIds, exitList, statesObj, &edgeCount);
+              if (av) jsvUnLock(av);
+            }
+            if (name) jsvUnLock(name);
+            jsvUnLock(ak);
+            jsvObjectIteratorNext(&ait);
+          }
+          jsvObjectIteratorFree(&ait);
+          if (timers) jsvUnLock(timers);
+          jsvUnLock(after);
+        } else {
+          JsVar *timers = jsvObjectGetChild(node, K_CTIMERS, 0);   /* flattened: rows are in `on` */
+          if (timers) { st->after = cc_handle(&cc, timers); jsvUnLock(timers); }
+        }
+        st->edgeCount = (uint16_t)(edgeCount - st->edgeStart);
+
+        /* sort the row by event id (rows are short: insertion sort) */
+        XfsmTEdge *row = tbl_edges(t) + st->edgeStart;
+        for (int i = 1; i < (int)st->edgeCount; i++) {
+          XfsmTEdge tmp = row[i];
+          int j = i - 1;
+          while (j >= 0 && row[j].event > tmp.event) { row[j+1] = row[j]; j--; }
+          row[j+1] = tmp;
+        }
+        /* the "*" edge sorts last; Edge lookups never match it by id */
+        st->any = (st->edgeCount && row[st->edgeCount-1].event == XFSM_NONE)
+                  ? (uint16_t)(st->edgeStart + st->edgeCount - 1) : XFSM_NONE;
+
+        if (entryList) jsvUnLock(entryList);
+        if (exitList) jsvUnLock(exitList);
+      }
+      if (node) jsvUnLock(node);
+      jsvUnLock(k);
+      jsvObjectIteratorNext(&it);
+    }
+    jsvObjectIteratorFree(&it);
+    /* Handles were allocated before the real candidate count was known */
+    ok = cc.cands == (uint16_t)nCands && edgeCount == (uint16_t)nEdges;
+    if (cc.actsMap) jsvUnLock(cc.actsMap);
+  }
+
+  if (ok) {
+    jsvObjectSetChild(machine, "_refs", refs);
+    jsvObjectSetChild(machine, "_table", tv);
+  }
+
+  if (refs) jsvUnLock(refs);
+  if (tv) jsvUnLock(tv);
+  if (stIds) jsvUnLock(stIds);
+  if (evIds) jsvUnLock(evIds);
+  if (initial) jsvUnLock(initial);
+  jsvUnLock(statesObj);
+  jsvUnLock(cfg);
+  return ok;
+}
+
+bool xfsm_machine_compile(JsVar *machine) {
+  return xfsm_machine_compile_ex(machine, 0);
+}
+
+bool xfsm_machine_is_compiled(JsVar *machine) {
+  XfsmTable *t = 0;
+  JsVar *tv = machine ? xfsm_machine_table(machine, &t) : 0;
+  if (tv) jsvUnLock(tv);
+  return tv != 0;
+}
+
+/* Re-resolve the compiled tables' named actions against the machine's
+ * current actions map (after implementations were swapped at runtime). */
+void xfsm_machine_refresh_actions(JsVar *machine) {
+  XfsmTable *t = 0;
+  JsVar *tv = xfsm_machine_table(machine, &t);
+  if (!tv) return;
+  JsVar *actsMap = xfsm_machine_actions_map(machine);
+  for (uint16_t i = 0; i < t->candCount; i++) {
+    XfsmTCand *c = &tbl_cands(t)[i];
+    if (!c->effects) continue;
+    JsVar *src = tbl_handle(t, c->actions);
+    JsVar *dst = tbl_handle(t, c->effects);
+    if (src && dst) fill_effects(dst, src, actsMap);
+    if (src) jsvUnLock(src);
+    if (dst) jsvUnLock(dst);
+  }
+  if (actsMap) jsvUnLock(actsMap);
+  jsvUnLock(tv);
+}
+
+/* ========================================================================== */
+/*                                Machine                                     */
+/* ========================================================================== */
+/* { compact:true }: once compiled, the machine keeps a config without
+ * `states`. The table pins every var it uses (names, action lists, guards,
+ * `after` lists), so the state nodes, `on` maps and candidate objects can
+ * be freed. The caller's config object itself is not modified. */
+static void xfsm_machine_compact(JsVar *m) {
+  JsVar *st = xfsm_machine_initial_state(m);   /* cached in _init before states go */
+  if (!st) return;
+  jsvUnLock(st);
+  JsVar *cfg = jsvObjectGetChild(m, K_CFG, 0);
+  JsVar *slim = (cfg && jsvIsObject(cfg)) ? jsvNewObject() : 0;
+  if (slim) {
+    JsvObjectIterator it;
+    jsvObjectIteratorNew(&it, cfg);
+    while (jsvObjectIteratorHasValue(&it)) {
+      JsVar *k = jsvObjectIteratorGetKey(&it);
+      if (k && !jsvIsStringEqual(k, K_STATES)) set_child_v_and_unlock(slim, k, jsvObjectIteratorGetValue(&it));
+      if (k) jsvUnLock(k);
+      jsvObjectIteratorNext(&it);
+    }
+    jsvObjectIteratorFree(&it);
+    jsvObjectSetChildAndUnLock(m, K_CFG, slim);
+  }
+  if (cfg) jsvUnLock(cfg);
+}
+
+/* ---------------- Static analysis ----------------
+ * Reachability is a breadth-first walk of the compiled table from the
+ * initial state over candidate targets (after edges included), so nested
+ * machines are analysed as their flattened leaves. */
+static const char * const K_MSTRIPPED = "_stripped";
+
+/* Flags of the states reachable from t->initial: a flat string holding a
+ * uint16 work queue then stateCount bytes (LOCKED), or 0 */
+static JsVar *tbl_reachable(XfsmTable *t) {
+  unsigned int n = t->stateCount;
+  JsVar *v = xfsm_new_flat(n * 3);
+  if (!v) return 0;
+  uint16_t *queue = (uint16_t*)xfsm_flat_ptr(v);
+  uint8_t *seen = (uint8_t*)(queue + n);
+  unsigned int head = 0, tail = 0;
+  if (t->initial < n) { seen[t->initial] = 1; queue[tail++] = t->initial; }
+  while (head < tail) {
+    XfsmTState *st = &tbl_states(t)[queue[head++]];
+    for (unsigned int e = st->edgeStart; e < (unsigned int)st->edgeStart + st->edgeCount; e++) {
+      XfsmTEdge *edge = &tbl_edges(t)[e];
+      for (unsigned int c = edge->cand; c < (unsigned int)edge->cand + edge->candCount; c++) {
+        uint16_t to = tbl_cands(t)[c].target;
+        if (to < n && !seen[to]) { seen[to] = 1; queue[tail++] = to; }
+      }
+    }
+  }
+  return v;
+}
+
+/* { name:true } for each compiled state the initial state can't reach
+ * (LOCKED), or 0 if there are none (or the initial state is unknown) */
+static JsVar *xfsm_machine_unreachable(JsVar *m) {
+  XfsmTable *t = 0;
+  JsVar *tv = xfsm_machine_table(m, &t);
+  if (!tv) return 0;
+  JsVar *rv = t->initial < t->stateCount ? tbl_reachable(t) : 0;
+  JsVar *dead = 0;
+  if (rv) {
+    const uint8_t *seen = (const uint8_t*)xfsm_flat_ptr(rv) + 2 * t->stateCount;
+    for (unsigned int i = 0; i < t->stateCount; i++) {
+      if (seen[i]) continue;
+      if (!dead) dead = jsvNewObject();
+      JsVar *name = dead ? tbl_handle(t, tbl_states(t)[i].name) : 0;
+      if (name) { set_child_v_and_unlock(dead, name, jsvNewFromBool(true)); jsvUnLock(name); }
+    }
+    jsvUnLock(rv);
+  }
+  jsvUnLock(tv);
+  return dead;
+}
+
+/* Compile; with { strip:true } compile again without the states the first
+ * table can't reach. This runs before any service holds a state id, so the
+ * ids may change. The dropped names are kept in `_stripped` for analyze(). */
+static bool xfsm_machine_build(JsVar *m, bool strip) {
+  if (!xfsm_machine_compile(m)) return false;
+  JsVar *dead = strip ? xfsm_machine_unreachable(m) : 0;
+  if (dead) {
+    if (xfsm_machine_compile_ex(m, dead)) jsvObjectSetChild(m, K_MSTRIPPED, dead);
+    jsvUnLock(dead);
+  }
+  return true;
+}
+
+static bool xfsm_option_set(JsVar *opts, const char *name) {
+  JsVar *v = opts ? jsvObjectGetChild(opts, name, 0) : 0;
+  bool set = v && jsvGetBool(v);
+  if (v) jsvUnLock(v);
+  return set;
+}
+
+/* Array of the keys of an object (LOCKED) */
+static JsVar *xfsm_keys(JsVar *o) {
+  JsVar *a = jsvNewEmptyArray();
+  if (!a || !o) return a;
+  JsvObjectIterator it;
+  jsvObjectIteratorNew(&it, o);
+  while (jsvObjectIteratorHasValue(&it)) {
+    JsVar *k = jsvObjectIteratorGetKey(&it);
+    jsvArrayPushAndUnLock(a, jsvAsString(k));
+    jsvUnLock(k);
+    jsvObjectIteratorNext(&it);
+  }
+  jsvObjectIteratorFree(&it);
+  return a;
+}
+
+/* Reachable/unreachable states, per-state events, dead events and counts
+ * of one compiled table, into res */
+static void tbl_analyze(XfsmTable *t, JsVar *res) {
+  JsVar *rv = tbl_reachable(t);
+  JsVar *hv = t->eventCount ? jsvNewFlatStringOfLength(t->eventCount) : 0;
+  JsVar *reach = jsvNewEmptyArray(), *dead = jsvNewEmptyArray(), *events = jsvNewObject();
+  if (!rv || (t->eventCount && !hv) || !reach || !dead || !events) {
+    if (rv) jsvUnLock(rv);
+    if (hv) jsvUnLock(hv);
+    if (reach) jsvUnLock(reach);
+    if (dead) jsvUnLock(dead);
+    if (events) jsvUnLock(events);
+    return;
+  }
+  const uint8_t *seen = (const uint8_t*)xfsm_flat_ptr(rv) + 2 * t->stateCount;
+  uint8_t *handled = hv ? (uint8_t*)jsvGetFlatStringPointer(hv) : 0;
+  if (handled) memset(handled, 0, t->eventCount);
+  int transitions = 0, guards = 0, actions = 0, shadowed = 0;
+  for (unsigned int sid = 0; sid < t->stateCount; sid++) {
+    XfsmTState *st = &tbl_states(t)[sid];
+    JsVar *name = tbl_handle(t, st->name);
+    if (!name) continue;
+    if (!seen[sid]) { jsvArrayPushAndUnLock(dead, name); continue; }
+    jsvArrayPush(reach, name);
+    JsVar *evs = jsvNewEmptyArray();
+    for (unsigned int e = st->edgeStart; e < (unsigned int)st->edgeStart + st->edgeCount; e++) {
+      XfsmTEdge *edge = &tbl_edges(t)[e];
+      JsVar *ev = 0;
+      if (edge->event == XFSM_NONE) ev = jsvNewFromString(K_ANY);
+      else if (edge->event < t->eventCount) {
+        handled[edge->event] = 1;
+        ev = tbl_handle(t, tbl_evNames(t)[edge->event]);
+        if (ev && jsvIsStringEqualOrStartsWith(ev, XFSM_AFTER_PREFIX, true)) { jsvUnLock(ev); ev = 0; }
+      }
+      if (ev && evs) jsvArrayPush(evs, ev);
+      if (ev) jsvUnLock(ev);
+      /* candidates after an unguarded one in the same row can't be taken */
+      bool open = false;
+      for (unsigned int c = edge->cand; c < (unsigned int)edge->cand + edge->candCount; c++) {
+        XfsmTCand *cand = &tbl_cands(t)[c];
+        transitions++;
+        if (open) shadowed++;
+        if (cand->cond || (cand->flags & XFSM_CAND_NATIVE_COND)) guards++;
+        else open = true;
+        JsVar *acts = (cand->flags & XFSM_CAND_HAS_ACTIONS) ? tbl_handle(t, cand->actions) : 0;
+        if (acts) { actions += (int)jsvGetArrayLength(acts); jsvUnLock(acts); }
+      }
+    }
+    if (evs) set_child_v_and_unlock(events, name, evs);
+    jsvUnLock(name);
+  }
+  JsVar *deadEvents = jsvNewEmptyArray();
+  for (unsigned int e = 0; deadEvents && e < t->eventCount; e++) {
+    if (handled[e]) continue;
+    JsVar *ev = tbl_handle(t, tbl_evNames(t)[e]);
+    if (ev && !jsvIsStringEqualOrStartsWith(ev, XFSM_AFTER_PREFIX, true)) jsvArrayPush(deadEvents, ev);
+    if (ev) jsvUnLock(ev);
+  }
+  jsvObjectSetChildAndUnLock(res, "states", reach);
+  jsvObjectSetChildAndUnLock(res, "unreachable", dead);
+  jsvObjectSetChildAndUnLock(res, "events", events);
+  if (deadEvents) jsvObjectSetChildAndUnLock(res, "deadEvents", deadEvents);
+  jsvObjectSetChildAndUnLock(res, "transitions", jsvNewFromInteger(transitions));
+  jsvObjectSetChildAndUnLock(res, "guards", jsvNewFromInteger(guards));
+  jsvObjectSetChildAndUnLock(res, "actions", jsvNewFromInteger(actions));
+  jsvObjectSetChildAndUnLock(res, "shadowed", jsvNewFromInteger(shadowed));
+  if (hv) jsvUnLock(hv);
+  jsvUnLock(rv);
+}
+
+JsVar *xfsm_machine_analyze(JsVar *machine) {
+  if (!machine || !jsvIsObject(machine)) return 0;
+  JsVar *cfg = jsvObjectGetChild(machine, K_CFG, 0);
+  JsVar *opts = jsvObjectGetChild(machine, "_options", 0);
+  bool compiled = xfsm_machine_is_compiled(machine);
+  JsVar *states = cfg ? getChildObj(cfg, K_STATES) : 0;
+
+  /* table cost: a scratch build of the same config (and strip option) while
+   * the states are still there; a compact machine's table owns what it pins */
+  int tableBlocks = 0;
+  JsVar *scratch = states ? jsvNewObject() : 0;
+  if (states) jsvUnLock(states);
+  if (scratch) {
+    jsvObjectSetChild(scratch, K_CFG, cfg);
+    if (opts) jsvObjectSetChild(scratch, "_options", opts);
+    unsigned int mem0 = jsvGetMemoryUsage();
+    if (xfsm_machine_build(scratch, compiled && xfsm_option_set(opts, "strip")))
+      tableBlocks = (int)(jsvGetMemoryUsage() - mem0);
+  } else if (compiled) {
+    JsVar *tv = jsvObjectGetChild(machine, "_table", 0);
+    JsVar *refs = jsvObjectGetChild(machine, "_refs", 0);
+    tableBlocks = (int)(jsvCountJsVarsUsed(tv) + jsvCountJsVarsUsed(refs));
+    if (tv) jsvUnLock(tv);
+    if (refs) jsvUnLock(refs);
+  }
+  if (opts) jsvUnLock(opts);
+
+  XfsmTable *t = 0;
+  JsVar *tv = xfsm_machine_table(machine, &t);
+  if (!tv && scratch) tv = xfsm_machine_table(scratch, &t);
+  JsVar *res = tv ? jsvNewObject() : 0;
+  if (res) {
+    tbl_analyze(t, res);
+    JsVar *stripped = jsvObjectGetChild(machine, K_MSTRIPPED, 0);
+    jsvObjectSetChildAndUnLock(res, "stripped", xfsm_keys(stripped));
+    if (stripped) jsvUnLock(stripped);
+
+    /* per service: what interpret() adds (the initial state is cached per machine) */
+    JsVar *st0 = xfsm_machine_initial_state(machine);
+    if (st0) jsvUnLock(st0);
+    int svcBlocks = 0;
+    unsigned int mem0 = jsvGetMemoryUsage();
+    JsVar *svc = jspNewObject(0, "Service");
+    if (svc) {
+      xfsm_service_init(svc, machine);
+      svcBlocks = (int)(jsvGetMemoryUsage() - mem0);
+      jsvUnLock(svc);
+    }
+    JsVar *blocks = jsvNewObject();
+    if (blocks) {
+      jsvObjectSetChildAndUnLock(blocks, "config", jsvNewFromInteger((JsVarInt)jsvCountJsVarsUsed(cfg)));
+      jsvObjectSetChildAndUnLock(blocks, "table", jsvNewFromInteger(tableBlocks));
+      jsvObjectSetChildAndUnLock(blocks, "service", jsvNewFromInteger(svcBlocks));
+      jsvObjectSetChildAndUnLock(res, "blocks", blocks);
+    }
+  }
+  if (tv) jsvUnLock(tv);
+  if (scratch) jsvUnLock(scratch);
+  if (cfg) jsvUnLock(cfg);
+  return res;
+}
+
+void xfsm_machine_init(JsVar *m) {
+  if (!m || !jsvIsObject(m)) return;
+  /* { compile:false } keeps the interpretive path (config may be mutated later) */
+  JsVar *opts = jsvObjectGetChild(m, "_options", 0);
+  JsVar *comp = opts ? jsvObjectGetChild(opts, "compile", 0) : 0;
+  bool compile = !comp || jsvGetBool(comp) || jsvIsUndefined(comp);
+  if (comp) jsvUnLock(comp);
+  bool compact = xfsm_option_set(opts, "compact");
+  bool strip = xfsm_option_set(opts, "strip");
+  if (opts) jsvUnLock(opts);
+  if (compile && xfsm_machine_build(m, strip) && compact) xfsm_machine_compact(m);
+}
+
+/* One initial entry item: assigns go into *pCtx, anything else is deferred
+ * to start() via `rest`. */
+static void init_entry_item(JsVar **pCtx, JsVar *rest, JsVar *item, JsVar *evtInit) {
+  if (jsvIsObject(item) && is_assign_like(item)) {
+    apply_assignment(0 /*svc unused*/, pCtx, item, evtInit);
+  } else if (rest) {
+    jsvArrayPush(rest, item);
+  }
+}
+
+/* Build the initial state object. Its context is a shallow copy of
+ * config.context (entry assigns applied), never config.context itself. */
+static JsVar *xfsm_machine_build_initial_state(JsVar *cfg) {
+  JsVar *initial = jsvObjectGetChild(cfg, "initial", 0);
+  if (!initial || !jsvIsString(initial) || !jsvGetStringLength(initial)) {
+    if (initial) jsvUnLock(initial);
+    return 0;
   }
 
   JsVar *states = jsvObjectGetChild(cfg, K_STATES, 0);
   if (!states || !jsvIsObject(states)) {
     if (states) jsvUnLock(states);
-    jsvUnLock(cfg);
+    jsvUnLock(initial);
     return 0;
   }
 
-  JsVar *node = jsvObjectGetChild(states, initBuf, 0);
+  /* nested: the initial leaf, entering each state on the initial chain */
+  XfsmChain ch;
   JsVar *entryRaw = 0;
-  if (node && jsvIsObject(node)) {
-    entryRaw = jsvObjectGetChild(node, K_ENTRY, 0);
-  }
-
-  /* Build working context as a copy of config.context (service owns its own copy later) */
-  JsVar *ctxBase = jsvObjectGetChild(cfg, K_CONTEXT, 0); /* may be 0 */
-  JsVar *ctx = jsvNewObject();
-  if (!ctx) {
-    if (entryRaw) jsvUnLock(entryRaw);
-    if (node) jsvUnLock(node);
-    jsvUnLock(states);
-    jsvUnLock(cfg);
-    return 0;
-  }
-  if (ctxBase && jsvIsObject(ctxBase)) {
-    JsvObjectIterator it;
-    jsvObjectIteratorNew(&it, ctxBase);
-    while (jsvObjectIteratorHasValue(&it)) {
-      JsVar *k = jsvObjectIteratorGetKey(&it);
-      JsVar *v = jsvObjectIteratorGetValue(&it);
-      if (k && v) {
-        JsVar *ks = jsvAsString(k);
-        char keybuf[64] = "";
-        if (ks) { jsvGetString(ks, keybuf, sizeof(keybuf)); jsvUnLock(ks); }
-        if (keybuf[0]) jsvObjectSetChildAndUnLock(ctx, keybuf, jsvLockAgain(v));
-      }
-      if (k) jsvUnLock(k);
-      if (v) jsvUnLock(v);
-      jsvObjectIteratorNext(&it);
+  if (chain_initial(&ch, states, initial)) {
+    if (ch.depth > 1) {
+      JsVar *leaf = chain_path(&ch);
+      if (leaf) { jsvUnLock(initial); initial = leaf; }
+      entryRaw = jsvNewEmptyArray();
+      for (int i = 0; entryRaw && i < ch.depth; i++) cc_push_hook(entryRaw, ch.node[i], K_ENTRY);
+    } else {
+      entryRaw = jsvObjectGetChild(ch.node[0], K_ENTRY, 0);
     }
-    jsvObjectIteratorFree(&it);
   }
-  if (ctxBase) jsvUnLock(ctxBase);
+  chain_trunc(&ch, 0);
+
+  JsVar *cfgCtx = jsvObjectGetChild(cfg, K_CONTEXT, 0); /* may be 0 */
+  JsVar *ctx = (cfgCtx && jsvIsObject(cfgCtx)) ? jsvCopy(cfgCtx, true) : jsvNewObject();
+  if (cfgCtx) jsvUnLock(cfgCtx);
 
   /* Split entry into assigns (apply to ctx now) and non-assign actions (defer to start) */
-  JsVar *nonAssignActs = jsvNewArray(NULL, 0);
-  if (entryRaw) {
-    bool isArr = jsvIsArray(entryRaw);
-    JsVarInt len = isArr ? jsvGetArrayLength(entryRaw) : 1;
+  JsVar *nonAssignActs = jsvNewEmptyArray();
+  if (entryRaw && ctx) {
     JsVar *evtInit = jsvNewObject();
     if (evtInit) jsvObjectSetChildAndUnLock(evtInit, "type", jsvNewFromString("xstate.init"));
-
-    for (JsVarInt i=0;i<len;i++) {
-      JsVar *item = isArr ? jsvGetArrayItem(entryRaw, i) : jsvLockAgain(entryRaw);
-      if (!item) continue;
-      if (jsvIsObject(item) && is_assign_like(item)) {
-        apply_assignment(0 /*svc unused*/, &ctx, item, evtInit);
-      } else {
-        jsvArrayPush(nonAssignActs, item);
+    if (jsvIsArray(entryRaw)) {
+      JsvObjectIterator it;
+      jsvObjectIteratorNew(&it, entryRaw);
+      while (jsvObjectIteratorHasValue(&it)) {
+        JsVar *item = jsvObjectIteratorGetValue(&it);
+        if (item) { init_entry_item(&ctx, nonAssignActs, item, evtInit); jsvUnLock(item); }
+        jsvObjectIteratorNext(&it);
       }
-      jsvUnLock(item);
+      jsvObjectIteratorFree(&it);
+    } else {
+      init_entry_item(&ctx, nonAssignActs, entryRaw, evtInit);
     }
     if (evtInit) jsvUnLock(evtInit);
   }
 
-  JsVar *st = new_state_obj(initBuf, ctx, nonAssignActs, false /*changed*/);
+  JsVar *st = new_state_obj_v(initial, ctx, nonAssignActs, false /*changed*/);
+  state_obj_set_nested(st, xfsm_states_nested(states));
 
   if (nonAssignActs) jsvUnLock(nonAssignActs);
   if (ctx) jsvUnLock(ctx);
   if (entryRaw) jsvUnLock(entryRaw);
-  if (node) jsvUnLock(node);
   jsvUnLock(states);
+  jsvUnLock(initial);
+  return st; /* locked */
+}
+
+/**
+ * xfsm_machine_initial_state
+ * Initial state object: { value, context, actions, changed:false }
+ * Note: returns actions = state's entry[] (if any). Service.start() will execute them.
+ *
+ * Compiled machines build it once and keep it in _init; every call (and
+ * every service of the machine) shares that object, so treat it as
+ * read-only. Each service takes its own copy of the context on start().
+ */
+JsVar *xfsm_machine_initial_state(JsVar *machine) {
+  if (!machine || !jsvIsObject(machine)) return 0;
+
+  JsVar *st = jsvObjectGetChild(machine, K_MINIT, 0);
+  if (st) return st;
+
+  JsVar *cfg = jsvObjectGetChild(machine, K_CFG, 0);
+  if (!cfg) return 0;
+
+  /* Flat-only validation (dev-time aid). Normally already done by the
+   * constructor; this logs if nested states are found and we continue safely.
+   */
+  (void)xfsm_machine_validated(machine, cfg);
+
+  st = xfsm_machine_build_initial_state(cfg);
   jsvUnLock(cfg);
+
+  /* the compiled table is a snapshot of the config: so is its initial state */
+  XfsmTable *t = 0;
+  JsVar *tv = st ? xfsm_machine_table(machine, &t) : 0;
+  if (tv) {
+    jsvObjectSetChild(machine, K_MINIT, st);
+    jsvUnLock(tv);
+  }
   return st; /* locked */
 }
 
+/**
+ * xfsm_machine_event
+ * Interned event object { type:name } for a machine (LOCKED). Events in the
+ * compiled table come from the table (send() recognises them by id); other
+ * names are created once and cached in machine._events. Shared by every
+ * caller, so don't attach payload to it.
+ */
+JsVar *xfsm_machine_event(JsVar *machine, JsVar *name) {
+  if (!machine || !jsvIsObject(machine) || !name || !jsvIsString(name)) return 0;
+  XfsmTable *t = 0;
+  JsVar *tv = xfsm_machine_table(machine, &t);
+  if (tv) {
+    uint16_t id = tbl_event_id(t, name);
+    JsVar *ev = id != XFSM_NONE ? tbl_handle(t, tbl_evObjs(t)[id]) : 0;
+    jsvUnLock(tv);
+    if (ev) return ev;
+  }
+  JsVar *cache = jsvObjectGetChild(machine, K_MEVENTS, 0);
+  if (!cache) {
+    cache = jsvNewObject();
+    if (!cache) return 0;
+    jsvObjectSetChild(machine, K_MEVENTS, cache);
+  }
+  JsVar *n = jsvFindChildFromVar(cache, name, false);
+  JsVar *ev = n ? jsvSkipNameAndUnLock(n) : 0;
+  if (!ev) {
+    ev = jsvNewObject();
+    n = ev ? jsvFindChildFromVar(cache, name, true) : 0;
+    if (n) {
+      jsvObjectSetChildAndUnLock(ev, "type", jsvLockAgain(name));
+      jsvSetValueOfName(n, ev);
+      jsvUnLock(n);
+    }
+  }
+  jsvUnLock(cache);
+  return ev;
+}
+
+#ifdef XFSM_HAS_PURE_TRANSITION
 /**
  * xfsm_machine_transition (shim)
  * Keep backward-compat signature using string event.
@@ -935,26 +2874,73 @@ JsVar *xfsm_machine_initial_state(JsVar *machine) {
 JsVar *xfsm_machine_transition(JsVar *machine, JsVar *stateOrValue, JsVar *eventStr /*string*/) {
   if (!machine || !jsvIsObject(machine) || !eventStr || !jsvIsString(eventStr))
     return 0;
-  JsVar *evtObj = jsvNewObject();
+  JsVar *evtObj = xfsm_machine_event(machine, eventStr);
   if (!evtObj) return 0;
-  jsvObjectSetChildAndUnLock(evtObj, "type", jsvLockAgain(eventStr));
   JsVar *res = xfsm_machine_transition_ex(machine, stateOrValue, evtObj);
   jsvUnLock(evtObj);
   return res; /* LOCKED or 0 */
 }
+#endif
+
+/* Select from on[event] candidates: shorthand, object, or the first array
+ * element whose cond(ctx,evt) passes. Returns LOCKED candidate object or 0. */
+static JsVar *xfsm_select_cand(JsVar *cands, JsVar *ctx, JsVar *evt) {
+  if (!cands) return 0;
+  JsVar *candSel = 0;
+  if (jsvIsString(cands)) {
+    /* shorthand "B" -> { target:"B" } */
+    JsVar *obj = jsvNewObject();
+    if (obj) jsvObjectSetChildAndUnLock(obj, K_TARGET, jsvLockAgain(cands));
+    candSel = obj;
+  } else if (jsvIsObject(cands)) {
+    JsVar *c = jsvLockAgain(cands);
+    JsVar *cond = jsvObjectGetChild(c, K_COND, 0);
+    bool pass = xfsm_cond_passes(cond, ctx, evt);
+    if (cond) jsvUnLock(cond);
+    candSel = pass ? c : 0;
+    if (!pass) jsvUnLock(c);
+  } else if (jsvIsArray(cands)) {
+    JsVarInt len = jsvGetArrayLength(cands);
+    for (JsVarInt i=0;i<len;i++) {
+      JsVar *el = jsvGetArrayItem(cands, i);
+      if (!el) continue;
+
+      JsVar *c = 0;
+      if (jsvIsString(el)) {
+        c = jsvNewObject();
+        if (c) jsvObjectSetChildAndUnLock(c, K_TARGET, jsvLockAgain(el));
+      } else if (jsvIsObject(el)) {
+        c = jsvLockAgain(el);
+      }
+      jsvUnLock(el);
+      if (!c) continue;
+
+      JsVar *cond = jsvObjectGetChild(c, K_COND, 0);
+      bool pass = xfsm_cond_passes(cond, ctx, evt);
+      if (cond) jsvUnLock(cond);
+
+      if (pass) { candSel = c; break; }
+      jsvUnLock(c);
+    }
+  }
+  return candSel;
+}
 
 /**
- * xfsm_machine_transition_ex
- * Compute next state object given machine, prev state/value, and OBJECT-form event.
+ * xfsm_machine_transition_interp
+ * Interpretive path (Machine built with { compile:false }, or compile failed):
+ * walks config.states[from].on[event] on every call.
  * - Supports shorthand: on[event] = "B"
  * - Supports arrays with cond(ctx, evt) (first truthy wins)
+ * - Falls back to on["*"] when no on[event] candidate is taken
  * - Supports targetless (actions only, keep value, changed=false)
  * - Builds actions in order: exit[], transition.actions[], entry[]
- * Returns LOCKED state object or 0 if no transition.
+ * - after: { delay: ... } values under their "xstate.after(delay)#state" events
+ * Returns LOCKED state object or 0 if no transition. *pEntered (if given)
+ * is set when a targeted candidate was taken, i.e. the state was re-entered.
  */
-JsVar *xfsm_machine_transition_ex(JsVar *machine, JsVar *stateOrValue, JsVar *eventObj /*object*/) {
-  if (!machine || !jsvIsObject(machine) || !eventObj || !jsvIsObject(eventObj))
-    return 0;
+static JsVar *xfsm_machine_transition_interp(JsVar *machine, JsVar *stateOrValue, JsVar *eventObj /*object*/, bool *pEntered) {
+  if (pEntered) *pEntered = false;
 
   /* config + states */
   JsVar *cfg = jsvObjectGetChild(machine, K_CFG, 0);
@@ -966,48 +2952,47 @@ JsVar *xfsm_machine_transition_ex(JsVar *machine, JsVar *stateOrValue, JsVar *ev
     return 0;
   }
 
-  /* event.type => evBuf */
-  char evBuf[64] = "";
-  JsVar *etype = jsvObjectGetChild(eventObj, "type", 0);
-  if (etype && jsvIsString(etype)) str_from_jsv(etype, evBuf, sizeof(evBuf));
-  if (etype) jsvUnLock(etype);
-  if (!evBuf[0]) { jsvUnLock(states); jsvUnLock(cfg); return 0; }
+  /* event.type => evName (names are looked up by JsVar, never copied out) */
+  JsVar *evName = jsvObjectGetChild(eventObj, "type", 0);
+  if (!evName || !jsvIsString(evName) || !jsvGetStringLength(evName)) {
+    if (evName) jsvUnLock(evName);
+    jsvUnLock(states); jsvUnLock(cfg);
+    return 0;
+  }
 
-  /* determine fromBuf and guard context (prefer prev state's context if provided) */
-  char fromBuf[64] = "";
+  /* determine fromVal and guard context (prefer prev state's context if provided) */
+  JsVar *fromVal = 0;  /* locked or 0 */
   JsVar *guardCtx = 0; /* locked or 0 */
 
   if (stateOrValue) {
     if (jsvIsObject(stateOrValue)) {
-      JsVar *sv = jsvObjectGetChild(stateOrValue, S_VALUE, 0);
-      if (sv && jsvIsString(sv)) str_from_jsv(sv, fromBuf, sizeof(fromBuf));
-      if (sv) jsvUnLock(sv);
+      fromVal = jsvObjectGetChild(stateOrValue, S_VALUE, 0);
       guardCtx = jsvObjectGetChild(stateOrValue, S_CTX, 0); /* may be 0 */
     } else if (jsvIsString(stateOrValue)) {
-      str_from_jsv(stateOrValue, fromBuf, sizeof(fromBuf));
+      fromVal = jsvLockAgain(stateOrValue);
     }
   }
-  if (!fromBuf[0]) {
-    JsVar *initial = jsvObjectGetChild(cfg, "initial", 0);
-    if (initial && jsvIsString(initial)) str_from_jsv(initial, fromBuf, sizeof(fromBuf));
-    if (initial) jsvUnLock(initial);
+  if (fromVal && (!jsvIsString(fromVal) || !jsvGetStringLength(fromVal))) { jsvUnLock(fromVal); fromVal = 0; }
+  if (!fromVal) {
+    fromVal = jsvObjectGetChild(cfg, "initial", 0);
+    if (fromVal && (!jsvIsString(fromVal) || !jsvGetStringLength(fromVal))) { jsvUnLock(fromVal); fromVal = 0; }
   }
   if (!guardCtx) {
     /* fall back to machine.config.context */
     guardCtx = jsvObjectGetChild(cfg, K_CONTEXT, 0); /* may be 0 */
   }
-  if (!fromBuf[0]) {
+  if (!fromVal) {
     if (guardCtx) jsvUnLock(guardCtx);
-    jsvUnLock(states); jsvUnLock(cfg);
+    jsvUnLock(evName); jsvUnLock(states); jsvUnLock(cfg);
     return 0;
   }
 
   /* source node */
-  JsVar *srcNode = jsvObjectGetChild(states, fromBuf, 0);
+  JsVar *srcNode = get_child_v(states, fromVal);
   if (!srcNode || !jsvIsObject(srcNode)) {
     if (srcNode) jsvUnLock(srcNode);
     if (guardCtx) jsvUnLock(guardCtx);
-    jsvUnLock(states); jsvUnLock(cfg);
+    jsvUnLock(fromVal); jsvUnLock(evName); jsvUnLock(states); jsvUnLock(cfg);
     return 0;
   }
 
@@ -1016,77 +3001,27 @@ JsVar *xfsm_machine_transition_ex(JsVar *machine, JsVar *stateOrValue, JsVar *ev
 
   /* on[event] candidates: string | object | array */
   JsVar *cands = 0;
-  if (onObj && jsvIsObject(onObj)) cands = jsvObjectGetChild(onObj, evBuf, 0);
-
-  /* select candidate (shorthand, object, or first array element whose cond(ctx,evt) passes) */
-  JsVar *candSel = 0;
-
-  if (cands) {
-    if (jsvIsString(cands)) {
-      /* shorthand "B" -> { target:"B" } */
-      char toTmp[64]=""; str_from_jsv(cands, toTmp, sizeof(toTmp));
-      JsVar *obj = jsvNewObject();
-      if (obj) jsvObjectSetChildAndUnLock(obj, K_TARGET, jsvNewFromString(toTmp));
-      candSel = obj;
-    } else if (jsvIsObject(cands)) {
-      JsVar *c = jsvLockAgain(cands);
-      bool pass = true;
-      JsVar *cond = jsvObjectGetChild(c, K_COND, 0);
-      if (cond) {
-        if (jsvIsFunction(cond)) {
-          JsVar *args[2] = { guardCtx ? jsvLockAgain(guardCtx) : jsvNewObject(), jsvLockAgain(eventObj) };
-          JsVar *res = xfsm_callJsFunction(cond, 0, args, 2);
-          if (args[0]) jsvUnLock(args[0]);
-          if (args[1]) jsvUnLock(args[1]);
-          pass = res ? jsvGetBool(res) : false;  /* ✔ truthiness via jsvGetBool */
-          if (res) jsvUnLock(res);
-        }
-        jsvUnLock(cond);
-      }
-      candSel = pass ? c : 0;
-      if (!pass) jsvUnLock(c);
-    } else if (jsvIsArray(cands)) {
-      JsVarInt len = jsvGetArrayLength(cands);
-      for (JsVarInt i=0;i<len;i++) {
-        JsVar *el = jsvGetArrayItem(cands, i);
-        if (!el) continue;
-
-        JsVar *c = 0;
-        if (jsvIsString(el)) {
-          char toTmp[64]=""; str_from_jsv(el, toTmp, sizeof(toTmp));
-          c = jsvNewObject();
-          if (c) jsvObjectSetChildAndUnLock(c, K_TARGET, jsvNewFromString(toTmp));
-        } else if (jsvIsObject(el)) {
-          c = jsvLockAgain(el);
-        }
-        jsvUnLock(el);
-        if (!c) continue;
-
-        bool pass = true;
-        JsVar *cond = jsvObjectGetChild(c, K_COND, 0);
-        if (cond) {
-          if (jsvIsFunction(cond)) {
-            JsVar *args[2] = { guardCtx ? jsvLockAgain(guardCtx) : jsvNewObject(), jsvLockAgain(eventObj) };
-            JsVar *res = xfsm_callJsFunction(cond, 0, args, 2);
-            if (args[0]) jsvUnLock(args[0]);
-            if (args[1]) jsvUnLock(args[1]);
-            pass = res ? jsvGetBool(res) : false;  /* ✔ truthiness via jsvGetBool */
-            if (res) jsvUnLock(res);
-          }
-          jsvUnLock(cond);
-        }
+  if (onObj && jsvIsObject(onObj)) cands = get_child_v(onObj, evName);
+  bool timer = false;
+  if (!cands && jsvIsStringEqualOrStartsWith(evName, XFSM_AFTER_PREFIX, true)) {
+    cands = xfsm_after_cands(srcNode, fromVal, evName);
+    timer = cands != 0;
+  }
+  jsvUnLock(evName);
 
-        if (pass) { candSel = c; break; }
-        jsvUnLock(c);
-      }
-    }
+  /* select candidate; nothing passing falls back to on["*"] (not for own timers) */
+  JsVar *candSel = xfsm_select_cand(cands, guardCtx, eventObj);
+  if (!candSel && !timer && onObj && jsvIsObject(onObj)) {
+    JsVar *any = jsvObjectGetChild(onObj, K_ANY, 0);
+    if (any) { candSel = xfsm_select_cand(any, guardCtx, eventObj); jsvUnLock(any); }
   }
 
   if (!candSel) {
     /* No-match => return unchanged state object with empty actions */
     JsVar *allActs = jsvNewArray(NULL, 0);
-    JsVar *st = new_state_obj(fromBuf, guardCtx /*locked or 0*/, allActs, false /*changed*/);
+    JsVar *st = new_state_obj_v(fromVal, guardCtx /*locked or 0*/, allActs, false /*changed*/);
     if (allActs) jsvUnLock(allActs);
+    jsvUnLock(fromVal);
     if (cands) jsvUnLock(cands);
     if (exitArr) jsvUnLock(exitArr);
     if (onObj) jsvUnLock(onObj);
@@ -1097,11 +3032,10 @@ JsVar *xfsm_machine_transition_ex(JsVar *machine, JsVar *stateOrValue, JsVar *ev
   }
 
   /* Determine target before composing actions */
-  char toBuf[64] = "";
-  JsVar *t = jsvObjectGetChild(candSel, K_TARGET, 0);
-  if (t && jsvIsString(t)) str_from_jsv(t, toBuf, sizeof(toBuf));
-  if (t) jsvUnLock(t);
-  bool targetless = (toBuf[0] == 0);
+  JsVar *toVal = jsvObjectGetChild(candSel, K_TARGET, 0);
+  if (toVal && (!jsvIsString(toVal) || !jsvGetStringLength(toVal))) { jsvUnLock(toVal); toVal = 0; }
+  bool targetless = !toVal;
+  if (pEntered) *pEntered = !targetless;
 
   /* Build actions: targeted => exit + trans.actions + entry; targetless => trans.actions only */
   JsVar *allActs = jsvNewArray(NULL, 0);
@@ -1129,7 +3063,7 @@ JsVar *xfsm_machine_transition_ex(JsVar *machine, JsVar *stateOrValue, JsVar *ev
 
   /* entry[] if targeted */
   if (!targetless) {
-    JsVar *dstNode = jsvObjectGetChild(states, toBuf, 0);
+    JsVar *dstNode = get_child_v(states, toVal);
     if (dstNode && jsvIsObject(dstNode)) {
       JsVar *entryArr = jsvObjectGetChild(dstNode, K_ENTRY, 0);
       if (entryArr) {
@@ -1146,9 +3080,11 @@ JsVar *xfsm_machine_transition_ex(JsVar *machine, JsVar *stateOrValue, JsVar *ev
   }
 
   /* create next state object (machine path: context is the guardCtx snapshot) */
-  bool changed = ( (!targetless) && (0 != strcmp(fromBuf, toBuf)) ) || (jsvGetArrayLength(allActs) > 0);
-  JsVar *st = new_state_obj(targetless ? fromBuf : toBuf, guardCtx /*locked or 0*/, allActs, changed);
+  bool changed = ( (!targetless) && (0 != jsvCompareString(fromVal, toVal, 0, 0, false)) ) || (jsvGetArrayLength(allActs) > 0);
+  JsVar *st = new_state_obj_v(targetless ? fromVal : toVal, guardCtx /*locked or 0*/, allActs, changed);
 
+  if (toVal) jsvUnLock(toVal);
+  jsvUnLock(fromVal);
   if (allActs) jsvUnLock(allActs);
   if (transActs) jsvUnLock(transActs);
   if (candSel) jsvUnLock(candSel);
@@ -1162,11 +3098,293 @@ JsVar *xfsm_machine_transition_ex(JsVar *machine, JsVar *stateOrValue, JsVar *ev
   return st; /* LOCKED */
 }
 
+/* Does candidate candIdx (from fromId) change anything? A no-match
+ * (XFSM_NONE), or a self/targetless candidate without actions, does not. */
+static bool tbl_cand_changes(XfsmTable *t, uint16_t fromId, uint16_t candIdx) {
+  if (candIdx == XFSM_NONE) return false;
+  XfsmTCand *c = &tbl_cands(t)[candIdx];
+  return (c->flags & XFSM_CAND_HAS_ACTIONS) || (c->target != XFSM_NONE && c->target != fromId);
+}
+
+/* Build the next state object for a selected candidate (or no-match when
+ * candIdx == XFSM_NONE). *pToId receives the resulting state id. If `reuse`
+ * is given it is updated in place and returned (locked again) instead. */
+static JsVar *tbl_state_obj(XfsmTable *t, uint16_t fromId, uint16_t candIdx, JsVar *ctx, uint16_t *pToId, JsVar *reuse) {
+  uint16_t toId = fromId;
+  uint16_t actsH = t->emptyActs;
+  if (candIdx != XFSM_NONE) {
+    XfsmTCand *c = &tbl_cands(t)[candIdx];
+    if (c->target != XFSM_NONE) toId = c->target;
+    if (c->flags & XFSM_CAND_HAS_ACTIONS) actsH = c->actions;
+  }
+  if (pToId) *pToId = toId;
+  JsVar *value = tbl_handle(t, tbl_states(t)[toId].name);
+  JsVar *acts = tbl_handle(t, actsH);
+  JsVar *st;
+  if (reuse) {
+    reuse_state_obj(reuse, value, ctx, acts, tbl_cand_changes(t, fromId, candIdx));
+    st = jsvLockAgain(reuse);
+  } else {
+    st = new_state_obj_v(value, ctx, acts, tbl_cand_changes(t, fromId, candIdx));
+    state_obj_set_nested(st, t->flags & XFSM_TBL_NESTED);
+  }
+  if (acts) jsvUnLock(acts);
+  if (value) jsvUnLock(value);
+  return st; /* LOCKED */
+}
+
+/* Event type of an event (string, or object with .type) as a state-table
+ * event id. Reads the type in place, so no event object is needed. An
+ * interned event of this machine (machine.event(name)) carries its id. */
+static uint16_t tbl_event_of(XfsmTable *t, JsVar *event) {
+  if (jsvIsObject(event)) {
+    JsVar *eid = jsvObjectGetChild(event, K_EVID, 0);
+    if (eid) {
+      JsVarInt id = jsvGetInteger(eid);
+      jsvUnLock(eid);
+      if (id >= 0 && id < t->eventCount) {
+        uint16_t h = tbl_evObjs(t)[id];
+        if (h && h <= t->handleCount && tbl_handles(t)[h-1] == jsvGetRef(event)) return (uint16_t)id;
+      }
+    }
+  }
+  JsVar *etype = jsvIsObject(event) ? jsvObjectGetChild(event, "type", 0)
+                                    : (jsvIsString(event) ? jsvLockAgain(event) : 0);
+  uint16_t evId = XFSM_NONE;
+  if (etype && jsvIsString(etype) && jsvGetStringLength(etype)) evId = tbl_event_id(t, etype);
+  else evId = XFSM_NOEVENT; /* no/empty type: not a transition at all */
+  if (etype) jsvUnLock(etype);
+  return evId;
+}
+
+#ifdef XFSM_HAS_PURE_TRANSITION
+/**
+ * xfsm_machine_transition_ex
+ * Compute next state object given machine, prev state/value, and OBJECT-form event.
+ * Uses the compiled table when present (see xfsm_machine_compile), otherwise
+ * the interpretive config walk.
+ * Returns LOCKED state object, or 0 if the event has no type or the source
+ * state is unknown. An unmatched event yields the unchanged state.
+ */
+JsVar *xfsm_machine_transition_ex(JsVar *machine, JsVar *stateOrValue, JsVar *eventObj /*object*/) {
+  if (!machine || !jsvIsObject(machine) || !eventObj || !jsvIsObject(eventObj))
+    return 0;
+
+  XfsmTable *t = 0;
+  JsVar *tv = xfsm_machine_table(machine, &t);
+  if (!tv) return xfsm_machine_transition_interp(machine, stateOrValue, eventObj, 0);
+
+  uint16_t evId = tbl_event_of(t, eventObj);
+  if (evId == XFSM_NOEVENT) { jsvUnLock(tv); return 0; }
+
+  /* source state + guard context (prefer prev state's context if provided) */
+  uint16_t fromId = t->initial;
+  JsVar *guardCtx = 0;
+  if (stateOrValue && jsvIsObject(stateOrValue)) {
+    JsVar *sv = jsvObjectGetChild(stateOrValue, S_VALUE, 0);
+    if (sv && jsvIsString(sv)) fromId = tbl_state_id(t, sv);
+    if (sv) jsvUnLock(sv);
+    guardCtx = jsvObjectGetChild(stateOrValue, S_CTX, 0);
+  } else if (stateOrValue && jsvIsString(stateOrValue)) {
+    fromId = tbl_state_id(t, stateOrValue);
+  }
+  if (fromId == XFSM_NONE) {
+    if (guardCtx) jsvUnLock(guardCtx);
+    jsvUnLock(tv);
+    return 0;
+  }
+  if (!guardCtx) {
+    JsVar *cfg = jsvObjectGetChild(machine, K_CFG, 0);
+    if (cfg) { guardCtx = jsvObjectGetChild(cfg, K_CONTEXT, 0); jsvUnLock(cfg); }
+  }
+
+  uint16_t ci = tbl_select(t, fromId, evId, guardCtx, eventObj);
+  JsVar *st = tbl_state_obj(t, fromId, ci, guardCtx, 0, 0);
+
+  if (guardCtx) jsvUnLock(guardCtx);
+  jsvUnLock(tv);
+  return st; /* LOCKED */
+}
+#endif /* XFSM_HAS_PURE_TRANSITION */
+
 /* ========================================================================== */
 /*                           Service / Interpreter                             */
 /* ========================================================================== */
+static const char * const K_SSID    = "_sid";
+static const char * const K_SFLAGS  = "_flags";
+static const char * const K_SOPTS   = "_options";
+static const char * const K_SBUS    = "_bus";
+static const char * const K_SBSID   = "_bsid";
+
+/* _flags: packed service word. Low bits hold the XfsmStatus; the rest are
+ * derived once from interpret(options) in xfsm_service_init. */
+#define XFSM_SVC_STATUS_MASK      0x0003  /* XfsmStatus */
+#define XFSM_SVC_QUIET_UNCHANGED  0x0004  /* { notifyUnchanged:false } */
+#define XFSM_SVC_OWN_ACTIONS      0x0008  /* { actions:{...} }: names resolve per service */
+#define XFSM_SVC_SHARED_CTX       0x0010  /* _context is still the initial state's context */
+#define XFSM_SVC_IMMUTABLE_CTX    0x0020  /* Machine { immutableContext:true }: new context per send */
+#define XFSM_SVC_REUSE_STATE      0x0040  /* { reuseState:true }: update one state object in place */
+#define XFSM_SVC_OWN_STATE        0x0080  /* _state is this service's own (reusable) object */
+#define XFSM_SVC_COALESCE         0x0100  /* { coalesce:true }: one listener call per idle tick */
+#define XFSM_SVC_NOTIFY_PENDING   0x0200  /* a coalesced notification is queued */
+#define XFSM_SVC_PROFILE          0x0400  /* { profile:true } / profile(true), XFSM_PROFILE builds */
+#define XFSM_SVC_TRACE            0x0800  /* { trace:N }: transitions recorded in `_trace` */
+#define XFSM_SVC_BUS              0x1000  /* registered with an FSM.Bus (`_bus`) */
+
+static void xfsm_bus_sync(JsVar *svc);
+
+static int xfsm_service_flags(JsVar *svc) {
+  JsVar *f = jsvObjectGetChild(svc, K_SFLAGS, 0);
+  int flags = f ? (int)jsvGetInteger(f) : 0;
+  if (f) jsvUnLock(f);
+  return flags;
+}
+static void xfsm_service_set_flags(JsVar *svc, int flags) {
+  jsvObjectSetChildAndUnLock(svc, K_SFLAGS, jsvNewFromInteger(flags));
+}
+static void xfsm_service_set_status(JsVar *svc, XfsmStatus status) {
+  xfsm_service_set_flags(svc, (xfsm_service_flags(svc) & ~XFSM_SVC_STATUS_MASK) | (int)status);
+}
+XfsmStatus xfsm_service_status(JsVar *svc) {
+  if (!svc) return XFSM_STATUS_NOTSTARTED;
+  return (XfsmStatus)(xfsm_service_flags(svc) & XFSM_SVC_STATUS_MASK);
+}
+
+/* Copy-on-write context: the first assign on a service whose _context is
+ * still shared (with the previous state under immutableContext, or with the
+ * initial state before start()) swaps in a shallow copy. Untouched keys keep pointing
+ * at the same values. The caller persists *pCtx to _context afterwards. */
+static void xfsm_service_claim_context(JsVar *svc, JsVar **pCtx) {
+  if (!svc || !*pCtx || !jsvIsObject(*pCtx)) return;
+  int flags = xfsm_service_flags(svc);
+  if (!(flags & XFSM_SVC_SHARED_CTX)) return;
+  JsVar *c = jsvCopy(*pCtx, true);
+  if (!c) return;
+  jsvUnLock(*pCtx);
+  *pCtx = c;
+  xfsm_service_set_flags(svc, flags & ~XFSM_SVC_SHARED_CTX);
+}
+
+/* Current state id of a service on the compiled path */
+static void xfsm_service_set_sid_initial(JsVar *svc, JsVar *machine) {
+  XfsmTable *t = 0;
+  JsVar *tv = xfsm_machine_table(machine, &t);
+  if (!tv) return;
+  jsvObjectSetChildAndUnLock(svc, K_SSID, jsvNewFromInteger(t->initial));
+  jsvUnLock(tv);
+}
+
+/* Resolve the actions map once and keep a direct reference in _actsMap
+ * (null when there is none). A service with its own { actions } cannot use
+ * the machine's pre-resolved lists, so that is recorded in _flags. */
+static void xfsm_service_cache_actions(JsVar *svc) {
+  JsVar *opts = jsvObjectGetChild(svc, K_SOPTS, 0);
+  JsVar *own = opts ? jsvObjectGetChild(opts, "actions", 0) : 0;
+  int flags = xfsm_service_flags(svc) & ~XFSM_SVC_OWN_ACTIONS;
+  if (own && jsvIsObject(own)) flags |= XFSM_SVC_OWN_ACTIONS;
+  if (own) jsvUnLock(own);
+  if (opts) jsvUnLock(opts);
+  xfsm_service_set_flags(svc, flags);
+
+  JsVar *actsMap = xfsm_actions_map(svc);
+  jsvObjectSetChildAndUnLock(svc, K_SACTS, actsMap ? actsMap : jsvNewNull());
+}
+
+/* service.refreshActions(): pick up swapped action implementations */
+void xfsm_service_refresh_actions(JsVar *svc) {
+  if (!svc || !jsvIsObject(svc)) return;
+  xfsm_service_cache_actions(svc);
+  JsVar *m = jsvObjectGetChild(svc, K_MACHINE, 0);
+  if (m) { xfsm_machine_refresh_actions(m); jsvUnLock(m); }
+}
+
+/* ---------------- Transition trace ({ trace:N }) ----------------
+ * A fixed ring of the last N events a compiled service processed, kept in
+ * one flat string (`_trace`): a header, then N 16-byte records of ids.
+ * Recording is a few stores per send and allocates nothing; names are only
+ * looked up when service.trace() decodes it. */
+static const char * const K_STRACE = "_trace";
+#define XFSM_TRACE_MAX 1024
+
+typedef struct {
+  uint16_t cap, head;     /* records, next slot to write */
+  uint32_t count;         /* records written so far */
+} XfsmTraceHdr;
+
+/* Records are copied in and out with memcpy: flat string data need not be
+ * aligned for the 64-bit `time` */
+typedef struct {
+  JsSysTime time;
+  uint16_t from, event;   /* state id, event id (XFSM_NONE: not in the table) */
+  uint16_t to;            /* target state id, or XFSM_NONE if nothing changed */
+  uint16_t guard;         /* candidate index within the event's list, or XFSM_NONE */
+} XfsmTraceRec;
+
+static bool xfsm_service_trace_init(JsVar *svc, JsVar *machine, JsVarInt n) {
+  XfsmTable *t = 0;
+  JsVar *tv = xfsm_machine_table(machine, &t);
+  if (!tv) return false;     /* ids only exist on compiled machines */
+  jsvUnLock(tv);
+  if (n > XFSM_TRACE_MAX) n = XFSM_TRACE_MAX;
+  JsVar *v = xfsm_new_flat(sizeof(XfsmTraceHdr) + (size_t)n * sizeof(XfsmTraceRec));
+  if (!v) return false;
+  XfsmTraceHdr *h = (XfsmTraceHdr*)xfsm_flat_ptr(v);
+  h->cap = (uint16_t)n;
+  jsvObjectSetChildAndUnLock(svc, K_STRACE, v);
+  return true;
+}
+
+static void xfsm_service_trace_record(JsVar *svc, uint16_t from, uint16_t event, uint16_t to, uint16_t guard) {
+  JsVar *v = jsvObjectGetChild(svc, K_STRACE, 0);
+  if (!v) return;
+  XfsmTraceHdr *h = (XfsmTraceHdr*)xfsm_flat_ptr(v);
+  if (h) {
+    XfsmTraceRec r;
+    r.time = jshGetSystemTime();
+    r.from = from; r.event = event; r.to = to; r.guard = guard;
+    memcpy((char*)(h + 1) + (size_t)h->head * sizeof(XfsmTraceRec), &r, sizeof(r));
+    h->head = (uint16_t)((h->head + 1) % h->cap);
+    h->count++;
+  }
+  jsvUnLock(v);
+}
+
+/* service.trace(): oldest first, [{ time, from, event, to, guard }, ...]
+ * (time as getTime(); to/guard left out when the event changed nothing),
+ * or undefined if the service isn't tracing */
+JsVar *xfsm_service_get_trace(JsVar *svc) {
+  JsVar *v = jsvObjectGetChild(svc, K_STRACE, 0);
+  if (!xfsm_flat_ptr(v)) { if (v) jsvUnLock(v); return 0; }
+  JsVar *m = jsvObjectGetChild(svc, K_MACHINE, 0);
+  XfsmTable *t = 0;
+  JsVar *tv = m ? xfsm_machine_table(m, &t) : 0;
+  if (m) jsvUnLock(m);
+  JsVar *arr = tv ? jsvNewEmptyArray() : 0;
+  if (!arr) { if (tv) jsvUnLock(tv); jsvUnLock(v); return 0; }
+
+  XfsmTraceHdr *h = (XfsmTraceHdr*)xfsm_flat_ptr(v);
+  uint32_t n = h->count < h->cap ? h->count : h->cap;
+  uint16_t first = (uint16_t)(h->count < h->cap ? 0 : h->head);
+  for (uint32_t i = 0; i < n; i++) {
+    XfsmTraceRec r;
+    memcpy(&r, (char*)(h + 1) + (size_t)((first + i) % h->cap) * sizeof(XfsmTraceRec), sizeof(r));
+    JsVar *o = jsvNewObject();
+    if (!o) break;
+    jsvObjectSetChildAndUnLock(o, "time", jsvNewFromFloat(jshGetMillisecondsFromTime(r.time) / 1000));
+    if (r.from < t->stateCount) jsvObjectSetChildAndUnLock(o, "from", tbl_handle(t, tbl_states(t)[r.from].name));
+    if (r.event < t->eventCount) jsvObjectSetChildAndUnLock(o, "event", tbl_handle(t, tbl_evNames(t)[r.event]));
+    if (r.to < t->stateCount) jsvObjectSetChildAndUnLock(o, "to", tbl_handle(t, tbl_states(t)[r.to].name));
+    if (r.guard != XFSM_NONE) jsvObjectSetChildAndUnLock(o, "guard", jsvNewFromInteger(r.guard));
+    jsvArrayPushAndUnLock(arr, o);
+  }
+  jsvUnLock(tv);
+  jsvUnLock(v);
+  return arr;
+}
+
 // Initialize a Service object with an owned copy of its context
 // svc: the Service JsVar (object) that already has K_CONFIG set
+//      (and _options, if interpret() was given any)
 void xfsm_service_init(JsVar *serviceObj, JsVar *machineObj) {
   if (!serviceObj || !jsvIsObject(serviceObj)) return;
   if (!machineObj || !jsvIsObject(machineObj)) return;
@@ -1174,43 +3392,576 @@ void xfsm_service_init(JsVar *serviceObj, JsVar *machineObj) {
   /* Bind machine to service */
   jsvObjectSetChildAndUnLock(serviceObj, K_MACHINE, jsvLockAgain(machineObj));
 
-  /* Initialize service context from machine.config.context (if present) */
-  JsVar *cfg = jsvObjectGetChild(machineObj, K_CFG, 0);
-  if (cfg) {
-    JsVar *ctx = jsvObjectGetChild(cfg, K_CONTEXT, 0);
-    if (ctx) {
-      jsvObjectSetChildAndUnLock(serviceObj, K_SCTX, jsvLockAgain(ctx));
-      jsvUnLock(ctx);
+  /* Seed _state/_context with machine.initialState (PURE; entry actions NOT
+   * executed here). The context is shared until start() copies it. */
+  JsVar *st = xfsm_machine_initial_state(machineObj);
+  if (st) {
+    JsVar *ctx = jsvObjectGetChild(st, S_CTX, 0);
+    if (ctx) jsvObjectSetChildAndUnLock(serviceObj, K_SCTX, ctx);
+    jsvObjectSetChildAndUnLock(serviceObj, K_SSTATE, st);
+  }
+  xfsm_service_set_sid_initial(serviceObj, machineObj);
+
+  /* Status NotStarted + service options (set by the wrapper from interpret(options)) -> _flags */
+  int flags = XFSM_STATUS_NOTSTARTED | XFSM_SVC_SHARED_CTX;
+  JsVar *opts = jsvObjectGetChild(serviceObj, K_SOPTS, 0);
+  if (opts && jsvIsObject(opts)) {
+    JsVar *nu = jsvObjectGetChild(opts, "notifyUnchanged", 0);
+    if (nu && !jsvIsUndefined(nu) && !jsvGetBool(nu)) flags |= XFSM_SVC_QUIET_UNCHANGED;
+    if (nu) jsvUnLock(nu);
+    JsVar *rs = jsvObjectGetChild(opts, "reuseState", 0);
+    if (rs && jsvGetBool(rs)) flags |= XFSM_SVC_REUSE_STATE;
+    if (rs) jsvUnLock(rs);
+    JsVar *co = jsvObjectGetChild(opts, "coalesce", 0);
+    if (co && jsvGetBool(co)) flags |= XFSM_SVC_COALESCE;
+    if (co) jsvUnLock(co);
+    JsVar *tr = jsvObjectGetChild(opts, "trace", 0);
+    if (tr && jsvIsNumeric(tr) && jsvGetInteger(tr) > 0 && xfsm_service_trace_init(serviceObj, machineObj, jsvGetInteger(tr)))
+      flags |= XFSM_SVC_TRACE;
+    if (tr) jsvUnLock(tr);
+#ifdef XFSM_PROFILE
+    JsVar *pr = jsvObjectGetChild(opts, "profile", 0);
+    if (pr && jsvGetBool(pr)) flags |= XFSM_SVC_PROFILE;
+    if (pr) jsvUnLock(pr);
+#endif
+  }
+  if (opts) jsvUnLock(opts);
+  JsVar *mopts = jsvObjectGetChild(machineObj, "_options", 0);
+  JsVar *imm = mopts ? jsvObjectGetChild(mopts, "immutableContext", 0) : 0;
+  if (imm && jsvGetBool(imm)) flags |= XFSM_SVC_IMMUTABLE_CTX;
+  if (imm) jsvUnLock(imm);
+  if (mopts) jsvUnLock(mopts);
+  xfsm_service_set_flags(serviceObj, flags);
+  xfsm_service_cache_actions(serviceObj);
+#ifdef XFSM_PROFILE
+  if (flags & XFSM_SVC_PROFILE) xfsm_service_profile(serviceObj, true);
+#endif
+}
+
+
+#ifdef XFSM_PROFILE
+/* ---------------- Profiling: per-service stats ----------------
+ * The counters live in a flat string (`_stats`), created when profiling is
+ * switched on so that a profiled send allocates nothing for them. Flat
+ * strings never move, so the pointer stays valid while the var is locked. */
+static const char * const K_SSTATS = "_stats";
+
+typedef struct {
+  JsVar *hold;          /* locked `_stats` var, or 0 when not profiling */
+  XfsmStats *prev;      /* xfsm_prof of the enclosing scope */
+  bool timed;
+  JsSysTime t0;
+  unsigned int mem0;
+} XfsmProfScope;
+
+static XfsmStats *xfsm_service_stats(JsVar *svc, JsVar **pHold) {
+  *pHold = 0;
+  if (!(xfsm_service_flags(svc) & XFSM_SVC_PROFILE)) return 0;
+  JsVar *v = jsvObjectGetChild(svc, K_SSTATS, 0);
+  if (xfsm_flat_len(v) < sizeof(XfsmStats)) { if (v) jsvUnLock(v); return 0; }
+  *pHold = v;
+  return (XfsmStats*)xfsm_flat_ptr(v);
+}
+
+/* Make svc's counters current (0 if it isn't profiled, so a send to another
+ * service from an action isn't counted twice); `timed` scopes also measure
+ * time and blocks */
+static void xfsm_prof_begin(XfsmProfScope *ps, JsVar *svc, bool timed) {
+  ps->prev = xfsm_prof;
+  xfsm_prof = xfsm_service_stats(svc, &ps->hold);
+  ps->timed = timed && xfsm_prof;
+  if (ps->timed) { ps->mem0 = jsvGetMemoryUsage(); ps->t0 = jshGetSystemTime(); }
+}
+
+static void xfsm_prof_end(XfsmProfScope *ps) {
+  if (ps->timed) {
+    JsSysTime time;
+    memcpy(&time, xfsm_prof->time, sizeof(time));
+    time += jshGetSystemTime() - ps->t0;
+    memcpy(xfsm_prof->time, &time, sizeof(time));
+    xfsm_prof->blocks += (int32_t)(jsvGetMemoryUsage() - ps->mem0);
+  }
+  xfsm_prof = ps->prev;
+  if (ps->hold) jsvUnLock(ps->hold);
+}
+
+/* profile(on): switch counting on (creating zeroed counters) or off */
+void xfsm_service_profile(JsVar *svc, bool on) {
+  int flags = xfsm_service_flags(svc);
+  if (!on) { xfsm_service_set_flags(svc, flags & ~XFSM_SVC_PROFILE); return; }
+  JsVar *v = jsvObjectGetChild(svc, K_SSTATS, 0);
+  if (!v) {
+    v = xfsm_new_flat(sizeof(XfsmStats));
+    if (!v) return;
+    jsvObjectSetChild(svc, K_SSTATS, v);
+  }
+  jsvUnLock(v);
+  xfsm_service_set_flags(svc, flags | XFSM_SVC_PROFILE);
+}
+
+void xfsm_service_reset_stats(JsVar *svc) {
+  JsVar *v = jsvObjectGetChild(svc, K_SSTATS, 0);
+  if (xfsm_flat_ptr(v)) memset(xfsm_flat_ptr(v), 0, xfsm_flat_len(v));
+  if (v) jsvUnLock(v);
+}
+
+/* stats(): the counters as a plain object (time in ms), or undefined if
+ * profiling was never switched on */
+JsVar *xfsm_service_get_stats(JsVar *svc) {
+  JsVar *v = jsvObjectGetChild(svc, K_SSTATS, 0);
+  if (xfsm_flat_len(v) < sizeof(XfsmStats)) { if (v) jsvUnLock(v); return 0; }
+  XfsmStats st;
+  memcpy(&st, xfsm_flat_ptr(v), sizeof(st));
+  jsvUnLock(v);
+  JsSysTime time;
+  memcpy(&time, st.time, sizeof(time));
+  JsVar *o = jsvNewObject();
+  if (!o) return 0;
+  jsvObjectSetChildAndUnLock(o, "sends", jsvNewFromInteger((JsVarInt)st.sends));
+  jsvObjectSetChildAndUnLock(o, "matched", jsvNewFromInteger((JsVarInt)st.matched));
+  jsvObjectSetChildAndUnLock(o, "unmatched", jsvNewFromInteger((JsVarInt)st.unmatched));
+  jsvObjectSetChildAndUnLock(o, "guards", jsvNewFromInteger((JsVarInt)st.guards));
+  jsvObjectSetChildAndUnLock(o, "actions", jsvNewFromInteger((JsVarInt)st.actions));
+  jsvObjectSetChildAndUnLock(o, "listeners", jsvNewFromInteger((JsVarInt)st.listeners));
+  jsvObjectSetChildAndUnLock(o, "blocks", jsvNewFromInteger((JsVarInt)st.blocks));
+  jsvObjectSetChildAndUnLock(o, "time", jsvNewFromFloat(jshGetMillisecondsFromTime(time)));
+  return o;
+}
+
+#define XFSM_PROF_BEGIN(svc, timed) XfsmProfScope xfsm_ps; xfsm_prof_begin(&xfsm_ps, svc, timed)
+#define XFSM_PROF_END()             xfsm_prof_end(&xfsm_ps)
+#else
+#define XFSM_PROF_BEGIN(svc, timed)
+#define XFSM_PROF_END()
+#endif
+
+/* ---------------- Pending work (low-power idle) ----------------
+ * Native counts of the FSM work that is still outstanding across all
+ * services: queued listener calls (subscribe() pre-notifications, coalesced
+ * notifications) and armed `after` timers. Run-to-completion queues always
+ * drain inside the send that filled them. The idle handler calls the
+ * FSM.idle() hook once each time the counts drain to zero, and never keeps
+ * the device awake itself: timers are Espruino timers, so the idle loop
+ * already sleeps until the next one is due.
+ * The timer count is only an upper bound: user code can drop timers behind
+ * the services' backs (clearTimeout() with no id clears every timer). The
+ * idle handler only compares the counts; FSM.hasPendingWork() recounts the
+ * FSM's own timers in Espruino's timer list (xfsm_timers_resync()), so a
+ * stale count holds FSM.idle back only until the next such query. */
+static int  xfsm_pendingWork = 0;
+static int  xfsm_pendingTimers = 0;
+static bool xfsm_wasBusy = false;
+static const char * const K_IDLEHOOK = JS_HIDDEN_CHAR_STR"fsmIdle"; /* root: FSM.idle() callback */
+static const char * const K_PRENOTIFY = JS_HIDDEN_CHAR_STR"fsmPre"; /* root: pre-notify callback */
+
+static void xfsm_work_add(void) { xfsm_pendingWork++; xfsm_wasBusy = true; }
+static void xfsm_work_done(void) { if (xfsm_pendingWork > 0) xfsm_pendingWork--; }
+static void xfsm_timer_add(void) { xfsm_pendingTimers++; xfsm_wasBusy = true; }
+static void xfsm_timer_done(void) { if (xfsm_pendingTimers > 0) xfsm_pendingTimers--; }
+
+/* Is timer `id` still in Espruino's timer list? */
+static bool xfsm_timer_live(JsVar *id) {
+  if (!id || !timerArray) return false;
+  JsVar *timers = jsvLock(timerArray);
+  JsVar *tmr = jsvFindChildFromVar(timers, id, false);
+  jsvUnLock(timers);
+  if (tmr) jsvUnLock(tmr);
+  return tmr != 0;
+}
+
+/* Is `tmr` (id `id`) one of a service's `after` timers? Its callback's bound
+ * `this` is then a service whose _timers map holds that id */
+static bool xfsm_timer_is_fsm(JsVar *tmr, JsVar *id) {
+  JsVar *cb = jsvObjectGetChild(tmr, "callback", 0);
+  JsVar *svc = (cb && jsvIsNativeFunction(cb)) ? jsvObjectGetChild(cb, JSPARSE_FUNCTION_THIS_NAME, 0) : 0;
+  JsVar *timers = (svc && jsvIsObject(svc)) ? jsvObjectGetChild(svc, K_STIMERS, 0) : 0;
+  bool found = false;
+  if (timers) {
+    JsVarInt want = jsvGetInteger(id);
+    JsvObjectIterator it;
+    jsvObjectIteratorNew(&it, timers);
+    while (!found && jsvObjectIteratorHasValue(&it)) {
+      JsVar *v = jsvObjectIteratorGetValue(&it);
+      found = v && jsvGetInteger(v) == want;
+      if (v) jsvUnLock(v);
+      jsvObjectIteratorNext(&it);
+    }
+    jsvObjectIteratorFree(&it);
+    jsvUnLock(timers);
+  }
+  if (svc) jsvUnLock(svc);
+  if (cb) jsvUnLock(cb);
+  return found;
+}
+
+/* Recount the armed `after` timers from the timer list */
+static void xfsm_timers_resync(void) {
+  if (!xfsm_pendingTimers) return;
+  int n = 0;
+  JsVar *timers = timerArray ? jsvLock(timerArray) : 0;
+  if (timers) {
+    JsvObjectIterator it;
+    jsvObjectIteratorNew(&it, timers);
+    while (jsvObjectIteratorHasValue(&it)) {
+      JsVar *id = jsvObjectIteratorGetKey(&it);
+      JsVar *tmr = jsvObjectIteratorGetValue(&it);
+      if (id && tmr && xfsm_timer_is_fsm(tmr, id)) n++;
+      if (tmr) jsvUnLock(tmr);
+      if (id) jsvUnLock(id);
+      jsvObjectIteratorNext(&it);
+    }
+    jsvObjectIteratorFree(&it);
+    jsvUnLock(timers);
+  }
+  xfsm_pendingTimers = n;
+}
+
+bool xfsm_has_pending_work(void) {
+  if (xfsm_pendingWork > 0) return true;
+  xfsm_timers_resync();
+  return xfsm_pendingTimers > 0;
+}
+
+/* FSM.idle(fn): called (from the event queue) when FSM work drains; undefined clears it */
+void xfsm_set_idle_hook(JsVar *fn) {
+  if (!execInfo.root) return;
+  if (fn && jsvIsFunction(fn)) jsvObjectSetChild(execInfo.root, K_IDLEHOOK, fn);
+  else jsvObjectRemoveChild(execInfo.root, K_IDLEHOOK);
+}
+
+/* Idle-loop handler. Returns false: FSM work never needs the CPU kept awake */
+bool xfsm_idle(void) {
+  if (!xfsm_wasBusy || xfsm_pendingWork > 0 || xfsm_pendingTimers > 0) return false;
+  xfsm_wasBusy = false;
+  JsVar *hook = execInfo.root ? jsvObjectGetChild(execInfo.root, K_IDLEHOOK, 0) : 0;
+  if (hook && jsvIsFunction(hook)) jsiQueueEvents(0, hook, 0, 0);
+  if (hook) jsvUnLock(hook);
+  return false;
+}
+
+/* reset()/load(): timers and queued events are gone with the variables */
+void xfsm_kill(void) {
+  xfsm_pendingWork = 0;
+  xfsm_pendingTimers = 0;
+  xfsm_wasBusy = false;
+}
+
+/* ---------------- Delayed transition timers ----------------
+ * Entering a state with `after` arms one native timer per delay: a native
+ * callback with `this` bound to the service and the after event name bound
+ * as its argument, so no JS closure is created. _timers maps event name ->
+ * timer id; leaving the state (a targeted transition) or stop() clears them
+ * all with clearTimeout, so none fires late or outlives the service. */
+static void xfsm_after_fire(JsVar *svc, JsVar *name) {
+  if (!svc || !jsvIsObject(svc) || !name) return;
+  JsVar *timers = jsvObjectGetChild(svc, K_STIMERS, 0);
+  if (timers) {
+    JsVar *n = jsvFindChildFromVar(timers, name, false);
+    if (n) { jsvRemoveChildAndUnLock(timers, n); xfsm_timer_done(); }
+    jsvUnLock(timers);
+  }
+  JsVar *r = xfsm_service_send(svc, name);
+  if (r) jsvUnLock(r);
+}
+
+static void xfsm_timer_clear(JsVar *id) {
+  /* skip ids user code already cleared: clearTimeout() throws on those.
+   * An empty args array would clear every timer, so never pass one. */
+  JsVar *args = xfsm_timer_live(id) ? jsvNewEmptyArray() : 0;
+  if (args) { jsvArrayPush(args, id); jswrap_interface_clearTimeout(args); jsvUnLock(args); xfsm_timer_done(); }
+}
+
+static void xfsm_service_cancel_timers(JsVar *svc) {
+  JsVar *timers = jsvObjectGetChild(svc, K_STIMERS, 0);
+  if (!timers) return;
+  jsvObjectRemoveChild(svc, K_STIMERS);
+  JsvObjectIterator it;
+  jsvObjectIteratorNew(&it, timers);
+  while (jsvObjectIteratorHasValue(&it)) {
+    JsVar *id = jsvObjectIteratorGetValue(&it);
+    xfsm_timer_clear(id);
+    if (id) jsvUnLock(id);
+    jsvObjectIteratorNext(&it);
+  }
+  jsvObjectIteratorFree(&it);
+  jsvUnLock(timers);
+}
+
+/* The current state's [delay, depth, eventName, ...] list (LOCKED) or 0:
+ * pinned in the table when compiled, otherwise built from
+ * config.states[value].after */
+static JsVar *xfsm_service_after_list(JsVar *svc, JsVar *machine) {
+  XfsmTable *t = 0;
+  JsVar *tv = xfsm_machine_table(machine, &t);
+  if (tv) {
+    JsVar *vsid = jsvObjectGetChild(svc, K_SSID, 0);
+    uint16_t sid = vsid ? (uint16_t)jsvGetInteger(vsid) : t->initial;
+    if (vsid) jsvUnLock(vsid);
+    JsVar *list = sid < t->stateCount ? tbl_handle(t, tbl_states(t)[sid].after) : 0;
+    jsvUnLock(tv);
+    return list;
+  }
+  JsVar *list = 0;
+  JsVar *st = jsvObjectGetChild(svc, K_SSTATE, 0);
+  JsVar *val = st ? jsvObjectGetChild(st, S_VALUE, 0) : 0;
+  JsVar *cfg = (val && jsvIsString(val)) ? jsvObjectGetChild(machine, K_CFG, 0) : 0;
+  JsVar *states = cfg ? getChildObj(cfg, K_STATES) : 0;
+  JsVar *node = states ? get_child_v(states, val) : 0;
+  JsVar *after = (node && jsvIsObject(node)) ? getChildObj(node, K_AFTER) : 0;
+  if (after) { list = xfsm_after_list(val, after); jsvUnLock(after); }
+  if (node) jsvUnLock(node);
+  if (states) jsvUnLock(states);
+  if (cfg) jsvUnLock(cfg);
+  if (val) jsvUnLock(val);
+  if (st) jsvUnLock(st);
+  return list;
+}
+
+/* Arm the current state's timers of the states below depth `keep` (all for
+ * keep 0). With only != 0 just the listed entries (indices into the list's
+ * delay/depth/name triples) are armed, entry i having elapsed[i] ms of its
+ * delay behind it: used by restore(). _tarm[depth-1] keeps each level's
+ * arm time for snapshot(). */
+static void xfsm_service_arm_timers_ex(JsVar *svc, JsVar *machine, int keep,
+                                       const uint8_t *only, const uint32_t *elapsed, int nOnly) {
+  JsVar *list = xfsm_service_after_list(svc, machine);
+  if (!list) return;
+  JsVarFloat now = jshGetMillisecondsFromTime(jshGetSystemTime());
+  JsVar *tarm = jsvObjectGetChild(svc, K_STARM, 0);
+  if (!tarm || !jsvIsArray(tarm)) {
+    if (tarm) jsvUnLock(tarm);
+    tarm = jsvNewEmptyArray();
+    if (tarm) jsvObjectSetChild(svc, K_STARM, tarm);
+  }
+  JsVar *timers = jsvObjectGetChild(svc, K_STIMERS, 0);
+  if (!timers) {
+    timers = jsvNewObject();
+    if (timers) jsvObjectSetChild(svc, K_STIMERS, timers);
+  }
+  JsVarFloat delay = 0;
+  int depth = 0, i = 0;
+  JsvObjectIterator it;
+  jsvObjectIteratorNew(&it, list);
+  while (timers && jsvObjectIteratorHasValue(&it)) {
+    JsVar *v = jsvObjectIteratorGetValue(&it);
+    if (i % 3 == 0) delay = jsvGetFloat(v);
+    else if (i % 3 == 1) depth = (int)jsvGetInteger(v);
+    else if (depth > keep) {
+      bool arm = !only;
+      JsVarFloat done = 0;
+      for (int j = 0; j < nOnly && !arm; j++)
+        if (only[j] == i / 3) { arm = true; done = (JsVarFloat)elapsed[j]; }
+      JsVar *fn = (v && arm) ? jsvNewNativeFunction((void (*)(void))xfsm_after_fire,
+                                                    JSWAT_VOID | JSWAT_THIS_ARG | (JSWAT_JSVAR << JSWAT_BITS)) : 0;
+      if (fn) {
+        jsvObjectSetChild(fn, JSPARSE_FUNCTION_THIS_NAME, svc);
+        jsvAddFunctionParameter(fn, 0, v);
+        JsVar *id = jswrap_interface_setTimeout(fn, delay > done ? delay - done : 0, 0);
+        if (id) { set_child_v_and_unlock(timers, v, id); xfsm_timer_add(); }
+        jsvUnLock(fn);
+        JsVar *at = (tarm && depth > 0) ? jsvNewFromFloat(now - done) : 0;
+        if (at) { jsvSetArrayItem(tarm, depth - 1, at); jsvUnLock(at); }
+      }
     }
-    jsvUnLock(cfg);
+    if (v) jsvUnLock(v);
+    jsvObjectIteratorNext(&it);
+    i++;
   }
+  jsvObjectIteratorFree(&it);
+  if (timers) jsvUnLock(timers);
+  if (tarm) jsvUnLock(tarm);
+  jsvUnLock(list);
+}
 
-  /* Seed _state with machine.initialState (PURE; entry actions NOT executed here) */
-  JsVar *st = xfsm_machine_initial_state(machineObj);
-  if (st) {
-    jsvObjectSetChildAndUnLock(serviceObj, K_SSTATE, jsvLockAgain(st));
-    jsvUnLock(st);
-  }
+static void xfsm_service_arm_timers(JsVar *svc, JsVar *machine) {
+  xfsm_service_arm_timers_ex(svc, machine, 0, 0, 0, 0);
+}
 
-  /* Unsubscribe factory is ready before any wrapper call */
-  xfsm_ensure_unsub_factory();
+/* ---------------- Snapshot / restore ----------------
+ * Binary layout (little-endian):
+ *   'X' 'S' version status | sid:u16 | nameLen:u16 | name
+ *   | nTimers:u8 | (timer index:u8, elapsed ms:u32) x nTimers
+ *   | ctxLen:u32 | context as JSON
+ * The state is restored by name (sid is informational), so a blob survives
+ * a recompile that renumbers states. Timer indices are positions in the
+ * state's `after` list, which is built in config order either way. Each
+ * timer has its own elapsed time: an ancestor's timers keep running across
+ * transitions inside it. */
+#define XFSM_SNAP_VERSION   2
+#define XFSM_SNAP_MAXTIMERS 32
+
+static void snap_put16(char *b, uint32_t v) { b[0] = (char)(v & 0xFF); b[1] = (char)((v >> 8) & 0xFF); }
+static void snap_put32(char *b, uint32_t v) { snap_put16(b, v & 0xFFFF); snap_put16(b + 2, v >> 16); }
+static uint32_t snap_get(JsvStringIterator *it, int bytes) {
+  uint32_t v = 0;
+  for (int i = 0; i < bytes; i++) v |= (uint32_t)(unsigned char)jsvStringIteratorGetCharAndNext(it) << (8*i);
+  return v;
+}
 
-  /* Set status to NotStarted */
-  jsvObjectSetChildAndUnLock(serviceObj, K_SSTATUS, jsvNewFromString("NotStarted"));
+/* service.snapshot(): LOCKED binary string, or 0 */
+JsVar *xfsm_service_snapshot(JsVar *svc) {
+  JsVar *st = jsvObjectGetChild(svc, K_SSTATE, 0);
+  JsVar *val = st ? jsvObjectGetChild(st, S_VALUE, 0) : 0;
+  if (st) jsvUnLock(st);
+  if (!val || !jsvIsString(val)) { if (val) jsvUnLock(val); return 0; }
+  size_t nameLen = jsvGetStringLength(val);
+  if (nameLen > 0xFFFF) { jsvUnLock(val); return 0; }
+
+  char hdr[8];
+  hdr[0] = 'X'; hdr[1] = 'S'; hdr[2] = XFSM_SNAP_VERSION; hdr[3] = (char)xfsm_service_status(svc);
+  JsVar *vsid = jsvObjectGetChild(svc, K_SSID, 0);
+  snap_put16(hdr + 2*2, vsid ? (uint32_t)jsvGetInteger(vsid) : XFSM_NONE);
+  if (vsid) jsvUnLock(vsid);
+  snap_put16(hdr + 3*2, (uint32_t)nameLen);
+  JsVar *blob = jsvNewStringOfLength(sizeof(hdr), hdr);
+  if (!blob) { jsvUnLock(val); return 0; }
+  jsvAppendStringVarComplete(blob, val);
+  jsvUnLock(val);
+
+  /* pending timers: entries of the after list still present in _timers */
+  char tb[1 + XFSM_SNAP_MAXTIMERS * 5];
+  int n = 0;
+  JsVar *timers = jsvObjectGetChild(svc, K_STIMERS, 0);
+  JsVar *m = timers ? jsvObjectGetChild(svc, K_MACHINE, 0) : 0;
+  JsVar *list = m ? xfsm_service_after_list(svc, m) : 0;
+  JsVar *tarm = list ? jsvObjectGetChild(svc, K_STARM, 0) : 0;
+  if (m) jsvUnLock(m);
+  if (list) {
+    JsVarFloat now = jshGetMillisecondsFromTime(jshGetSystemTime());
+    int i = 0, depth = 0;
+    JsvObjectIterator it;
+    jsvObjectIteratorNew(&it, list);
+    while (jsvObjectIteratorHasValue(&it) && n < XFSM_SNAP_MAXTIMERS) {
+      JsVar *v = jsvObjectIteratorGetValue(&it);
+      if (i % 3 == 1) depth = (int)jsvGetInteger(v);
+      if (i % 3 == 2) {
+        JsVar *id = v ? jsvFindChildFromVar(timers, v, false) : 0;
+        if (id) {
+          JsVar *at = (tarm && jsvIsArray(tarm) && depth > 0) ? jsvGetArrayItem(tarm, depth - 1) : 0;
+          JsVarFloat elapsed = at ? now - jsvGetFloat(at) : 0;
+          if (at) jsvUnLock(at);
+          tb[1 + 5*n] = (char)(i / 3);
+          snap_put32(tb + 2 + 5*n, elapsed > 0 ? (uint32_t)elapsed : 0);
+          n++;
+          jsvUnLock(id);
+        }
+      }
+      if (v) jsvUnLock(v);
+      jsvObjectIteratorNext(&it);
+      i++;
+    }
+    jsvObjectIteratorFree(&it);
+    jsvUnLock(list);
+  }
+  if (tarm) jsvUnLock(tarm);
+  if (timers) jsvUnLock(timers);
+  tb[0] = (char)n;
+  jsvAppendStringBuf(blob, tb, (size_t)(1 + 5*n));
 
+  JsVar *ctx = jsvObjectGetChild(svc, K_SCTX, 0);
+  JsVar *json = ctx ? jswrap_json_stringify(ctx, 0, 0) : 0;
+  if (ctx) jsvUnLock(ctx);
+  char lb[4];
+  snap_put32(lb, json ? (uint32_t)jsvGetStringLength(json) : 0);
+  jsvAppendStringBuf(blob, lb, sizeof(lb));
+  if (json) { jsvAppendStringVarComplete(blob, json); jsvUnLock(json); }
+  return blob;
 }
 
+/* machine.restore(blob): put a freshly initialised service into the saved
+ * state without running entry actions, re-arming the timers that were
+ * pending with what was left of their delays. False if the blob is not a
+ * snapshot of a state of this machine. */
+bool xfsm_service_restore(JsVar *svc, JsVar *blob) {
+  if (!blob || !jsvIsString(blob)) return false;
+  size_t len = jsvGetStringLength(blob);
+  if (len < 8 + 1 + 4) return false;
+
+  uint8_t only[XFSM_SNAP_MAXTIMERS];
+  uint32_t elapsed[XFSM_SNAP_MAXTIMERS];
+  JsvStringIterator it;
+  jsvStringIteratorNew(&it, blob, 0);
+  uint32_t magic = snap_get(&it, 2), version = snap_get(&it, 1), status = snap_get(&it, 1);
+  uint32_t sid = snap_get(&it, 2), nameLen = snap_get(&it, 2);
+  bool ok = magic == ('X' | ('S' << 8)) && version == XFSM_SNAP_VERSION &&
+            status <= XFSM_STATUS_STOPPED && 8 + nameLen + 1 + 4 <= len;
+  uint32_t nTimers = 0, ctxLen = 0;
+  if (ok) {
+    for (uint32_t i = 0; i < nameLen; i++) jsvStringIteratorNext(&it);
+    nTimers = snap_get(&it, 1);
+    ok = nTimers <= XFSM_SNAP_MAXTIMERS && 8 + nameLen + 1 + 5 * nTimers + 4 <= len;
+  }
+  if (ok) {
+    for (uint32_t i = 0; i < nTimers; i++) { only[i] = (uint8_t)snap_get(&it, 1); elapsed[i] = snap_get(&it, 4); }
+    ctxLen = snap_get(&it, 4);
+    ok = 8 + nameLen + 1 + 5 * nTimers + 4 + (size_t)ctxLen <= len;
+  }
+  jsvStringIteratorFree(&it);
+  if (!ok) return false;
+
+  JsVar *m = jsvObjectGetChild(svc, K_MACHINE, 0);
+  if (!m) return false;
+  JsVar *val = jsvNewFromStringVar(blob, 8, nameLen);
+  /* the state must exist in this machine */
+  XfsmTable *t = 0;
+  JsVar *tv = val ? xfsm_machine_table(m, &t) : 0;
+  bool nested = false;
+  if (tv) {
+    sid = tbl_state_id(t, val);
+    ok = sid != XFSM_NONE;
+    nested = t->flags & XFSM_TBL_NESTED;
+    jsvUnLock(tv);
+  } else if (val) {
+    JsVar *cfg = jsvObjectGetChild(m, K_CFG, 0);
+    JsVar *states = cfg ? getChildObj(cfg, K_STATES) : 0;
+    JsVar *node = states ? get_child_v(states, val) : 0;
+    ok = node && jsvIsObject(node);
+    if (node) jsvUnLock(node);
+    if (states) jsvUnLock(states);
+    if (cfg) jsvUnLock(cfg);
+  }
+  JsVar *ctx = 0;
+  bool ownCtx = ok && ctxLen;
+  if (ownCtx) {
+    JsVar *json = jsvNewFromStringVar(blob, 8 + nameLen + 1 + 5 * nTimers + 4, ctxLen);
+    ctx = json ? jswrap_json_parse(json) : 0;
+    if (json) jsvUnLock(json);
+    ok = ctx && jsvIsObject(ctx);
+  } else if (ok) {   /* no context saved: a private copy of the initial one */
+    JsVar *c0 = jsvObjectGetChild(svc, K_SCTX, 0);
+    ctx = (c0 && jsvIsObject(c0)) ? jsvCopy(c0, true) : jsvNewObject();
+    if (c0) jsvUnLock(c0);
+    ownCtx = ctx != 0;
+  }
+  JsVar *acts = ok ? jsvNewEmptyArray() : 0;
+  JsVar *st = acts ? new_state_obj_v(val, ctx, acts, false) : 0;
+  state_obj_set_nested(st, nested);
+  if (acts) jsvUnLock(acts);
+  if (st) {
+    xfsm_service_cancel_timers(svc);
+    jsvObjectSetChildAndUnLock(svc, K_SSTATE, st);
+    if (tv) jsvObjectSetChildAndUnLock(svc, K_SSID, jsvNewFromInteger(sid));
+    int flags = xfsm_service_flags(svc) & ~(XFSM_SVC_OWN_STATE | XFSM_SVC_STATUS_MASK);
+    if (ownCtx) {   /* the restored context is this service's own */
+      jsvObjectSetChild(svc, K_SCTX, ctx);
+      flags &= ~XFSM_SVC_SHARED_CTX;
+    }
+    xfsm_service_set_flags(svc, flags | (int)status);
+    if (flags & XFSM_SVC_BUS) xfsm_bus_sync(svc);
+    if (status == XFSM_STATUS_RUNNING && nTimers)
+      xfsm_service_arm_timers_ex(svc, m, 0, only, elapsed, (int)nTimers);
+  }
+  if (ctx) jsvUnLock(ctx);
+  if (val) jsvUnLock(val);
+  jsvUnLock(m);
+  return st != 0;
+}
 
 JsVar *xfsm_service_start(JsVar *svc) {
   if (!svc || !jsvIsObject(svc)) return 0;
 
   /* already running? */
-  JsVar *status = jsvObjectGetChild(svc, K_SSTATUS, 0);
-  if (status && jsvIsString(status)) {
-    char s[16]; str_from_jsv(status, s, sizeof(s));
-    jsvUnLock(status);
-    if (!strcmp(s, "Running")) return jsvLockAgain(svc);
-  } else if (status) jsvUnLock(status);
+  if (xfsm_service_status(svc) == XFSM_STATUS_RUNNING) return jsvLockAgain(svc);
 
   JsVar *m = jsvObjectGetChild(svc, K_MACHINE, 0);
   if (!m) return 0;
@@ -1218,29 +3969,38 @@ JsVar *xfsm_service_start(JsVar *svc) {
   JsVar *st = xfsm_machine_initial_state(m);
   if (!st) { jsvUnLock(m); return 0; }
 
-  /* run entry actions with xstate.init */
-  JsVar *ctx = jsvObjectGetChild(svc, K_SCTX, 0);
+  /* start from a private shallow copy of the initial context (entry assigns
+   * already applied); run the remaining entry actions with xstate.init */
+  xfsm_service_set_flags(svc, xfsm_service_flags(svc) & ~(XFSM_SVC_SHARED_CTX | XFSM_SVC_OWN_STATE));
+  JsVar *ctx0 = jsvObjectGetChild(st, S_CTX, 0);
+  JsVar *ctx = (ctx0 && jsvIsObject(ctx0)) ? jsvCopy(ctx0, true) : 0;
   JsVar *acts = jsvObjectGetChild(st, S_ACTS, 0);
   JsVar *val  = jsvObjectGetChild(st, S_VALUE, 0);
-  char toBuf[64] = "";
-  if (val && jsvIsString(val)) str_from_jsv(val, toBuf, sizeof(toBuf));
 
   JsVar *evtInit = jsvNewObject();
   if (evtInit) jsvObjectSetChildAndUnLock(evtInit, "type", jsvNewFromString("xstate.init"));
-  run_actions_raw(svc, &ctx, acts, evtInit, 0, toBuf);
+  run_actions_raw(svc, &ctx, acts, evtInit, 0, 0);
   if (evtInit) jsvUnLock(evtInit);
 
-  /* persist updated context back to service */
+  /* persist context; the shared initial state is never written to */
   if (ctx) {
     jsvObjectSetChildAndUnLock(svc, K_SCTX, jsvLockAgain(ctx));
-    /* IMPORTANT: also reflect into stored state object */
-    jsvObjectSetChildAndUnLock(st, S_CTX, jsvLockAgain(ctx));
+    if (ctx != ctx0) {
+      JsVar *own = new_state_obj_v(val, ctx, acts, false);
+      state_obj_set_nested(own, state_obj_nested(st));
+      if (own) { jsvUnLock(st); st = own; }
+    }
     jsvUnLock(ctx);
   }
+  if (ctx0) jsvUnLock(ctx0);
 
   /* commit state + status */
   jsvObjectSetChildAndUnLock(svc, K_SSTATE, jsvLockAgain(st));
-  jsvObjectSetChildAndUnLock(svc, K_SSTATUS, jsvNewFromString("Running"));
+  xfsm_service_set_sid_initial(svc, m);
+  xfsm_service_set_status(svc, XFSM_STATUS_RUNNING);
+  if (xfsm_service_flags(svc) & XFSM_SVC_BUS) xfsm_bus_sync(svc);
+  xfsm_service_cancel_timers(svc);
+  xfsm_service_arm_timers(svc, m);
 
   xfsm_notify_listeners(svc);
 
@@ -1254,12 +4014,19 @@ JsVar *xfsm_service_start(JsVar *svc) {
 JsVar *xfsm_service_stop(JsVar *svc) {
   if (!svc) return 0;
 
-  // Status -> "Stopped"
-  jsvObjectSetChildAndUnLock(svc, K_SSTATUS, jsvNewFromString("Stopped"));
+  // Status -> Stopped
+  xfsm_service_set_status(svc, XFSM_STATUS_STOPPED);
+  if (xfsm_service_flags(svc) & XFSM_SVC_BUS) xfsm_bus_sync(svc);
 
   // Clear all listeners
-  JsVar *empty = jsvNewObject();
-  if (empty) jsvObjectSetChildAndUnLock(svc, "_listeners", empty);
+  JsVar *empty = jsvNewEmptyArray();
+  if (empty) jsvObjectSetChildAndUnLock(svc, K_SLISTENERS, empty);
+
+  // Drop events still queued for run-to-completion
+  jsvObjectRemoveChild(svc, K_SQUEUE);
+
+  // Cancel pending `after` timers
+  xfsm_service_cancel_timers(svc);
 
   // Return locked svc so the wrapper can return `this`
   return jsvLockAgain(svc);
@@ -1267,50 +4034,367 @@ JsVar *xfsm_service_stop(JsVar *svc) {
 
 
 
-/**
- * xfsm_service_send
- * Apply a transition to a running service.
- * Accepts event as string OR object; normalizes to {type:string,...}.
- * Executes actions with the **object** event; returns next state's value (locked string) or 0.
- */
-JsVar *xfsm_service_send(JsVar *svc, JsVar *event /*string or object*/) {
+/* ---------------- Listeners ----------------
+ * _listeners is an array indexed by listener id (ids only grow, so it is
+ * in subscription order). Unsubscribing writes a null tombstone rather
+ * than removing the entry, which keeps a notification loop that is in
+ * progress valid; the next outermost loop drops the tombstones as it
+ * passes them. */
+static int xfsm_notifyDepth = 0;
+
+static void xfsm_call_listeners(JsVar *service) {
+  JsVar *listeners = jsvObjectGetChild(service, K_SLISTENERS, 0);
+  if (!listeners || !jsvIsArray(listeners)) { if (listeners) jsvUnLock(listeners); return; }
+
+  JsVar *st = jsvObjectGetChild(service, K_SSTATE, 0);
+  XFSM_PROF_BEGIN(service, false);
+  xfsm_notifyDepth++;
+  JsvObjectIterator it;
+  jsvObjectIteratorNew(&it, listeners);
+  while (jsvObjectIteratorHasValue(&it)) {
+    JsVar *fn = jsvObjectIteratorGetValue(&it);
+    if (fn && jsvIsFunction(fn)) {
+      if (st) {
+        JsVar *argv[1] = { st };
+        XFSM_PROF_COUNT(listeners);
+        JsVar *res = jspExecuteFunction(fn, service, 1, argv);
+        if (res) jsvUnLock(res);
+      }
+      jsvUnLock(fn);
+      jsvObjectIteratorNext(&it);
+    } else {
+      if (fn) jsvUnLock(fn);
+      if (xfsm_notifyDepth == 1) jsvObjectIteratorRemoveAndGotoNext(&it, listeners); /* compact */
+      else jsvObjectIteratorNext(&it);
+    }
+  }
+  jsvObjectIteratorFree(&it);
+  xfsm_notifyDepth--;
+  XFSM_PROF_END();
+
+  if (st) jsvUnLock(st);
+  jsvUnLock(listeners);
+}
+
+/* Native idle-tick callback for coalesced notification (argument: the service) */
+static void xfsm_service_flush_notify(JsVar *svc) {
+  if (!svc || !jsvIsObject(svc)) return;
+  int flags = xfsm_service_flags(svc);
+  if (!(flags & XFSM_SVC_NOTIFY_PENDING)) return;
+  xfsm_service_set_flags(svc, flags & ~XFSM_SVC_NOTIFY_PENDING);
+  xfsm_work_done();
+  if ((flags & XFSM_SVC_STATUS_MASK) == XFSM_STATUS_RUNNING) xfsm_call_listeners(svc);
+}
+
+/** Notify all registered listeners with the current state (argument 0).
+ * With { coalesce:true } this only queues one idle-tick callback, however
+ * many transitions happen before it runs; listeners then see the latest state. */
+void xfsm_notify_listeners(JsVar *service) {
+  if (!service || !jsvIsObject(service)) return;
+  int flags = xfsm_service_flags(service);
+  if (!(flags & XFSM_SVC_COALESCE)) { xfsm_call_listeners(service); return; }
+  if (flags & XFSM_SVC_NOTIFY_PENDING) return;
+
+  JsVar *fn = jsvNewNativeFunction((void (*)(void))xfsm_service_flush_notify,
+                                   JSWAT_VOID | (JSWAT_JSVAR << JSWAT_BITS));
+  if (!fn) return;
+  xfsm_service_set_flags(service, flags | XFSM_SVC_NOTIFY_PENDING);
+  xfsm_work_add();
+  JsVar *argv[1] = { service };
+  jsiQueueEvents(0, fn, argv, 1);
+  jsvUnLock(fn);
+}
+
+static int xfsm_service_prenotify_count(JsVar *svc) {
+  JsVar *v = jsvObjectGetChild(svc, K_SPRE, 0);
+  int n = v ? (int)jsvGetInteger(v) : 0;
+  if (v) jsvUnLock(v);
+  return n;
+}
+/* updated in place once it exists, so a subscribe allocates no counter */
+static void xfsm_service_set_prenotify_count(JsVar *svc, int n) {
+  JsVar *v = jsvObjectGetChild(svc, K_SPRE, 0);
+  if (v && jsvIsInt(v)) jsvSetInteger(v, n);
+  else jsvObjectSetChildAndUnLock(svc, K_SPRE, jsvNewFromInteger(n));
+  if (v) jsvUnLock(v);
+}
+
+/* Native event-queue callback delivering one pre-notification */
+static void xfsm_service_deliver_prenotify(JsVar *svc, JsVar *listener, JsVar *st) {
+  if (!svc || !jsvIsObject(svc)) return;
+  int n = xfsm_service_prenotify_count(svc);
+  if (n > 0) { xfsm_service_set_prenotify_count(svc, n - 1); xfsm_work_done(); }
+  if (listener && jsvIsFunction(listener) && st) {
+    JsVar *argv[1] = { st };
+    JsVar *res = jspExecuteFunction(listener, svc, 1, argv);
+    if (res) jsvUnLock(res);
+  }
+}
+
+/* subscribe(): queue the listener's first call, with the current state, for
+ * the next idle tick. It goes through a native callback (one function,
+ * kept under root) so the queued call is counted as pending work until it
+ * has run. */
+void xfsm_service_prenotify(JsVar *svc, JsVar *listener) {
+  JsVar *st = jsvObjectGetChild(svc, K_SSTATE, 0);
+  if (!st) st = xfsm_service_get_state(svc);
+  if (!st) return;
+  JsVar *fn = execInfo.root ? jsvObjectGetChild(execInfo.root, K_PRENOTIFY, 0) : 0;
+  if (!fn) {
+    fn = jsvNewNativeFunction((void (*)(void))xfsm_service_deliver_prenotify,
+                              JSWAT_VOID | (JSWAT_JSVAR << JSWAT_BITS) |
+                              (JSWAT_JSVAR << (JSWAT_BITS*2)) | (JSWAT_JSVAR << (JSWAT_BITS*3)));
+    if (fn && execInfo.root) jsvObjectSetChild(execInfo.root, K_PRENOTIFY, fn);
+  }
+  if (fn) {
+    xfsm_service_set_prenotify_count(svc, xfsm_service_prenotify_count(svc) + 1);
+    xfsm_work_add();
+    JsVar *argv[3] = { svc, listener, st };
+    jsiQueueEvents(0, fn, argv, 3);
+    jsvUnLock(fn);
+  }
+  jsvUnLock(st);
+}
+
+/* service.hasPendingWork(): queued events, armed `after` timers or queued
+ * listener calls */
+bool xfsm_service_has_pending_work(JsVar *svc) {
+  if (!svc || !jsvIsObject(svc)) return false;
+  if (xfsm_service_flags(svc) & XFSM_SVC_NOTIFY_PENDING) return true;
+  if (xfsm_service_prenotify_count(svc) > 0) return true;
+  JsVar *q = jsvObjectGetChild(svc, K_SQUEUE, 0);
+  bool busy = q && jsvGetArrayLength(q) > 0;
+  if (q) jsvUnLock(q);
+  if (busy) return true;
+  /* drop timer ids user code cleared (e.g. clearTimeout() with no id) */
+  JsVar *timers = jsvObjectGetChild(svc, K_STIMERS, 0);
+  if (!timers) return false;
+  JsvObjectIterator it;
+  jsvObjectIteratorNew(&it, timers);
+  while (jsvObjectIteratorHasValue(&it)) {
+    JsVar *id = jsvObjectIteratorGetValue(&it);
+    bool live = xfsm_timer_live(id);
+    if (id) jsvUnLock(id);
+    if (live) { busy = true; jsvObjectIteratorNext(&it); }
+    else jsvObjectIteratorRemoveAndGotoNext(&it, timers);
+  }
+  jsvObjectIteratorFree(&it);
+  jsvUnLock(timers);
+  return busy;
+}
+
+/* subscribe(): append a listener, return its id (> 0), or 0 on failure */
+int xfsm_service_add_listener(JsVar *svc, JsVar *listener) {
+  JsVar *listeners = jsvObjectGetChild(svc, K_SLISTENERS, 0);
+  if (!listeners || !jsvIsArray(listeners)) {
+    if (listeners) jsvUnLock(listeners);
+    listeners = jsvNewEmptyArray();
+    if (!listeners) return 0;
+    jsvObjectSetChild(svc, K_SLISTENERS, listeners);
+  }
+  JsVar *vlid = jsvObjectGetChild(svc, "_lid", 0);
+  int id = (vlid ? (int)jsvGetInteger(vlid) : 0) + 1;
+  if (vlid) jsvUnLock(vlid);
+  jsvObjectSetChildAndUnLock(svc, "_lid", jsvNewFromInteger(id));
+  jsvSetArrayItem(listeners, id, listener);
+  jsvUnLock(listeners);
+  return id;
+}
+
+/* unsubscribe: tombstone listener `id`; true if it was subscribed */
+bool xfsm_service_remove_listener(JsVar *svc, int id) {
+  if (id <= 0) return false;
+  JsVar *listeners = jsvObjectGetChild(svc, K_SLISTENERS, 0);
+  if (!listeners || !jsvIsArray(listeners)) { if (listeners) jsvUnLock(listeners); return false; }
+  JsVar *fn = jsvGetArrayItem(listeners, id);
+  bool existed = fn && jsvIsFunction(fn);
+  if (fn) jsvUnLock(fn);
+  if (existed) {
+    JsVar *tomb = jsvNewNull();
+    jsvSetArrayItem(listeners, id, tomb);
+    if (tomb) jsvUnLock(tomb);
+  }
+  jsvUnLock(listeners);
+  return existed;
+}
+
+/* Native body of the function subscribe() returns: `this` is the service
+ * and the listener id is a bound first argument (see xfsm_make_unsubscribe) */
+static bool xfsm_unsubscribe_native(JsVar *svc, int id) {
+  if (!svc || !jsvIsObject(svc)) return false;
+  return xfsm_service_remove_listener(svc, id);
+}
+
+/* unsubscribe() for listener `id`: a native function with `this` bound to
+ * the service and the id pre-bound as its first argument, i.e. two hidden
+ * children and no closure scope. Returns a LOCKED function. */
+JsVar *xfsm_make_unsubscribe(JsVar *svc, int id) {
+  JsVar *fn = jsvNewNativeFunction((void (*)(void))xfsm_unsubscribe_native,
+                                   JSWAT_BOOL | JSWAT_THIS_ARG | (JSWAT_INT32 << JSWAT_BITS));
+  if (!fn) return 0;
+  jsvObjectSetChild(fn, JSPARSE_FUNCTION_THIS_NAME, svc);
+  JsVar *idv = jsvNewFromInteger(id);
+  if (idv) { jsvAddFunctionParameter(fn, 0, idv); jsvUnLock(idv); }
+  return fn;
+}
+
+/* Entered (or re-entered) the state: the timers of the states the transition
+ * exited are cancelled and those of the states it entered start from now,
+ * unless an action stopped the service. The `keep` outer levels (the
+ * candidate's LCA depth, 0 on flat machines) were neither exited nor
+ * entered, so their timers keep running. */
+static void xfsm_service_rearm_timers(JsVar *svc, JsVar *m, int keep) {
+  if (xfsm_service_status(svc) != XFSM_STATUS_RUNNING) return;
+  if (keep <= 0) {
+    xfsm_service_cancel_timers(svc);
+    xfsm_service_arm_timers(svc, m);
+    return;
+  }
+  JsVar *timers = jsvObjectGetChild(svc, K_STIMERS, 0);
+  JsVar *list = timers ? xfsm_service_after_list(svc, m) : 0;
+  if (timers) {
+    JsvObjectIterator it;
+    jsvObjectIteratorNew(&it, timers);
+    while (jsvObjectIteratorHasValue(&it)) {
+      JsVar *name = jsvObjectIteratorGetKey(&it);
+      int depth = (list && name) ? xfsm_after_depth(list, name) : 0;
+      if (name) jsvUnLock(name);
+      if (depth > 0 && depth <= keep) { jsvObjectIteratorNext(&it); continue; }
+      JsVar *id = jsvObjectIteratorGetValue(&it);
+      xfsm_timer_clear(id);
+      if (id) jsvUnLock(id);
+      jsvObjectIteratorRemoveAndGotoNext(&it, timers);
+    }
+    jsvObjectIteratorFree(&it);
+    jsvUnLock(timers);
+  }
+  if (list) jsvUnLock(list);
+  xfsm_service_arm_timers_ex(svc, m, keep, 0, 0, 0);
+}
+
+/* "Nothing happened" result of a send: _state/_context are left untouched.
+ * Listeners still see the (unchanged) state unless the Service was created
+ * with { notifyUnchanged:false }. Returns the current value (LOCKED) or 0. */
+static JsVar *xfsm_service_unchanged(JsVar *svc, int flags) {
+  XFSM_PROF_COUNT(unmatched);
+  if (!(flags & XFSM_SVC_QUIET_UNCHANGED))
+    xfsm_notify_listeners(svc);
+  JsVar *cur = jsvObjectGetChild(svc, K_SSTATE, 0);
+  JsVar *val = cur ? jsvObjectGetChild(cur, S_VALUE, 0) : 0;
+  if (cur) jsvUnLock(cur);
+  return val;
+}
+
+/* One macrostep: apply a single event to a running service. Listeners are
+ * called only if `notify` (sendBatch defers them to the end). Returns the
+ * next state's value (LOCKED string) or 0. On the compiled path an event the
+ * current state ignores is resolved without allocating anything (see
+ * xfsm_service_unchanged). */
+static JsVar *xfsm_service_step(JsVar *svc, JsVar *event /*string or object*/, bool notify) {
   if (!svc || !event) return 0;
 
   /* must be running */
-  JsVar *st = jsvObjectGetChild(svc, K_SSTATUS, 0);
-  bool running = false;
-  if (st && jsvIsString(st)) { char s[16]; str_from_jsv(st, s, sizeof(s)); running = (0==strcmp(s,"Running")); }
-  if (st) jsvUnLock(st);
-  if (!running) return 0;
+  int flags = xfsm_service_flags(svc);
+  if ((flags & XFSM_SVC_STATUS_MASK) != XFSM_STATUS_RUNNING) return 0;
+  int uflags = notify ? flags : (flags | XFSM_SVC_QUIET_UNCHANGED);
+  XFSM_PROF_COUNT(sends);
 
   JsVar *m = jsvObjectGetChild(svc, K_MACHINE, 0); if (!m) return 0;
 
-  /* normalize event */
-  JsVar *evtObj = xfsm_normalize_event(event);
-  if (!evtObj) { jsvUnLock(m); return 0; }
+  /* compute next pure state from the service's own state id + context */
+  JsVar *next = 0;
+  JsVar *evtObj = 0;
+  JsVar *reused = 0;    /* _state updated in place ({ reuseState:true }) */
+  bool split = false;   /* run runAssigns/runEffects instead of next.actions */
+  JsVar *runAssigns = 0, *runEffects = 0;
+  bool entered = false; /* targeted transition: re-arm the `after` timers */
+  int keep = 0;         /* ... of the states below this depth */
+  XfsmTable *t = 0;
+  JsVar *tv = xfsm_machine_table(m, &t);
+  if (tv) {
+    JsVar *vsid = jsvObjectGetChild(svc, K_SSID, 0);
+    uint16_t fromId = vsid ? (uint16_t)jsvGetInteger(vsid) : t->initial;
+    if (vsid) jsvUnLock(vsid);
+    uint16_t evId = tbl_event_of(t, event);
+    if (fromId >= t->stateCount || evId == XFSM_NOEVENT) { jsvUnLock(tv); jsvUnLock(m); return 0; }
+
+    /* fast path: no edge for this event in the current state */
+    XfsmTEdge *edge = tbl_edge_for(t, fromId, evId);
+    if (!edge) {
+      if (flags & XFSM_SVC_TRACE) xfsm_service_trace_record(svc, fromId, evId, XFSM_NONE, XFSM_NONE);
+      jsvUnLock(tv); jsvUnLock(m);
+      return xfsm_service_unchanged(svc, uflags);
+    }
 
-  /* previous service state (for fromStr) */
-  char fromBuf[64] = "";
-  JsVar *prev = jsvObjectGetChild(svc, K_SSTATE, 0);
-  if (prev) {
-    JsVar *pv = jsvObjectGetChild(prev, S_VALUE, 0);
-    if (pv && jsvIsString(pv)) str_from_jsv(pv, fromBuf, sizeof(fromBuf));
-    if (pv) jsvUnLock(pv);
-    jsvUnLock(prev);
+    /* string events use the machine's interned { type } object: no allocation */
+    evtObj = (jsvIsString(event) && evId < t->eventCount) ? tbl_handle(t, tbl_evObjs(t)[evId]) : 0;
+    if (!evtObj) evtObj = xfsm_normalize_event(event);
+    JsVar *gctx = evtObj ? jsvObjectGetChild(svc, K_SCTX, 0) : 0;
+    uint16_t ci = evtObj ? tbl_select(t, fromId, evId, gctx, evtObj) : XFSM_NONE;
+    uint16_t traceTo = XFSM_NONE;
+    if (tbl_cand_changes(t, fromId, ci)) {
+      uint16_t toId = fromId;
+      /* reuseState: once the service has its own state object, update it */
+      reused = (flags & XFSM_SVC_REUSE_STATE) && (flags & XFSM_SVC_OWN_STATE)
+               ? jsvObjectGetChild(svc, K_SSTATE, 0) : 0;
+      next = tbl_state_obj(t, fromId, ci, gctx, &toId, reused);
+      if (next) traceTo = toId;
+      entered = tbl_cands(t)[ci].target != XFSM_NONE;
+      keep = (tbl_cands(t)[ci].flags & XFSM_CAND_KEEP_MASK) >> XFSM_CAND_KEEP_SHIFT;
+      if (next && toId != fromId) {
+        jsvObjectSetChildAndUnLock(svc, K_SSID, jsvNewFromInteger(toId));
+        if (flags & XFSM_SVC_BUS) xfsm_bus_sync(svc);
+      }
+      /* run the pre-split, pre-resolved lists unless names resolve per service */
+      if (next && !(flags & XFSM_SVC_OWN_ACTIONS)) {
+        split = true;
+        runAssigns = tbl_handle(t, tbl_cands(t)[ci].assigns);
+        runEffects = tbl_handle(t, tbl_cands(t)[ci].effects);
+      }
+    }
+    if (gctx) jsvUnLock(gctx);
+    if (flags & XFSM_SVC_TRACE)
+      xfsm_service_trace_record(svc, fromId, evId, traceTo, ci == XFSM_NONE ? XFSM_NONE : (uint16_t)(ci - edge->cand));
+    /* a bare self-target changes nothing but still re-enters the state */
+    bool reenter = !next && ci != XFSM_NONE && tbl_cands(t)[ci].target != XFSM_NONE &&
+                   tbl_states(t)[fromId].after;
+    if (reenter) keep = (tbl_cands(t)[ci].flags & XFSM_CAND_KEEP_MASK) >> XFSM_CAND_KEEP_SHIFT;
+    jsvUnLock(tv);
+    if (evtObj && !next) {
+      if (reenter) xfsm_service_rearm_timers(svc, m, keep);
+      jsvUnLock(evtObj); jsvUnLock(m);
+      return xfsm_service_unchanged(svc, uflags);
+    }
+  } else {
+    evtObj = jsvIsString(event) ? xfsm_machine_event(m, event) : xfsm_normalize_event(event);
+    JsVar *prev = evtObj ? jsvObjectGetChild(svc, K_SSTATE, 0) : 0;
+    next = evtObj ? xfsm_machine_transition_interp(m, prev, evtObj, &entered) : 0;
+    if (prev) jsvUnLock(prev);
+    JsVar *ch = next ? jsvObjectGetChild(next, "changed", 0) : 0;
+    bool changed = ch && jsvGetBool(ch);
+    if (ch) jsvUnLock(ch);
+    if (next && !changed) {
+      if (entered) xfsm_service_rearm_timers(svc, m, 0);
+      jsvUnLock(next); jsvUnLock(evtObj); jsvUnLock(m);
+      return xfsm_service_unchanged(svc, uflags);
+    }
   }
-
-  /* compute next pure state */
-  JsVar *next = xfsm_machine_transition_ex(m, 0 /*use svc state via fromBuf if needed in ex*/, evtObj);
-  if (!next) { jsvUnLock(evtObj); jsvUnLock(m); return 0; }
+  if (!next) { if (evtObj) jsvUnLock(evtObj); jsvUnLock(m); return 0; }
 
   /* execute actions */
-  JsVar *acts = jsvObjectGetChild(next, S_ACTS, 0);
-  JsVar *val  = jsvObjectGetChild(next, S_VALUE, 0);
-  char toBuf[64] = "";
-  if (val && jsvIsString(val)) str_from_jsv(val, toBuf, sizeof(toBuf));
+  JsVar *acts = split ? 0 : jsvObjectGetChild(next, S_ACTS, 0);
 
+  /* immutableContext: the first assign of this send copies the context, so
+   * earlier state objects keep theirs */
+  if (flags & XFSM_SVC_IMMUTABLE_CTX) xfsm_service_set_flags(svc, xfsm_service_flags(svc) | XFSM_SVC_SHARED_CTX);
   JsVar *ctx = jsvObjectGetChild(svc, K_SCTX, 0);
-  run_actions_raw(svc, &ctx, acts, evtObj, fromBuf, toBuf);
+  if (split) {
+    run_actions_split(svc, &ctx, runAssigns, runEffects, evtObj);
+    if (runAssigns) jsvUnLock(runAssigns);
+    if (runEffects) jsvUnLock(runEffects);
+  } else {
+    run_actions_raw(svc, &ctx, acts, evtObj, 0, 0);
+  }
 
   /* reflect updated ctx both into service and into state object */
   if (ctx) {
@@ -1320,21 +4404,141 @@ JsVar *xfsm_service_send(JsVar *svc, JsVar *event /*string or object*/) {
   }
 
   /* store next state object on service */
-  jsvObjectSetChildAndUnLock(svc, K_SSTATE, jsvLockAgain(next));
+  if (reused) {
+    jsvUnLock(reused);
+  } else {
+    jsvObjectSetChildAndUnLock(svc, K_SSTATE, jsvLockAgain(next));
+    if (t && (flags & XFSM_SVC_REUSE_STATE) && !(flags & XFSM_SVC_OWN_STATE))
+      xfsm_service_set_flags(svc, xfsm_service_flags(svc) | XFSM_SVC_OWN_STATE);
+  }
+
+  XFSM_PROF_COUNT(matched);
+
+  /* left the state: its timers go, the new state's are armed (unless an
+   * action stopped the service) */
+  if (entered) xfsm_service_rearm_timers(svc, m, keep);
 
   /* V2.1 addition: notify listeners after a successful transition */
-  xfsm_notify_listeners(svc);
+  if (notify) xfsm_notify_listeners(svc);
 
   /* return the new value */
   JsVar *retVal = jsvObjectGetChild(next, S_VALUE, 0);
   if (acts) jsvUnLock(acts);
-  if (val)  jsvUnLock(val);
   jsvUnLock(next);
   jsvUnLock(evtObj);
   jsvUnLock(m);
   return retVal;
 }
 
+/* ---------------- Run-to-completion event queue ----------------
+ * A send made while the same service is still processing (from an action,
+ * guard or listener) is appended to _queue and handled after the current
+ * macrostep, instead of re-entering xfsm_service_step. Services being
+ * processed are tracked in a small native stack, so the check allocates
+ * nothing; if it is full (services sending to each other more than
+ * XFSM_BUSY_MAX deep) the send is processed directly as before. */
+#define XFSM_BUSY_MAX 8
+static JsVarRef xfsm_busy[XFSM_BUSY_MAX];
+static int xfsm_busyDepth = 0;
+
+static bool xfsm_service_busy(JsVar *svc) {
+  JsVarRef ref = jsvGetRef(svc);
+  for (int i = 0; i < xfsm_busyDepth; i++)
+    if (xfsm_busy[i] == ref) return true;
+  return false;
+}
+
+static void xfsm_service_enqueue(JsVar *svc, JsVar *event) {
+  JsVar *q = jsvObjectGetChild(svc, K_SQUEUE, 0);
+  if (!q) {
+    q = jsvNewEmptyArray();
+    if (!q) return;
+    jsvObjectSetChild(svc, K_SQUEUE, q);
+  }
+  jsvArrayPush(q, event);
+  jsvUnLock(q);
+}
+
+/* Process queued events until none are left. `ret` is the value of the last
+ * step so far (LOCKED or 0); the value of the final step is returned. */
+static JsVar *xfsm_service_drain(JsVar *svc, JsVar *ret, bool notify) {
+  JsVar *q = jsvObjectGetChild(svc, K_SQUEUE, 0);
+  if (!q) return ret;
+  JsVar *ev;
+  while ((ev = jsvArrayPopFirst(q)) != 0) {
+    JsVar *r = xfsm_service_step(svc, ev, notify);
+    jsvUnLock(ev);
+    if (r) { if (ret) jsvUnLock(ret); ret = r; }
+  }
+  jsvUnLock(q);
+  return ret;
+}
+
+/**
+ * xfsm_service_send
+ * Apply a transition to a running service.
+ * Accepts event as string OR object; normalizes to {type:string,...}.
+ * Executes actions with the **object** event; returns next state's value (locked string) or 0.
+ * Sends made while this service is processing are queued (run-to-completion):
+ * they return 0 and run after the current event, in order.
+ */
+JsVar *xfsm_service_send(JsVar *svc, JsVar *event /*string or object*/) {
+  if (!svc || !event) return 0;
+  if (xfsm_service_busy(svc)) { xfsm_service_enqueue(svc, event); return 0; }
+  XFSM_PROF_BEGIN(svc, true);
+  JsVar *ret;
+  if (xfsm_busyDepth >= XFSM_BUSY_MAX) {
+    ret = xfsm_service_step(svc, event, true);
+  } else {
+    xfsm_busy[xfsm_busyDepth++] = jsvGetRef(svc);
+    ret = xfsm_service_step(svc, event, true);
+    ret = xfsm_service_drain(svc, ret, true);
+    xfsm_busyDepth--;
+  }
+  XFSM_PROF_END();
+  return ret;
+}
+
+/**
+ * xfsm_service_send_batch
+ * Apply every event of an array in one call. Listeners are notified once at
+ * the end (with the final state), not per event. Events sent from actions
+ * meanwhile are queued and processed within the batch.
+ */
+void xfsm_service_send_batch(JsVar *svc, JsVar *events /*array*/) {
+  if (!svc || !events || !jsvIsArray(events)) return;
+  bool busy = xfsm_service_busy(svc);
+  bool nested = !busy && xfsm_busyDepth >= XFSM_BUSY_MAX;
+  if (!busy && !nested) xfsm_busy[xfsm_busyDepth++] = jsvGetRef(svc);
+  XFSM_PROF_BEGIN(svc, !busy);
+
+  JsvObjectIterator it;
+  jsvObjectIteratorNew(&it, events);
+  while (jsvObjectIteratorHasValue(&it)) {
+    JsVar *ev = jsvObjectIteratorGetValue(&it);
+    if (ev && (jsvIsString(ev) || jsvIsObject(ev))) {
+      if (busy) xfsm_service_enqueue(svc, ev);
+      else {
+        JsVar *r = xfsm_service_step(svc, ev, false);
+        if (r) jsvUnLock(r);
+      }
+    }
+    if (ev) jsvUnLock(ev);
+    jsvObjectIteratorNext(&it);
+  }
+  jsvObjectIteratorFree(&it);
+  if (busy) { XFSM_PROF_END(); return; }
+
+  JsVar *r = xfsm_service_drain(svc, 0, false);
+  if (r) jsvUnLock(r);
+  if (xfsm_service_status(svc) == XFSM_STATUS_RUNNING) xfsm_notify_listeners(svc);
+  /* sends made by the listeners themselves run as ordinary sends */
+  r = xfsm_service_drain(svc, 0, true);
+  if (r) jsvUnLock(r);
+  if (!nested) xfsm_busyDepth--;
+  XFSM_PROF_END();
+}
+
 JsVar *xfsm_service_get_state(JsVar *svc) {
   if (!svc) return 0;
   JsVar *st = jsvObjectGetChild(svc, K_SSTATE, 0);
@@ -1343,25 +4547,422 @@ JsVar *xfsm_service_get_state(JsVar *svc) {
 }
 JsVar *xfsm_service_get_status(JsVar *svc) {
   if (!svc) return 0;
-  JsVar *v = jsvObjectGetChild(svc, K_SSTATUS, 0);
-  if (!v) return jsvNewFromString("NotStarted");
-  return v; // locked
+  XfsmStatus st = xfsm_service_status(svc);
+  return jsvNewFromString(st == XFSM_STATUS_RUNNING ? "Running" :
+                          st == XFSM_STATUS_STOPPED ? "Stopped" : "NotStarted");
 }
 
 /**
  * xfsm_service_get_status_num
- * Map _status string to numeric: NotStarted=0, Running=1, Stopped=2
+ * Status from _flags as a number: NotStarted=0, Running=1, Stopped=2
  */
 
 JsVar *xfsm_service_get_status_num(JsVar *svc) {
-  if (!svc) return jsvNewFromInteger(0);
-  JsVar *v = jsvObjectGetChild(svc, K_SSTATUS, 0);
-  int num = 0;
-  if (v && jsvIsString(v)) {
-    char s[16]; str_from_jsv(v, s, sizeof(s));
-    if (0 == strcmp(s, "Running")) num = 1;
-    else if (0 == strcmp(s, "Stopped")) num = 2;
+  return jsvNewFromInteger((JsVarInt)xfsm_service_status(svc));
+}
+
+/* ========================================================================== */
+/*                               Service pool                                 */
+/* ========================================================================== */
+/* machine.pool(n): n instances of one compiled machine without a Service
+ * object each. Per instance there is one 4-byte record in a flat string
+ * (`_recs`: state id + status), and a context only once that instance has
+ * assigned (`_ctxs`, a sparse array); until then it shares the machine's
+ * initial context. Pools have no listeners, `after` timers or event queue:
+ * a send made from an action runs straight away. */
+static const char * const K_PRECS = "_recs";
+static const char * const K_PCTXS = "_ctxs";
+
+typedef struct {
+  uint16_t sid;
+  uint8_t  status;        /* XfsmStatus */
+  uint8_t  flags;         /* XFSM_PREC_* */
+} XfsmPoolRec;
+
+#define XFSM_PREC_OWN_CTX 0x01  /* _ctxs[i] holds this instance's own context */
+
+/* Record i of a pool (pointer into the LOCKED *pHold) or 0 */
+static XfsmPoolRec *xfsm_pool_rec(JsVar *pool, int i, JsVar **pHold) {
+  *pHold = 0;
+  JsVar *v = jsvObjectGetChild(pool, K_PRECS, 0);
+  if (!v) return 0;
+  if (i < 0 || (size_t)(i + 1) * sizeof(XfsmPoolRec) > xfsm_flat_len(v)) { jsvUnLock(v); return 0; }
+  *pHold = v;
+  return (XfsmPoolRec*)xfsm_flat_ptr(v) + i;
+}
+
+bool xfsm_pool_init(JsVar *pool, JsVar *machine, int n) {
+  XfsmTable *t = 0;
+  JsVar *tv = xfsm_machine_table(machine, &t);
+  if (!tv) return false;      /* needs compiled state ids */
+  uint16_t initial = t->initial;
+  jsvUnLock(tv);
+  if (n < 1 || n > 0xFFFF) return false;
+  JsVar *recs = xfsm_new_flat((size_t)n * sizeof(XfsmPoolRec));
+  if (!recs) return false;
+  XfsmPoolRec *r = (XfsmPoolRec*)xfsm_flat_ptr(recs);
+  for (int i = 0; i < n; i++) { r[i].sid = initial; r[i].status = XFSM_STATUS_NOTSTARTED; r[i].flags = 0; }
+  jsvObjectSetChildAndUnLock(pool, K_PRECS, recs);
+  jsvObjectSetChild(pool, K_MACHINE, machine);
+  jsvObjectSetChildAndUnLock(pool, K_PCTXS, jsvNewEmptyArray());
+  JsVar *actsMap = xfsm_machine_actions_map(machine);
+  jsvObjectSetChildAndUnLock(pool, K_SACTS, actsMap ? actsMap : jsvNewNull());
+  return true;
+}
+
+/* Instance i's context (LOCKED): its own, or the shared initial one */
+JsVar *xfsm_pool_context(JsVar *pool, int i) {
+  JsVar *hold;
+  XfsmPoolRec *r = xfsm_pool_rec(pool, i, &hold);
+  if (!r) return 0;
+  bool own = (r->flags & XFSM_PREC_OWN_CTX) != 0;
+  jsvUnLock(hold);
+  if (own) {
+    JsVar *ctxs = jsvObjectGetChild(pool, K_PCTXS, 0);
+    JsVar *c = ctxs ? jsvGetArrayItem(ctxs, i) : 0;
+    if (ctxs) jsvUnLock(ctxs);
+    return c;
+  }
+  JsVar *m = jsvObjectGetChild(pool, K_MACHINE, 0);
+  JsVar *st = m ? xfsm_machine_initial_state(m) : 0;
+  JsVar *c = st ? jsvObjectGetChild(st, S_CTX, 0) : 0;
+  if (st) jsvUnLock(st);
+  if (m) jsvUnLock(m);
+  return c;
+}
+
+/* First assign or action run by instance i: copy the shared context into
+ * _ctxs[i], so writes from either never reach the machine's initial state */
+static void xfsm_pool_claim_context(JsVar *pool, int i, JsVar **pCtx) {
+  JsVar *hold;
+  XfsmPoolRec *r = xfsm_pool_rec(pool, i, &hold);
+  if (!r) return;
+  if (!(r->flags & XFSM_PREC_OWN_CTX)) {
+    JsVar *c = (*pCtx && jsvIsObject(*pCtx)) ? jsvCopy(*pCtx, true) : jsvNewObject();
+    JsVar *ctxs = c ? jsvObjectGetChild(pool, K_PCTXS, 0) : 0;
+    if (ctxs) {
+      jsvSetArrayItem(ctxs, i, c);
+      jsvUnLock(ctxs);
+      r->flags |= XFSM_PREC_OWN_CTX;
+      if (*pCtx) jsvUnLock(*pCtx);
+      *pCtx = c;
+    } else if (c) jsvUnLock(c);
+  }
+  jsvUnLock(hold);
+}
+
+int  xfsm_pool_status(JsVar *pool, int i) {
+  JsVar *hold;
+  XfsmPoolRec *r = xfsm_pool_rec(pool, i, &hold);
+  if (!r) return -1;
+  int st = r->status;
+  jsvUnLock(hold);
+  return st;
+}
+
+/* Current state name of instance i (LOCKED) or 0 */
+JsVar *xfsm_pool_value(JsVar *pool, int i) {
+  JsVar *hold;
+  XfsmPoolRec *r = xfsm_pool_rec(pool, i, &hold);
+  if (!r) return 0;
+  uint16_t sid = r->sid;
+  jsvUnLock(hold);
+  JsVar *m = jsvObjectGetChild(pool, K_MACHINE, 0);
+  XfsmTable *t = 0;
+  JsVar *tv = m ? xfsm_machine_table(m, &t) : 0;
+  if (m) jsvUnLock(m);
+  JsVar *name = (tv && sid < t->stateCount) ? tbl_handle(t, tbl_states(t)[sid].name) : 0;
+  if (tv) jsvUnLock(tv);
+  return name;
+}
+
+/* start(i): instance i enters the initial state, running its entry actions
+ * with xstate.init. False if i is out of range or already running. */
+bool xfsm_pool_start(JsVar *pool, int i) {
+  JsVar *hold;
+  XfsmPoolRec *r = xfsm_pool_rec(pool, i, &hold);
+  if (!r) return false;
+  if (r->status == XFSM_STATUS_RUNNING) { jsvUnLock(hold); return false; }
+  JsVar *m = jsvObjectGetChild(pool, K_MACHINE, 0);
+  XfsmTable *t = 0;
+  JsVar *tv = m ? xfsm_machine_table(m, &t) : 0;
+  if (tv) { r->sid = t->initial; jsvUnLock(tv); }
+  r->status = XFSM_STATUS_RUNNING;
+  r->flags &= (uint8_t)~XFSM_PREC_OWN_CTX;   /* back to the initial context */
+  jsvUnLock(hold);
+  JsVar *ctxs = jsvObjectGetChild(pool, K_PCTXS, 0);
+  JsVar *idx = ctxs ? jsvNewFromInteger(i) : 0;
+  JsVar *slot = idx ? jsvFindChildFromVar(ctxs, idx, false) : 0;
+  if (slot) jsvRemoveChildAndUnLock(ctxs, slot);
+  if (idx) jsvUnLock(idx);
+  if (ctxs) jsvUnLock(ctxs);
+
+  /* initial entry assigns are already in the shared context; the rest run now */
+  JsVar *st = m ? xfsm_machine_initial_state(m) : 0;
+  JsVar *acts = st ? jsvObjectGetChild(st, S_ACTS, 0) : 0;
+  if (acts && jsvGetArrayLength(acts)) {
+    JsVar *ctx = jsvObjectGetChild(st, S_CTX, 0);
+    xfsm_pool_claim_context(pool, i, &ctx);
+    JsVar *evtInit = jsvNewObject();
+    if (evtInit) jsvObjectSetChildAndUnLock(evtInit, "type", jsvNewFromString("xstate.init"));
+    run_actions_raw(pool, &ctx, acts, evtInit, 0, 0);
+    if (evtInit) jsvUnLock(evtInit);
+    if (ctx) jsvUnLock(ctx);
+  }
+  if (acts) jsvUnLock(acts);
+  if (st) jsvUnLock(st);
+  if (m) jsvUnLock(m);
+  return true;
+}
+
+void xfsm_pool_stop(JsVar *pool, int i) {
+  JsVar *hold;
+  XfsmPoolRec *r = xfsm_pool_rec(pool, i, &hold);
+  if (!r) return;
+  if (r->status == XFSM_STATUS_RUNNING) r->status = XFSM_STATUS_STOPPED;
+  jsvUnLock(hold);
+}
+
+/* send(i, event): same transition rules as a compiled service. Returns the
+ * instance's state name afterwards (LOCKED), or 0 if it isn't running. */
+JsVar *xfsm_pool_send(JsVar *pool, int i, JsVar *event) {
+  if (!event) return 0;
+  JsVar *hold;
+  XfsmPoolRec *r = xfsm_pool_rec(pool, i, &hold);
+  if (!r) return 0;
+  uint16_t fromId = r->sid;
+  bool running = r->status == XFSM_STATUS_RUNNING;
+  jsvUnLock(hold);
+  if (!running) return 0;
+
+  JsVar *m = jsvObjectGetChild(pool, K_MACHINE, 0);
+  XfsmTable *t = 0;
+  JsVar *tv = m ? xfsm_machine_table(m, &t) : 0;
+  if (!tv) { if (m) jsvUnLock(m); return 0; }
+  uint16_t evId = tbl_event_of(t, event);
+  JsVar *evtObj = 0, *ctx = 0, *assigns = 0, *effects = 0;
+  uint16_t toId = fromId;
+  bool changed = false;
+  if (fromId < t->stateCount && evId != XFSM_NOEVENT && tbl_edge_for(t, fromId, evId)) {
+    evtObj = (jsvIsString(event) && evId < t->eventCount) ? tbl_handle(t, tbl_evObjs(t)[evId]) : 0;
+    if (!evtObj) evtObj = xfsm_normalize_event(event);
+    ctx = evtObj ? xfsm_pool_context(pool, i) : 0;
+    uint16_t ci = evtObj ? tbl_select(t, fromId, evId, ctx, evtObj) : XFSM_NONE;
+    if (tbl_cand_changes(t, fromId, ci)) {
+      XfsmTCand *c = &tbl_cands(t)[ci];
+      if (c->target != XFSM_NONE) toId = c->target;
+      assigns = tbl_handle(t, c->assigns);
+      effects = tbl_handle(t, c->effects);
+      changed = true;
+    }
+  }
+  jsvUnLock(tv);
+
+  if (changed) {
+    /* the new state is visible to sends made by the actions */
+    if (toId != fromId) {
+      r = xfsm_pool_rec(pool, i, &hold);
+      if (r) { r->sid = toId; jsvUnLock(hold); }
+    }
+    if (assigns || effects) xfsm_pool_claim_context(pool, i, &ctx);
+    run_actions_split(pool, &ctx, assigns, effects, evtObj);
   }
+  if (assigns) jsvUnLock(assigns);
+  if (effects) jsvUnLock(effects);
+  if (ctx) jsvUnLock(ctx);
+  if (evtObj) jsvUnLock(evtObj);
+  jsvUnLock(m);
+  return xfsm_pool_value(pool, i);
+}
+
+int xfsm_pool_size(JsVar *pool) {
+  JsVar *v = jsvObjectGetChild(pool, K_PRECS, 0);
+  int n = (int)(xfsm_flat_len(v) / sizeof(XfsmPoolRec));
   if (v) jsvUnLock(v);
-  return jsvNewFromInteger(num);
+  return n;
+}
+
+/* ========================================================================== */
+/*                                 Event bus                                  */
+/* ========================================================================== */
+/* FSM.Bus(): broadcast events to a set of services, touching only those
+ * whose current state handles them. The bus keeps an inverted index
+ * (`_idx`: event name -> array of services) plus `_any`, the services that
+ * take every event: interpretive machines, and compiled states with an
+ * on["*"] edge. A registered service carries `_bus` and the state id it is
+ * indexed under (`_bsid`), and xfsm_bus_sync moves it between lists when
+ * that changes (transition, start, stop, restore). */
+static const char * const K_BSVCS = "_svcs";
+static const char * const K_BIDX  = "_idx";
+static const char * const K_BANY  = "_any";
+
+#define XFSM_BUS_MAX  32     /* services per bus: bus.send locks its targets on the C stack */
+#define XFSM_BUS_OFF  -1     /* _bsid: not indexed (not running) */
+#define XFSM_BUS_ALL  -2     /* _bsid: in _any (interpretive machine) */
+
+/* Add svc to, or remove it from, an index list */
+static void xfsm_bus_list(JsVar *list, JsVar *svc, bool add) {
+  if (!list) return;
+  if (add) { jsvArrayPush(list, svc); return; }
+  JsvObjectIterator it;
+  jsvObjectIteratorNew(&it, list);
+  while (jsvObjectIteratorHasValue(&it)) {
+    JsVar *v = jsvObjectIteratorGetValue(&it);
+    bool hit = v == svc;
+    if (v) jsvUnLock(v);
+    if (hit) { jsvObjectIteratorRemoveAndGotoNext(&it, list); break; }
+    jsvObjectIteratorNext(&it);
+  }
+  jsvObjectIteratorFree(&it);
+}
+
+/* Index (or unindex) svc under key: a state id of its machine, or XFSM_BUS_ALL */
+static void xfsm_bus_index(JsVar *bus, JsVar *svc, int key, bool add) {
+  if (key == XFSM_BUS_OFF) return;
+  XfsmTable *t = 0;
+  JsVar *m = key != XFSM_BUS_ALL ? jsvObjectGetChild(svc, K_MACHINE, 0) : 0;
+  JsVar *tv = m ? xfsm_machine_table(m, &t) : 0;
+  if (m) jsvUnLock(m);
+  if (!tv || key >= t->stateCount || tbl_states(t)[key].any != XFSM_NONE) {
+    JsVar *any = jsvObjectGetChild(bus, K_BANY, 0);
+    xfsm_bus_list(any, svc, add);
+    if (any) jsvUnLock(any);
+    if (tv) jsvUnLock(tv);
+    return;
+  }
+  JsVar *idx = jsvObjectGetChild(bus, K_BIDX, 0);
+  XfsmTState *st = &tbl_states(t)[key];
+  for (int i = 0; idx && i < st->edgeCount; i++) {
+    uint16_t ev = tbl_edges(t)[st->edgeStart + i].event;
+    JsVar *name = ev < t->eventCount ? tbl_handle(t, tbl_evNames(t)[ev]) : 0;
+    if (name && !jsvIsStringEqualOrStartsWith(name, XFSM_AFTER_PREFIX, true)) {
+      JsVar *list = get_child_v(idx, name);
+      if (!list && add) {
+        list = jsvNewEmptyArray();
+        if (list) set_child_v_and_unlock(idx, name, jsvLockAgain(list));
+      }
+      xfsm_bus_list(list, svc, add);
+      if (list) jsvUnLock(list);
+    }
+    if (name) jsvUnLock(name);
+  }
+  if (idx) jsvUnLock(idx);
+  jsvUnLock(tv);
+}
+
+/* Re-index a registered service after its state id or status changed */
+static void xfsm_bus_sync(JsVar *svc) {
+  JsVar *bus = jsvObjectGetChild(svc, K_SBUS, 0);
+  if (!bus) return;
+  int want = XFSM_BUS_OFF;
+  if (xfsm_service_status(svc) == XFSM_STATUS_RUNNING) {
+    JsVar *vsid = jsvObjectGetChild(svc, K_SSID, 0);
+    want = vsid ? (int)jsvGetInteger(vsid) : XFSM_BUS_ALL;
+    if (vsid) jsvUnLock(vsid);
+  }
+  JsVar *had = jsvObjectGetChild(svc, K_SBSID, 0);
+  int have = had ? (int)jsvGetInteger(had) : XFSM_BUS_OFF;
+  if (had) jsvUnLock(had);
+  if (want != have) {
+    xfsm_bus_index(bus, svc, have, false);
+    xfsm_bus_index(bus, svc, want, true);
+    jsvObjectSetChildAndUnLock(svc, K_SBSID, jsvNewFromInteger(want));
+  }
+  jsvUnLock(bus);
+}
+
+bool xfsm_bus_init(JsVar *bus) {
+  JsVar *svcs = jsvNewEmptyArray(), *idx = jsvNewObject(), *any = jsvNewEmptyArray();
+  bool ok = svcs && idx && any;
+  if (ok) {
+    jsvObjectSetChild(bus, K_BSVCS, svcs);
+    jsvObjectSetChild(bus, K_BIDX, idx);
+    jsvObjectSetChild(bus, K_BANY, any);
+  }
+  if (svcs) jsvUnLock(svcs);
+  if (idx) jsvUnLock(idx);
+  if (any) jsvUnLock(any);
+  return ok;
+}
+
+/* Entries in _svcs (removal leaves gaps, so not its array length) */
+int xfsm_bus_size(JsVar *bus) {
+  JsVar *svcs = jsvObjectGetChild(bus, K_BSVCS, 0);
+  int n = svcs ? (int)jsvGetChildren(svcs) : 0;
+  if (svcs) jsvUnLock(svcs);
+  return n;
+}
+
+bool xfsm_bus_add(JsVar *bus, JsVar *svc) {
+  JsVar *m = (svc && jsvIsObject(svc)) ? jsvObjectGetChild(svc, K_MACHINE, 0) : 0;
+  if (!m) return false;        /* not a Service */
+  jsvUnLock(m);
+  JsVar *cur = jsvObjectGetChild(svc, K_SBUS, 0);
+  if (cur) { bool same = cur == bus; jsvUnLock(cur); return same; }
+  if (xfsm_bus_size(bus) >= XFSM_BUS_MAX) return false;
+  JsVar *svcs = jsvObjectGetChild(bus, K_BSVCS, 0);
+  if (!svcs) return false;
+  jsvArrayPush(svcs, svc);
+  jsvUnLock(svcs);
+  jsvObjectSetChild(svc, K_SBUS, bus);
+  xfsm_service_set_flags(svc, xfsm_service_flags(svc) | XFSM_SVC_BUS);
+  xfsm_bus_sync(svc);
+  return true;
+}
+
+bool xfsm_bus_remove(JsVar *bus, JsVar *svc) {
+  JsVar *cur = (svc && jsvIsObject(svc)) ? jsvObjectGetChild(svc, K_SBUS, 0) : 0;
+  bool mine = cur && cur == bus;
+  if (cur) jsvUnLock(cur);
+  if (!mine) return false;
+  JsVar *had = jsvObjectGetChild(svc, K_SBSID, 0);
+  xfsm_bus_index(bus, svc, had ? (int)jsvGetInteger(had) : XFSM_BUS_OFF, false);
+  if (had) jsvUnLock(had);
+  JsVar *svcs = jsvObjectGetChild(bus, K_BSVCS, 0);
+  xfsm_bus_list(svcs, svc, false);
+  if (svcs) jsvUnLock(svcs);
+  jsvObjectRemoveChild(svc, K_SBSID);
+  jsvObjectRemoveChild(svc, K_SBUS);
+  xfsm_service_set_flags(svc, xfsm_service_flags(svc) & ~XFSM_SVC_BUS);
+  return true;
+}
+
+/* Lock up to XFSM_BUS_MAX services of a list into out[] */
+static int xfsm_bus_collect(JsVar *list, JsVar **out, int n) {
+  if (!list) return n;
+  JsvObjectIterator it;
+  jsvObjectIteratorNew(&it, list);
+  while (n < XFSM_BUS_MAX && jsvObjectIteratorHasValue(&it)) {
+    JsVar *v = jsvObjectIteratorGetValue(&it);
+    if (v) out[n++] = v;
+    jsvObjectIteratorNext(&it);
+  }
+  jsvObjectIteratorFree(&it);
+  return n;
+}
+
+/* bus.send(e): the targets are locked first, so transitions made while
+ * dispatching (which re-index) don't change who gets this event */
+int xfsm_bus_send(JsVar *bus, JsVar *event) {
+  if (!bus || !event) return 0;
+  JsVar *type = jsvIsObject(event) ? jsvObjectGetChild(event, "type", 0)
+                                   : (jsvIsString(event) ? jsvLockAgain(event) : 0);
+  if (!type || !jsvIsString(type) || !jsvGetStringLength(type)) { if (type) jsvUnLock(type); return 0; }
+  JsVar *targets[XFSM_BUS_MAX];
+  int n = 0;
+  JsVar *idx = jsvObjectGetChild(bus, K_BIDX, 0);
+  JsVar *list = idx ? get_child_v(idx, type) : 0;
+  n = xfsm_bus_collect(list, targets, n);
+  if (list) jsvUnLock(list);
+  if (idx) jsvUnLock(idx);
+  jsvUnLock(type);
+  list = jsvObjectGetChild(bus, K_BANY, 0);
+  n = xfsm_bus_collect(list, targets, n);
+  if (list) jsvUnLock(list);
+  for (int i = 0; i < n; i++) {
+    JsVar *r = xfsm_service_send(targets[i], event);
+    if (r) jsvUnLock(r);
+    jsvUnLock(targets[i]);
+  }
+  return n;
 }
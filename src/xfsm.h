@@ -5,6 +5,26 @@
 #include "jsvar.h"
 #include <stdbool.h>
 
+/* ------------------------------------------------------------------------- */
+/*  Build options                                                            */
+/*  Everything is built by default. Define XFSM_MINIMAL to drop the          */
+/*  optional subsystems, then XFSM_ENABLE_<name> to keep single ones:        */
+/*    XFSM_ENABLE_V1              V1 `new FSM(config)` class                 */
+/*    XFSM_ENABLE_PURE_TRANSITION Machine.transition() (no Service)          */
+/*  XFSM_ENABLE_PROFILE (same as XFSM_PROFILE) adds service.profile(),       */
+/*  stats() and resetStats(); it is off unless given. The JSON wrapper       */
+/*  entries test the same flags.                                             */
+/* ------------------------------------------------------------------------- */
+#if !defined(XFSM_MINIMAL) || defined(XFSM_ENABLE_V1)
+#define XFSM_HAS_V1 1
+#endif
+#if !defined(XFSM_MINIMAL) || defined(XFSM_ENABLE_PURE_TRANSITION)
+#define XFSM_HAS_PURE_TRANSITION 1
+#endif
+#if defined(XFSM_ENABLE_PROFILE) && !defined(XFSM_PROFILE)
+#define XFSM_PROFILE 1
+#endif
+
 /* ------------------------------------------------------------------------- */
 /*  InterpreterStatus values (mirrors xstate-fsm.js for compatibility)       */
 /* ------------------------------------------------------------------------- */
@@ -18,12 +38,14 @@ typedef enum {
 /*  V1 single-object FSM (kept for compatibility)                            */
 /*  Prefer Service/Machine API (V2+) for new development.                    */
 /* ------------------------------------------------------------------------- */
+#ifdef XFSM_HAS_V1
 void       xfsm_init_object(JsVar *fsmObject);
 XfsmStatus xfsm_start_object(JsVar *fsmObject, JsVar *initialState /*locked or 0*/);
 void       xfsm_stop_object(JsVar *fsmObject);
 XfsmStatus xfsm_status_object(JsVar *fsmObject);
 JsVar     *xfsm_current_state_var(JsVar *fsmObject);
 JsVar     *xfsm_send_object(JsVar *fsmObject, JsVar *event /*locked string*/);
+#endif
 
 /* ------------------------------------------------------------------------- */
 /*  Core Machine API (V2)                                                    */
@@ -35,9 +57,17 @@ JsVar *xfsm_normalize_event(JsVar *event);
 /* Create initial state object from a machine */
 JsVar *xfsm_machine_initial_state(JsVar *machineObj);
 
+/* Interned { type } event for machine.event(name); LOCKED, shared (read-only) */
+JsVar *xfsm_machine_event(JsVar *machineObj, JsVar *name);
+
+#ifdef XFSM_HAS_PURE_TRANSITION
 /* Transition with string or object event */
 JsVar *xfsm_machine_transition(JsVar *machineObj, JsVar *state, JsVar *eventStr);
 JsVar *xfsm_machine_transition_ex(JsVar *machineObj, JsVar *prevStateOrValue, JsVar *eventObj);
+#endif
+
+/* State.prototype.matches: compare a state object's value with a string */
+bool   xfsm_state_matches(JsVar *stateObj, JsVar *value);
 
 /* Run ordered actions (exit → trans.actions → entry) */
 void run_actions_raw(JsVar *serviceObj, JsVar **ctx, JsVar *actions,
@@ -51,6 +81,18 @@ void run_actions_raw(JsVar *serviceObj, JsVar **ctx, JsVar *actions,
 
 /* Minimal initializers used by wrappers */
 void  xfsm_machine_init(JsVar *machineObj);
+
+/* Compile config into machine._table (state x event -> candidates). Returns
+ * false if the machine stays on the interpretive path. */
+bool  xfsm_machine_compile(JsVar *machineObj);
+/* Has the machine a compiled table? (nested configs need one) */
+bool  xfsm_machine_is_compiled(JsVar *machineObj);
+/* machine.analyze(): reachable/unreachable states, per-state events, dead
+ * events, guard/action counts and block estimates (LOCKED object, or 0) */
+JsVar *xfsm_machine_analyze(JsVar *machineObj);
+
+/* Re-resolve named actions in the compiled lists (machine-level map) */
+void  xfsm_machine_refresh_actions(JsVar *machineObj);
 void  xfsm_service_init(JsVar *serviceObj, JsVar *machineObj);
 
 /* Start/stop/send */
@@ -59,26 +101,105 @@ JsVar *xfsm_service_start(JsVar *svc);
 /* Stop the service (sets status, clears listeners) */
 JsVar *xfsm_service_stop(JsVar *svc);
 
-/* Send event to service */
+/* Send event to service (queued if the service is already processing one) */
 JsVar *xfsm_service_send(JsVar *svc, JsVar *event);
 
+/* Send an array of events; listeners are notified once at the end */
+void xfsm_service_send_batch(JsVar *svc, JsVar *events);
+
 /* Accessors */
 JsVar *xfsm_service_get_state(JsVar *serviceObj);
 JsVar *xfsm_service_get_status(JsVar *serviceObj);
 JsVar *xfsm_service_get_status_num(JsVar *serviceObj);
+XfsmStatus xfsm_service_status(JsVar *serviceObj);  /* read from _flags, no allocation */
+
+/* Re-read the actions map(s) after swapping implementations at runtime */
+void xfsm_service_refresh_actions(JsVar *serviceObj);
+
+#ifdef XFSM_PROFILE
+/* Profiling counters (`_stats`): switch on/off, zero, read as an object */
+void   xfsm_service_profile(JsVar *serviceObj, bool on);
+void   xfsm_service_reset_stats(JsVar *serviceObj);
+JsVar *xfsm_service_get_stats(JsVar *serviceObj);
+#endif
+
+/* Binary snapshot of state, status, pending timers and context (LOCKED
+ * string); restore applies one to a service fresh from xfsm_service_init
+ * without running entry actions, false if it doesn't fit the machine */
+JsVar *xfsm_service_snapshot(JsVar *serviceObj);
+bool   xfsm_service_restore(JsVar *serviceObj, JsVar *blob);
+
+/* { trace:N } ring buffer, decoded to [{ time, from, event, to, guard }] (or 0) */
+JsVar *xfsm_service_get_trace(JsVar *serviceObj);
 
 /* ------------------------------------------------------------------------- */
 /*  V2.1: Subscription + Validation Helpers                                  */
 /* ------------------------------------------------------------------------- */
 
-/* Call all registered listeners with latest state */
+/* Call all registered listeners with latest state (queued once per tick if coalescing) */
 void xfsm_notify_listeners(JsVar *service);
 
-/* Validate that config.states has no nested substates (flat only) */
+/* Listener array: add returns the new id (0 on failure); remove tombstones it */
+int xfsm_service_add_listener(JsVar *svc, JsVar *listener);
+bool xfsm_service_remove_listener(JsVar *svc, int id);
+
+/* Validate that config.states has no nested substates (flat only).
+ * Native walk; the Machine constructor runs it once and sets _valid. */
 bool xfsm_validate_no_nested_states(JsVar *machineConfig);
+/* Quiet check: does config.states contain substates? */
+bool xfsm_config_is_nested(JsVar *machineConfig);
+
+/* Native unsubscribe() bound to (svc, id); returns LOCKED function */
+JsVar *xfsm_make_unsubscribe(JsVar *svc, int id);
+
+/* subscribe() pre-notification: the listener's first call, queued for the next tick */
+void xfsm_service_prenotify(JsVar *svc, JsVar *listener);
+
+/* ------------------------------------------------------------------------- */
+/*  Low-power idle                                                           */
+/* ------------------------------------------------------------------------- */
+
+/* Queued events, armed `after` timers or queued listener calls of one service */
+bool xfsm_service_has_pending_work(JsVar *svc);
+
+/* Any such work outstanding across all services */
+bool xfsm_has_pending_work(void);
+
+/* FSM.idle(fn) hook: queued once each time pending work drains to zero */
+void xfsm_set_idle_hook(JsVar *fn);
+
+/* Idle-loop and reset() handlers */
+bool xfsm_idle(void);
+void xfsm_kill(void);
+
+/* ------------------------------------------------------------------------- */
+/*  Service pool: n packed instances of one compiled machine                 */
+/* ------------------------------------------------------------------------- */
+
+/* Set up `_recs`/`_ctxs` for n instances; false if the machine isn't compiled */
+bool   xfsm_pool_init(JsVar *pool, JsVar *machine, int n);
+int    xfsm_pool_size(JsVar *pool);
+
+/* Per instance i; out-of-range i gives false / 0 / -1 */
+bool   xfsm_pool_start(JsVar *pool, int i);
+void   xfsm_pool_stop(JsVar *pool, int i);
+JsVar *xfsm_pool_send(JsVar *pool, int i, JsVar *event);   /* state name after, LOCKED */
+JsVar *xfsm_pool_value(JsVar *pool, int i);
+JsVar *xfsm_pool_context(JsVar *pool, int i);
+int    xfsm_pool_status(JsVar *pool, int i);
+
+/* ------------------------------------------------------------------------- */
+/*  Event bus: broadcast to the registered services that handle the event    */
+/* ------------------------------------------------------------------------- */
+
+bool   xfsm_bus_init(JsVar *bus);
+int    xfsm_bus_size(JsVar *bus);
 
-void xfsm_ensure_unsub_factory(void);
-JsVar *xfsm_make_unsubscribe(JsVar *svc, int id);  // returns LOCKED function
+/* add: false if svc isn't a Service, is on another bus, or the bus is full */
+bool   xfsm_bus_add(JsVar *bus, JsVar *svc);
+bool   xfsm_bus_remove(JsVar *bus, JsVar *svc);
 
+/* Send to each interested service; returns how many were sent the event */
+int    xfsm_bus_send(JsVar *bus, JsVar *event);
 
 #endif /* CORE_XFSM_H */
@@ -0,0 +1,202 @@
+// xfsm_Benchmark_V2_25.js
+// Espruino XFSM Benchmarks — events/second, blocks per send, GC and start-up cost (V2_25)
+// Uses only the Machine / interpret() / send() API, so the same script runs
+// against V2_24 and later builds (B3n's declarative guards and B4n's assign
+// ops need V2_25). Copy the console output to results_Bench_<build>.txt and
+// diff the CSV sections between builds.
+//
+// Metrics (per machine, per mode):
+//   startMs     : new Machine(config) + interpret().start(), averaged over STARTUP_N
+//   eps         : events/second over N sends (after WARMUP sends)
+//   blocksSend  : net JsVar blocks still in use after the N sends, divided by N
+//                 (Espruino frees by reference count, so this is what is retained)
+//   gcBlocks    : blocks a forced GC reclaimed after the run (garbage in cycles)
+//   gcMs        : time that GC took
+// Modes: "c" = compiled table (default), "i" = { compile:false } interpretive.
+// Builds without a compiled table run both modes the same way.
+
+// =========================
+// Bench Harness (mirrors V2_24 gaps style)
+// =========================
+
+function log(s) { print(s); }
+
+var XFSM_BENCH_CFG = { N:500, WARMUP:20, STARTUP_N:10, CHUNK_DELAY_MS:0, MODES:["c","i"] };
+function _drain(lines, i){ if(i>=lines.length) return; print(lines[i]); setTimeout(function(){ _drain(lines,i+1); }, XFSM_BENCH_CFG.CHUNK_DELAY_MS|0); }
+function _fix(v, d){ var p=Math.pow(10,d); return ""+(Math.round(v*p)/p); }
+
+function makeMachine(config, mode) { return new Machine(config, mode==="i" ? { compile:false } : undefined); }
+
+// =========================
+// Benchmark Machines
+// =========================
+// Each returns { config, events } where events is the send sequence, built
+// once outside the timed loop (strings, or objects for payload events).
+
+// B1: two-state toggle, one string event
+function B1_Toggle() {
+  var ev = [];
+  for (var i=0;i<XFSM_BENCH_CFG.N;i++) ev.push("TOGGLE");
+  return { config:{ id:"toggle", initial:"off", states:{
+    off:{ on:{ TOGGLE:"on" } }, on:{ on:{ TOGGLE:"off" } }
+  }}, events:ev };
+}
+
+// B2: 20-state / 50-event protocol parser. Each state accepts 5 events;
+// every 8th send is an event the current state ignores (no-match path).
+function B2_Protocol() {
+  var NS=20, NE=50, K=5, states={}, i, k;
+  for (i=0;i<NS;i++) {
+    var on={};
+    for (k=0;k<K;k++) on["E"+((i*K+k)%NE)] = "S"+((i+k+1)%NS);
+    states["S"+i] = { on:on };
+  }
+  var ev=[], cur=0;
+  for (i=0;i<XFSM_BENCH_CFG.N;i++) {
+    if (i%8===7) { ev.push("E"+((cur*K+K)%NE)); continue; }   // not in S<cur>
+    k = i%K;
+    ev.push("E"+((cur*K+k)%NE));
+    cur = (cur+k+1)%NS;
+  }
+  return { config:{ id:"proto", initial:"S0", states:states }, events:ev };
+}
+
+// B3: guarded array transitions; guards read context and event payload
+function B3_Guarded() {
+  var ev=[];
+  for (var i=0;i<XFSM_BENCH_CFG.N;i++) ev.push({ type:"EV", x:i%4 });
+  return { config:{ id:"guarded", initial:"A", context:{ n:0 }, states:{
+    A:{ on:{ EV:[
+      { target:"B", cond:function(ctx, e){ return e.x===1; } },
+      { target:"C", cond:function(ctx, e){ return e.x===2; } },
+      { actions:[ function(ctx){ ctx.n++; } ] }
+    ] } },
+    B:{ on:{ EV:[
+      { target:"A", cond:function(ctx, e){ return e.x!==1; } },
+      { target:"C" }
+    ] } },
+    C:{ on:{ EV:"A" } }
+  }}, events:ev };
+}
+
+// B3n: B3 with declarative guards (native comparisons when compiled)
+function B3n_NativeGuards() {
+  var spec = B3_Guarded();
+  spec.config = { id:"guardedN", initial:"A", context:{ n:0 }, states:{
+    A:{ on:{ EV:[
+      { target:"B", cond:{ eq:["evt.x", 1] } },
+      { target:"C", cond:{ eq:["evt.x", 2] } },
+      { actions:[ function(ctx){ ctx.n++; } ] }
+    ] } },
+    B:{ on:{ EV:[
+      { target:"A", cond:{ ne:["evt.x", 1] } },
+      { target:"C" }
+    ] } },
+    C:{ on:{ EV:"A" } }
+  }};
+  return spec;
+}
+
+// B4: assign-heavy counters: a targetless event applying three assigns
+function B4_Counters() {
+  var ev=[];
+  for (var i=0;i<XFSM_BENCH_CFG.N;i++) ev.push("INC");
+  return { config:{ id:"counters", initial:"run", context:{ a:0, b:0, c:0 }, states:{
+    run:{ on:{ INC:{ actions:[
+      { type:"xstate.assign", assignment:function(ctx){ return { a:ctx.a+1 }; } },
+      { type:"xstate.assign", assignment:function(ctx){ return { b:ctx.b+2 }; } },
+      { type:"xstate.assign", assignment:{ c:function(ctx){ return ctx.a+ctx.b; } } }
+    ] } } }
+  }}, events:ev };
+}
+
+// B4n: B4 with native assign ops instead of assignment functions
+function B4n_NativeCounters() {
+  var spec = B4_Counters();
+  spec.config = { id:"countersN", initial:"run", context:{ a:0, b:0, c:0 }, states:{
+    run:{ on:{ INC:{ actions:[
+      { type:"xstate.assign", assignment:{ a:{ $inc:1 }, b:{ $inc:2 } } },
+      { type:"xstate.assign", assignment:{ c:function(ctx){ return ctx.a+ctx.b; } } }
+    ] } } }
+  }};
+  return spec;
+}
+
+// =========================
+// Measurement
+// =========================
+
+function benchOne(id, mk, mode) {
+  var spec = mk(), cfg = XFSM_BENCH_CFG, i, t0, t1;
+
+  t0 = getTime();
+  for (i=0;i<cfg.STARTUP_N;i++) makeMachine(spec.config, mode).interpret().start();
+  t1 = getTime();
+  var startMs = (t1-t0)*1000/cfg.STARTUP_N;
+
+  var s = makeMachine(spec.config, mode).interpret().start();
+  var ev = spec.events;
+  for (i=0;i<cfg.WARMUP;i++) s.send(ev[i%ev.length]);
+
+  process.memory();                        // GC before, so the run starts clean
+  var u0 = process.memory(false).usage;
+  t0 = getTime();
+  for (i=0;i<ev.length;i++) s.send(ev[i]);
+  t1 = getTime();
+  var u1 = process.memory(false).usage;
+  var gc = process.memory();               // forced GC: garbage the run left behind
+
+  return { id:id+"/"+mode, eps:ev.length/(t1-t0), startMs:startMs,
+           blocksSend:(u1-u0)/ev.length, gcBlocks:gc.gc|0, gcMs:gc.gctime||0 };
+}
+
+// =========================
+// Runner
+// =========================
+
+function runAllBench() {
+  var benches = [
+    ["B1", B1_Toggle],
+    ["B2", B2_Protocol],
+    ["B3", B3_Guarded],
+    ["B3n", B3n_NativeGuards],
+    ["B4", B4_Counters],
+    ["B4n", B4n_NativeCounters]
+  ];
+  var jobs = [];
+  for (var b=0;b<benches.length;b++)
+    for (var m=0;m<XFSM_BENCH_CFG.MODES.length;m++) jobs.push([benches[b][0], benches[b][1], XFSM_BENCH_CFG.MODES[m]]);
+
+  var results = [], out = [];
+
+  function addSummary() {
+    out.push(""); out.push("=== SUMMARY (Bench) ===");
+    out.push("build "+process.env.VERSION+" on "+process.env.BOARD+"; N="+XFSM_BENCH_CFG.N);
+    for (var i=0;i<results.length;i++) {
+      var r=results[i];
+      if (r.error) { out.push("ERR  "+r.id+" : "+r.error); continue; }
+      out.push(r.id+" : "+_fix(r.eps,0)+" ev/s; start "+_fix(r.startMs,2)+" ms; "+_fix(r.blocksSend,3)+" blocks/send; gc "+r.gcBlocks+" blocks / "+_fix(r.gcMs,2)+" ms");
+    }
+    out.push(""); out.push("=== CSV (BenchID,eps,startMs,blocksSend,gcBlocks,gcMs) ===");
+    for (var j=0;j<results.length;j++) {
+      var c=results[j];
+      if (c.error) out.push(c.id+",ERR,,,,");
+      else out.push(c.id+","+_fix(c.eps,0)+","+_fix(c.startMs,2)+","+_fix(c.blocksSend,3)+","+c.gcBlocks+","+_fix(c.gcMs,2));
+    }
+    out.push("=== END ===");
+  }
+
+  var i=0;
+  function runOne() {
+    if (i>=jobs.length) { addSummary(); _drain(out,0); return; }
+    var j=jobs[i++];
+    try { results.push(benchOne(j[0], j[1], j[2])); }
+    catch(e) { results.push({ id:j[0]+"/"+j[2], error:(e&&e.message?e.message:(""+e)) }); }
+    setTimeout(runOne, 0);                 // let the console and idle loop run between jobs
+  }
+
+  runOne();
+}
+
+// Execute
+runAllBench();
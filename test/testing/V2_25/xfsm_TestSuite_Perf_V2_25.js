@@ -0,0 +1,871 @@
+// xfsm_TestSuite_Perf_V2_25.js
+// Espruino XFSM Performance-path Tests — behaviour of the compiled/fast paths (V2_25)
+// Each test checks the optimised path gives the same observable result as the
+// interpretive one; timings live in the benchmark suite, not here.
+
+// =========================
+// Test Harness (mirrors V2_24 gaps style)
+// =========================
+
+function log(s) { print(s); }
+function pass(id, msg) { return { id:id, ok:true,  msg:msg }; }
+function fail(id, msg) { return { id:id, ok:false, msg:msg }; }
+function skip(id, msg) { return { id:id, ok:true,  skipped:true, msg:msg || "Skipped" }; }
+
+function asyncTest(startFn, timeoutMs) { return { __async__: true, __start__: startFn, __timeout__: (timeoutMs||400) }; }
+
+var XFSM_TS_CFG = { FAIL_ONLY:false, CHUNK_DELAY_MS:0, MAX_MSG_LEN:160 };
+function _san(s){ s=""+s; s=s.replace(/[\r\n]/g," ").replace(/,/g,";"); if(s.length>XFSM_TS_CFG.MAX_MSG_LEN)s=s.slice(0,XFSM_TS_CFG.MAX_MSG_LEN)+"…"; return s; }
+function _drain(lines, i){ if(i>=lines.length) return; print(lines[i]); setTimeout(function(){ _drain(lines,i+1); }, XFSM_TS_CFG.CHUNK_DELAY_MS|0); }
+
+function makeMachine(config, options) { return new Machine(config, options); }
+function tracer(arr, label) { return function (ctx, evt) { arr.push(label); }; }
+
+// Light switch with a guarded, multi-candidate event; used by several tests
+function switchConfig(trace) {
+  return {
+    id:"sw", initial:"off", context:{ n:0 },
+    states:{
+      off:{ exit:[tracer(trace,"exitOff")], on:{
+        FLIP:{ target:"on", actions:[tracer(trace,"flip")] },
+        BUMP:[ { target:"on", cond:function(ctx){ return ctx.n>=2; } },
+               { actions:[ { n:function(ctx){ return ctx.n+1; } } ] } ] } },
+      on:{ entry:[tracer(trace,"entryOn")], on:{ FLIP:"off" } }
+    }
+  };
+}
+
+// =========================
+// Compiled machine table
+// =========================
+
+// P1a: compiled and interpretive machines agree on a sequence of sends
+function T_P1a_Compiled_Matches_Interpretive() {
+  var tA=[], tB=[];
+  var a = makeMachine(switchConfig(tA)).interpret().start();
+  var b = makeMachine(switchConfig(tB), { compile:false }).interpret().start();
+  var seq = ["FLIP","FLIP","BUMP","BUMP","NOPE","BUMP","FLIP"];
+  for (var i=0;i<seq.length;i++) {
+    a.send(seq[i]); b.send(seq[i]);
+    if (a.state.value!==b.state.value) return fail("P1a","diverged at "+seq[i]+": "+a.state.value+" vs "+b.state.value);
+  }
+  if (tA.join(",")!==tB.join(",")) return fail("P1a","action order differs: "+tA.join(",")+" vs "+tB.join(","));
+  if (a.state.context.n!==b.state.context.n) return fail("P1a","context differs");
+  return pass("P1a","compiled table matches interpretive walk");
+}
+
+// P1b: a service transitions from its current state (not the machine's initial)
+function T_P1b_Send_Uses_Current_State() {
+  var t=[];
+  var s = makeMachine(switchConfig(t)).interpret().start();
+  s.send("FLIP"); s.send("FLIP");
+  if (s.state.value!=="off") return fail("P1b","expected off after two flips, got "+s.state.value);
+  return pass("P1b","second send computed from current state");
+}
+
+// P1c: guards see the service's live context
+function T_P1c_Guard_Sees_Service_Context() {
+  var t=[];
+  var s = makeMachine(switchConfig(t)).interpret().start();
+  s.send("BUMP"); s.send("BUMP");
+  if (s.state.value!=="off") return fail("P1c","guard passed too early");
+  s.send("BUMP");
+  if (s.state.value!=="on") return fail("P1c","guard did not see ctx.n==2 (n="+s.state.context.n+")");
+  return pass("P1c","guard evaluated against service context");
+}
+
+// P1d: pure transition() on the compiled table, including unknown targets
+function T_P1d_Pure_Transition_Compiled() {
+  var m = makeMachine({ id:"p", initial:"A", states:{ A:{ on:{ GO:"B", BAD:"NOWHERE" } }, B:{} } });
+  var st = m.transition(m.initialState(), "GO");
+  if (!st || st.value!=="B" || st.changed!==true) return fail("P1d","GO did not reach B");
+  st = m.transition("A", "BAD");
+  if (!st || st.value!=="NOWHERE") return fail("P1d","unknown target not preserved");
+  return pass("P1d","pure transition via table");
+}
+
+// =========================
+// Shared State.prototype.matches
+// =========================
+
+// P2a: matches() is one native prototype method, not a per-object closure
+function T_P2a_Matches_Shared_Native() {
+  var m = makeMachine({ id:"p2", initial:"A", states:{ A:{ on:{ GO:"AB" } }, AB:{} } });
+  var st0 = m.initialState();
+  var st1 = m.transition(st0, "GO");
+  if (!st0.matches("A") || st0.matches("AB")) return fail("P2a","initial matches() wrong");
+  if (!st1.matches("AB") || st1.matches("A")) return fail("P2a","matches() prefix compare");
+  if (st1.hasOwnProperty("matches")) return fail("P2a","matches is an own property");
+  if (st0.matches!==st1.matches) return fail("P2a","matches not shared");
+  if (!(st1 instanceof State)) return fail("P2a","state is not a State");
+  // flat machines compare exactly, even with dotted names
+  var fm = makeMachine({ id:"p2f", initial:"sensor.imu", states:{ "sensor":{}, "sensor.imu":{ on:{ UP:"sensor" } } } });
+  var fs = fm.initialState();
+  if (!fs.matches("sensor.imu") || fs.matches("sensor")) return fail("P2a","flat dotted name matched as an ancestor");
+  return pass("P2a","shared native State.prototype.matches");
+}
+
+// =========================
+// No-change fast path
+// =========================
+
+// P3a: an ignored event leaves _state untouched but still notifies (G8)
+function T_P3a_NoMatch_Keeps_State_Object() {
+  return asyncTest(function(done){
+    var s = makeMachine({ id:"p3", initial:"A", states:{ A:{ on:{ GO:"B", SELF:"A" } }, B:{} } }).interpret().start();
+    var hits=0;
+    s.subscribe(function(){ hits++; });
+    setTimeout(function(){
+      var st0 = s.state, pre = hits;
+      s.send("NOPE"); s.send("SELF");
+      if (s.state!==st0) return done(fail("P3a","_state replaced on no-change send"));
+      if (hits!==pre+2) return done(fail("P3a","expected 2 unchanged notifications, got "+(hits-pre)));
+      done(pass("P3a","unchanged state kept; listeners notified"));
+    },0);
+  }, 500);
+}
+
+// P3b: interpret({ notifyUnchanged:false }) only notifies real changes
+function T_P3b_NotifyUnchanged_False() {
+  return asyncTest(function(done){
+    var s = makeMachine({ id:"p3b", initial:"A", states:{ A:{ on:{ GO:"B" } }, B:{} } }).interpret({ notifyUnchanged:false }).start();
+    var hits=0;
+    s.subscribe(function(){ hits++; });
+    setTimeout(function(){
+      var pre = hits;
+      s.send("NOPE");
+      if (hits!==pre) return done(fail("P3b","notified on unchanged send"));
+      s.send("GO");
+      if (hits!==pre+1) return done(fail("P3b","not notified on change"));
+      done(pass("P3b","unchanged notifications suppressed"));
+    },0);
+  }, 500);
+}
+
+// =========================
+// Numeric status
+// =========================
+
+// P4a: status/statusText derive from the packed status word
+function T_P4a_Status_Numeric() {
+  var s = makeMachine({ id:"p4", initial:"A", states:{ A:{ on:{ GO:"B" } }, B:{} } }).interpret();
+  if (s.status!==0 || s.statusText()!=="NotStarted") return fail("P4a","bad initial status");
+  s.send("GO");
+  if (s.state.value!=="A") return fail("P4a","send accepted before start()");
+  s.start();
+  if (s.status!==1 || s.statusText()!=="Running") return fail("P4a","bad running status");
+  s.stop();
+  if (s.status!==2 || s.statusText()!=="Stopped") return fail("P4a","bad stopped status");
+  s.send("GO");
+  if (s.state.value!=="A") return fail("P4a","send accepted after stop()");
+  return pass("P4a","numeric status gate");
+}
+
+// =========================
+// Cached / pre-resolved actions map
+// =========================
+
+// P5a: named actions resolve once; refreshActions() picks up swapped functions
+function T_P5a_RefreshActions() {
+  var seq=[];
+  var opts = { actions:{ beep:function(){ seq.push("b1"); } } };
+  var m = makeMachine({ id:"p5", initial:"A", states:{ A:{ on:{ T:{ actions:[ "beep", { type:"beep" } ] } } } } }, opts);
+  var s = m.interpret().start();
+  s.send("T");
+  if (seq.join(",")!=="b1,b1") return fail("P5a","named actions not run: "+seq.join(","));
+  opts.actions.beep = function(){ seq.push("b2"); };
+  s.refreshActions();
+  seq=[]; s.send("T");
+  if (seq.join(",")!=="b2,b2") return fail("P5a","refreshActions() not applied: "+seq.join(","));
+  if (typeof s.state.actions[0]!=="string") return fail("P5a","state.actions lost the action name");
+  return pass("P5a","pre-resolved named actions + refreshActions()");
+}
+
+// P5b: a service-level actions map still overrides the machine's
+function T_P5b_Service_Actions_Override() {
+  var seq=[];
+  var m = makeMachine({ id:"p5b", initial:"A", states:{ A:{ on:{ T:{ actions:[ "beep" ] } } } } },
+                      { actions:{ beep:function(){ seq.push("machine"); } } });
+  var s = m.interpret({ actions:{ beep:function(){ seq.push("service"); } } }).start();
+  s.send("T");
+  if (seq.join(",")!=="service") return fail("P5b","expected service override, got "+seq.join(","));
+  return pass("P5b","service actions map has priority");
+}
+
+// =========================
+// Pre-partitioned action lists
+// =========================
+
+// P6a: a long mixed list runs all assigns first, then effects in order
+function T_P6a_Partitioned_Order() {
+  function build(out) {
+    var acts=[];
+    for (var i=0;i<40;i++) {
+      if (i%3===0) acts.push({ type:"xstate.assign", assignment:function(ctx){ return { n:ctx.n+1 }; } });
+      else acts.push((function(k){ return function(ctx){ out.push(k+":"+ctx.n); }; })(i));
+    }
+    return { id:"p6", initial:"A", context:{ n:0 }, states:{ A:{ on:{ T:{ target:"B", actions:acts } } }, B:{} } };
+  }
+  var oA=[], oB=[];
+  var a = makeMachine(build(oA)).interpret().start();
+  var b = makeMachine(build(oB), { compile:false }).interpret().start();
+  a.send("T"); b.send("T");
+  if (a.state.context.n!==14 || b.state.context.n!==14) return fail("P6a","assign count wrong: "+a.state.context.n+"/"+b.state.context.n);
+  if (oA.length!==26 || oA[0]!=="1:14" || oA[25]!=="38:14") return fail("P6a","effect order wrong: "+oA[0]+".."+oA[oA.length-1]);
+  if (oA.join(",")!==oB.join(",")) return fail("P6a","compiled and interpretive differ");
+  return pass("P6a","assign-first partition over 40 actions");
+}
+
+// =========================
+// Validation once per Machine
+// =========================
+
+// P7a: nested states rejected on the interpretive path; many interpret()/start() calls stay valid
+function T_P7a_Validate_Once() {
+  var threw=false;
+  try { makeMachine({ id:"p7n", initial:"A", states:{ A:{ states:{ AA:{} } } } }, { compile:false }); } catch(e){ threw=true; }
+  if (!threw) return fail("P7a","nested states accepted with compile:false");
+  var m = makeMachine({ id:"p7", initial:"A", states:{ A:{ on:{ T:{ target:"B" } } }, B:{} } });
+  if (m._valid!==true) return fail("P7a","_valid not set by constructor");
+  var t0=getTime();
+  for (var i=0;i<40;i++) { var s=m.interpret().start(); if (s.state.value!=="A") return fail("P7a","bad initial at "+i); s.stop(); }
+  var ms=Math.round((getTime()-t0)*1000);
+  return pass("P7a","40x interpret().start() in "+ms+"ms");
+}
+
+// =========================
+// Shared initial state
+// =========================
+
+// P8a: initialState cached per Machine; each started service has its own context
+function T_P8a_Shared_Initial_State() {
+  var inc = { type:"xstate.assign", assignment:function(ctx){ return { n:ctx.n+1 }; } };
+  var cfg = { id:"p8", initial:"A", context:{ n:0 }, states:{ A:{ entry:[inc], on:{ T:{ target:"B", actions:[inc] } } }, B:{} } };
+  var m = makeMachine(cfg);
+  if (m.initialState()!==m.initialState()) return fail("P8a","initialState not cached");
+  var a = m.interpret().start(), b = m.interpret().start();
+  if (a.state.context.n!==1 || b.state.context.n!==1) return fail("P8a","entry assign not applied on start");
+  a.send("T");
+  if (a.state.context.n!==2) return fail("P8a","assign lost (n="+a.state.context.n+")");
+  if (b.state.context.n!==1) return fail("P8a","context leaked between services");
+  if (cfg.context.n!==0 || m.initialState().context.n!==1) return fail("P8a","shared initial context was written");
+  a.stop(); a.start();
+  if (a.state.value!=="A" || a.state.context.n!==1) return fail("P8a","restart did not reset context");
+  // plain actions writing to ctx reach neither config.context nor other services
+  var cfg2 = { id:"p8b", initial:"A", context:{ n:0 }, states:{ A:{ on:{ T:{ target:"A", actions:[ function(ctx){ ctx.n++; } ] } } } } };
+  var m2 = makeMachine(cfg2);
+  var c = m2.interpret().start(), d = m2.interpret().start();
+  c.send("T"); c.send("T");
+  if (c.state.context.n!==2) return fail("P8a","in-place write lost (n="+c.state.context.n+")");
+  if (d.state.context.n!==0 || cfg2.context.n!==0 || m2.initialState().context.n!==0) return fail("P8a","in-place write leaked");
+  return pass("P8a","initial state shared, context private per service");
+}
+
+// =========================
+// Immutable context
+// =========================
+
+// P9a: { immutableContext:true } keeps earlier state snapshots intact, sharing untouched keys
+function T_P9a_Immutable_Context() {
+  var inc = { type:"xstate.assign", assignment:function(ctx){ return { n:ctx.n+1 }; } };
+  var big = { k:7 };
+  var m = makeMachine({ id:"p9", initial:"A", context:{ n:0, big:big }, states:{ A:{ on:{ T:{ target:"A", actions:[inc, inc] } } } } }, { immutableContext:true });
+  var s = m.interpret().start();
+  var hist = [s.state];
+  s.send("T"); hist.push(s.state);
+  s.send("T"); hist.push(s.state);
+  var ns = hist.map(function(h){ return h.context.n; }).join(",");
+  if (ns!=="0,2,4") return fail("P9a","history changed underneath: "+ns);
+  if (hist[1].context===hist[2].context) return fail("P9a","context object reused");
+  if (hist[2].context.big!==big) return fail("P9a","untouched key not shared");
+  return pass("P9a","snapshots "+ns+" with shared untouched keys");
+}
+
+// =========================
+// Reused state object
+// =========================
+
+// P10a: interpret({ reuseState:true }) updates one state object in place
+function T_P10a_Reuse_State() {
+  var m = makeMachine({ id:"p10", initial:"A", states:{ A:{ on:{ T:"B" } }, B:{ on:{ T:"A" } } } });
+  var s = m.interpret({ reuseState:true }).start();
+  s.send("T");
+  var st = s.state;
+  if (st===m.initialState()) return fail("P10a","shared initial state was reused");
+  var m0 = process.memory().usage;
+  for (var i=0;i<50;i++) s.send("T");
+  var grew = process.memory().usage - m0;
+  if (s.state!==st) return fail("P10a","state object replaced");
+  if (st.value!=="B" || st.changed!==true) return fail("P10a","bad in-place update: "+st.value);
+  s.stop(); s.start();
+  if (s.state!==m.initialState() || m.initialState().value!=="A") return fail("P10a","start did not reset");
+  return pass("P10a","one state object across 50 sends (vars delta "+grew+")");
+}
+
+// =========================
+// Event queue / sendBatch
+// =========================
+
+// P11a: send() from inside an action is queued until the current event completes
+function T_P11a_Run_To_Completion() {
+  var trace=[], s;
+  var m = makeMachine({ id:"p11", initial:"A", states:{
+    A:{ on:{ T:{ target:"B", actions:[ function(){ trace.push("a1"); s.send("U"); trace.push("a1done"); } ] } } },
+    B:{ on:{ U:{ target:"C", actions:[ function(){ trace.push("u"); } ] } } },
+    C:{}
+  }});
+  s = m.interpret().start();
+  s.send("T");
+  if (trace.join(",")!=="a1,a1done,u") return fail("P11a","nested send re-entered: "+trace.join(","));
+  if (s.state.value!=="C") return fail("P11a","queued event lost (state "+s.state.value+")");
+  return pass("P11a","nested send queued and drained");
+}
+
+// P11b: sendBatch() notifies listeners once, with the final state
+function T_P11b_SendBatch() {
+  return asyncTest(function(done){
+    var m = makeMachine({ id:"p11b", initial:"A", context:{ n:0 }, states:{
+      A:{ on:{ T:{ target:"A", actions:[ { type:"xstate.assign", assignment:function(ctx){ return { n:ctx.n+1 }; } } ] } } }
+    }});
+    var s = m.interpret().start(), hits=0, last;
+    s.subscribe(function(st){ hits++; last=st.context.n; });
+    setTimeout(function(){
+      hits=0;
+      var evs=[]; for (var i=0;i<20;i++) evs.push("T");
+      var t0=getTime();
+      s.sendBatch(evs);
+      var ms=Math.round((getTime()-t0)*1000);
+      if (hits!==1 || last!==20) done(fail("P11b","hits="+hits+" n="+last));
+      else done(pass("P11b","20 events; 1 notification; "+ms+"ms"));
+    },0);
+  }, 500);
+}
+
+// =========================
+// Listener vector / coalescing
+// =========================
+
+// P12a: a listener removing itself mid-notify does not disturb the others
+function T_P12a_Unsubscribe_During_Notify() {
+  return asyncTest(function(done){
+    var m = makeMachine({ id:"p12", initial:"A", states:{ A:{ on:{ T:"B" } }, B:{ on:{ T:"A" } } } });
+    var s = m.interpret().start(), armed=false, a=0, b=0, c=0, un2;
+    s.subscribe(function(){ a++; });
+    un2 = s.subscribe(function(){ if (armed) { b++; un2(); } });
+    s.subscribe(function(){ c++; });
+    setTimeout(function(){
+      armed=true; a=c=0;
+      s.send("T"); s.send("T");
+      if (a!==2 || b!==1 || c!==2) done(fail("P12a","a="+a+" b="+b+" c="+c));
+      else done(pass("P12a","tombstoned listener skipped; others intact"));
+    },0);
+  }, 500);
+}
+
+// P12b: interpret({ coalesce:true }) turns a burst of 50 sends into one listener call
+function T_P12b_Coalesce() {
+  return asyncTest(function(done){
+    var m = makeMachine({ id:"p12b", initial:"A", states:{ A:{ on:{ T:"B" } }, B:{ on:{ T:"A" } } } });
+    var s = m.interpret({ coalesce:true }).start(), hits=0, last;
+    s.subscribe(function(st){ hits++; last=st.value; });
+    setTimeout(function(){
+      hits=0;
+      for (var i=0;i<51;i++) s.send("T");
+      var sync=hits;
+      setTimeout(function(){
+        if (sync!==0 || hits!==1 || last!=="B") done(fail("P12b","sync="+sync+" hits="+hits+" last="+last));
+        else done(pass("P12b","51 sends -> 1 listener call with latest state"));
+      },0);
+    },0);
+  }, 500);
+}
+
+// =========================
+// Native unsubscribe
+// =========================
+
+// P13a: unsubscribe() is a native bound function; repeated cycles don't accumulate vars
+function T_P13a_Native_Unsubscribe() {
+  var m = makeMachine({ id:"p13", initial:"A", states:{ A:{} } });
+  var s = m.interpret().start();
+  var un = s.subscribe(function(){});
+  if (un()!==true || un()!==false) return fail("P13a","unsubscribe result not true then false");
+  s.send("X");
+  var m0 = process.memory().usage;
+  for (var i=0;i<50;i++) { s.subscribe(function(){})(); s.send("X"); }
+  var grew = process.memory().usage - m0;
+  if (grew > 10) return fail("P13a","vars grew by "+grew+" over 50 cycles");
+  return pass("P13a","50 subscribe/unsubscribe cycles; vars delta "+grew);
+}
+
+// =========================
+// Interned events
+// =========================
+
+// P14a: machine.event(name) returns one shared handle that send() accepts directly
+function T_P14a_Interned_Event() {
+  var ticks=0, bad=0;
+  var m = makeMachine({ id:"p14", initial:"A", states:{ A:{ on:{ TICK:{ actions:[ function(ctx, e){ ticks++; if (e.type!=="TICK") bad++; } ] } } } } });
+  var TICK = m.event("TICK");
+  if (TICK!==m.event("TICK") || TICK.type!=="TICK") return fail("P14a","event not interned");
+  var s = m.interpret({ reuseState:true }).start();
+  s.send(TICK);
+  var m0 = process.memory().usage;
+  for (var i=0;i<100;i++) s.send(TICK);
+  var grew = process.memory().usage - m0;
+  if (ticks!==101 || bad) return fail("P14a","ticks="+ticks+" bad="+bad);
+  return pass("P14a","100 interned TICK sends; vars delta "+grew);
+}
+
+// =========================
+// Long names
+// =========================
+
+// P15a: names longer than 64 chars resolve intact (states, events, assign keys, named actions)
+function T_P15a_Long_Names() {
+  var A="sensor.imu.accelerometer.calibration.waitingForStableReadings.phaseOne";
+  var B="sensor.imu.accelerometer.calibration.waitingForStableReadings.phaseTwo";
+  var EV="SENSOR_IMU_ACCELEROMETER_MOTION_DETECTED_AFTER_CALIBRATION_WINDOW_EXPIRED";
+  var KEY="accelerometerCalibrationSampleCountSinceLastStableWindowStarted_total";
+  var ACT="recordAccelerometerCalibrationSampleAndUpdateTheRollingAverageNow";
+  var modes=[undefined, { compile:false }];
+  for (var k=0;k<modes.length;k++) {
+    var ran=0, states={}, on={}, acts={}, asg={};
+    on[EV]=B; asg[KEY]=1; acts[ACT]=function(){ ran++; };
+    states[A]={ entry:[ { type:"xstate.assign", assignment:asg } ], on:on };
+    states[B]={ entry:[ ACT ] };
+    var m = makeMachine({ id:"p15", initial:A, context:{}, actions:acts, states:states }, modes[k]);
+    var st = m.transition(m.initialState(), EV);
+    if (!st || st.value!==B) return fail("P15a","pure transition lost the long name (mode "+k+")");
+    var s = m.interpret().start();
+    if (s.state.value!==A || s.state.context[KEY]!==1) return fail("P15a","initial value/assign key truncated (mode "+k+")");
+    s.send(EV);
+    if (s.state.value!==B || ran!==1) return fail("P15a","long event/action not resolved (mode "+k+")");
+  }
+  return pass("P15a","long state/event/key/action names intact in both modes");
+}
+
+// =========================
+// Delayed transitions
+// =========================
+
+// P16a: after:{ms:target} fires natively, and leaving the state or stop() clears the timer
+function T_P16a_After_Timers() {
+  return asyncTest(function(done){
+    var m = makeMachine({ id:"p16", initial:"A", states:{
+      A:{ after:{ 30:"B" }, on:{ GO:"C" } }, B:{}, C:{ after:{ 80:"B" } }
+    }});
+    var s1 = m.interpret().start();
+    var s2 = m.interpret().start(); s2.send("GO");   // exits A: its timer is cancelled
+    var s3 = m.interpret().start(); s3.send("GO"); s3.stop();
+    setTimeout(function(){
+      if (s1.state.value!=="B") return done(fail("P16a","after did not fire (s1="+s1.state.value+")"));
+      if (s2.state.value!=="C") return done(fail("P16a","cancelled timer fired (s2="+s2.state.value+")"));
+      if (s3.state.value!=="C") return done(fail("P16a","timer survived stop() (s3="+s3.state.value+")"));
+      setTimeout(function(){
+        if (s2.state.value!=="B") return done(fail("P16a","C's after did not fire"));
+        done(pass("P16a","after fired, exit/stop cancelled"));
+      }, 60);
+    }, 50);
+  }, 500);
+}
+
+// P16b: a bare self-target (KICK:"waiting") re-enters the state and pushes its after timer back
+function T_P16b_Self_Target_Rearms() {
+  return asyncTest(function(done){
+    var cfg = { id:"p16b", initial:"waiting", states:{
+      waiting:{ after:{ 60:"timeout" }, on:{ KICK:"waiting" } }, timeout:{}
+    }};
+    var sc = makeMachine(cfg).interpret().start();
+    var si = makeMachine(cfg, { compile:false }).interpret().start();
+    setTimeout(function(){ sc.send("KICK"); si.send("KICK"); }, 40);
+    setTimeout(function(){
+      if (sc.state.value!=="waiting") return done(fail("P16b","KICK did not restart the timer (compiled)"));
+      if (si.state.value!=="waiting") return done(fail("P16b","KICK did not restart the timer (compile:false)"));
+      setTimeout(function(){
+        if (sc.state.value!=="timeout" || si.state.value!=="timeout") return done(fail("P16b","re-armed timer did not fire"));
+        done(pass("P16b","self-target KICK re-armed after in both modes"));
+      }, 60);
+    }, 80);
+  }, 500);
+}
+
+// P17a: hasPendingWork() tracks after timers, and FSM.idle runs once the work drains
+function T_P17a_Pending_Work_Idle() {
+  return asyncTest(function(done){
+    var m = makeMachine({ id:"p17", initial:"A", states:{ A:{ after:{ 30:"B" } }, B:{} } });
+    var idles=0;
+    FSM.idle(function(){ idles++; });
+    var s = m.interpret().start();
+    if (!s.hasPendingWork()) { FSM.idle(); return done(fail("P17a","armed after timer not reported as pending")); }
+    if (!FSM.hasPendingWork()) { FSM.idle(); return done(fail("P17a","FSM.hasPendingWork() false with an armed timer")); }
+    setTimeout(function(){
+      FSM.idle();
+      if (s.state.value!=="B") return done(fail("P17a","after did not fire"));
+      if (s.hasPendingWork()) return done(fail("P17a","still pending after the timer fired"));
+      if (idles<1) return done(fail("P17a","FSM.idle callback not called"));
+      done(pass("P17a","pending work tracked, idle hook called"));
+    }, 80);
+  }, 500);
+}
+
+// P17b: timers cleared by user code (clearTimeout) are not left as pending work
+function T_P17b_Cleared_Timers() {
+  var m = makeMachine({ id:"p17b", initial:"A", states:{ A:{ after:{ 5000:"B" }, on:{ GO:"B" } }, B:{} } });
+  var s = m.interpret().start();
+  if (!s.hasPendingWork()) return fail("P17b","armed timer not pending");
+  for (var k in s._timers) clearTimeout(s._timers[k]);   // what clearTimeout() with no id does to it
+  if (s.hasPendingWork()) return fail("P17b","cleared timer still pending on the service");
+  if (FSM.hasPendingWork()) return fail("P17b","cleared timer still pending globally");
+  try { s.send("GO"); } catch(e) { return fail("P17b","leaving the state threw: "+e); }
+  if (s.state.value!=="B") return fail("P17b","GO not taken");
+  return pass("P17b","cleared timers dropped from pending work");
+}
+
+// P18a: { profile:true } counts sends, guards, actions and listener calls (XFSM_PROFILE builds)
+function T_P18a_Profile_Stats() {
+  var m = makeMachine({ id:"p18", initial:"A", states:{
+    A:{ on:{ T:{ target:"B", cond:function(){ return true; }, actions:[ function(){} ] } } }, B:{}
+  }});
+  var s = m.interpret({ profile:true });
+  if (typeof s.stats!=="function") return skip("P18a","firmware built without XFSM_PROFILE");
+  s.start();
+  s.subscribe(function(){});
+  s.send("T"); s.send("NOPE");
+  var st = s.stats();
+  if (st.sends!==2 || st.matched!==1 || st.unmatched!==1) return fail("P18a","send counts "+JSON.stringify(st));
+  if (st.guards!==1 || st.actions!==1) return fail("P18a","guard/action counts "+JSON.stringify(st));
+  if (st.listeners<2) return fail("P18a","listener count "+st.listeners);
+  s.resetStats();
+  if (s.stats().sends!==0) return fail("P18a","resetStats() did not zero the counters");
+  return pass("P18a","stats counted, reset");
+}
+
+// P20a: { trace:N } keeps the last N events, oldest first, decoded to names
+function T_P20a_Trace_Ring() {
+  var m = makeMachine({ id:"p20", initial:"A", states:{
+    A:{ on:{ T:[ { target:"B", cond:function(c,e){ return e.x===1; } }, { target:"C" } ] } },
+    B:{ on:{ BACK:"A" } }, C:{ on:{ BACK:"A" } }
+  }});
+  var s = m.interpret({ trace:3 }).start();
+  s.send({ type:"T", x:1 }); s.send("BACK"); s.send({ type:"T", x:2 }); s.send("NOPE");
+  var tr = s.trace();
+  if (!tr || tr.length!==3) return fail("P20a","expected 3 records, got "+(tr?tr.length:tr));
+  if (tr[0].from!=="B" || tr[0].to!=="A") return fail("P20a","oldest record wrong: "+JSON.stringify(tr[0]));
+  if (tr[1].to!=="C" || tr[1].guard!==1) return fail("P20a","guarded record wrong: "+JSON.stringify(tr[1]));
+  if (tr[2].to!==undefined) return fail("P20a","unmatched event recorded a target");
+  return pass("P20a","ring buffer kept the last 3 events");
+}
+
+// P21a: machine.restore(service.snapshot()) resumes state and context without entry actions
+function T_P21a_Snapshot_Restore() {
+  var entries=0;
+  var m = makeMachine({ id:"p21", initial:"A", context:{ n:0 }, states:{
+    A:{ entry:[ function(){ entries++; } ], on:{ GO:{ target:"B", actions:[ { type:"xstate.assign", assignment:{ n:7 } } ] } } },
+    B:{ entry:[ function(){ entries++; } ] }
+  }});
+  var s = m.interpret().start();
+  s.send("GO");
+  var blob = s.snapshot(); s.stop();
+  entries = 0;
+  var r = m.restore(blob);
+  if (entries!==0) return fail("P21a","restore ran entry actions");
+  if (r.state.value!=="B" || r.state.context.n!==7) return fail("P21a","restored "+r.state.value+" n="+r.state.context.n);
+  if (r.status!==1) return fail("P21a","restored service not running");
+  var threw=false; try { m.restore("junk"); } catch(e){ threw=true; }
+  if (!threw) return fail("P21a","invalid snapshot accepted");
+  return pass("P21a","state, context and status restored");
+}
+
+// P22a: { compact:true } drops config.states after compiling; the machine still runs
+function T_P22a_Compact_Config() {
+  var hits=0;
+  var m = makeMachine({ id:"p22", initial:"A", context:{ n:0 }, states:{
+    A:{ on:{ GO:{ target:"B", actions:[ function(){ hits++; }, { type:"xstate.assign", assignment:{ n:1 } } ] } } },
+    B:{ on:{ BACK:"A" } }
+  }}, { compact:true });
+  if (m.config.states!==undefined) return fail("P22a","config.states still held");
+  var s = m.interpret().start();
+  s.send("GO"); s.send("BACK"); s.send("GO");
+  if (s.state.value!=="B" || hits!==2 || s.state.context.n!==1) return fail("P22a","compact machine ran wrong: "+s.state.value+" hits="+hits);
+  return pass("P22a","config.states released, transitions unchanged");
+}
+
+// P22b: compact:true on an inline config lowers process.memory().usage (a config
+// the caller still references keeps its states alive, so nothing is freed then)
+function T_P22b_Compact_Memory() {
+  if (!process || !process.memory) return skip("P22b","process.memory() not available");
+  function big() {
+    var st = {};
+    for (var i=0;i<20;i++) st["s"+i] = { on:{ N:"s"+((i+1)%20), P:{ target:"s"+((i+19)%20) } } };
+    return { id:"p22b", initial:"s0", states:st };
+  }
+  var m0 = process.memory().usage;
+  var plain = makeMachine(big());
+  var usePlain = process.memory().usage - m0;
+  m0 = process.memory().usage;
+  var compact = makeMachine(big(), { compact:true });
+  var useCompact = process.memory().usage - m0;
+  if (!(useCompact < usePlain)) return fail("P22b","compact used "+useCompact+" blocks, plain "+usePlain);
+  var s = compact.interpret().start(); s.send("N"); s.send("P");
+  if (s.state.value!=="s0") return fail("P22b","compact machine ran wrong: "+s.state.value);
+  return pass("P22b","machine "+usePlain+" -> "+useCompact+" blocks with compact:true");
+}
+
+// P23a: machine.pool(n): independent instances, context copied on first assign or action
+function T_P23a_Service_Pool() {
+  var cfg = { id:"p23", initial:"idle", context:{ n:0, hits:0 }, states:{
+    idle:{ on:{ CONN:"up" } },
+    up:{ on:{ DATA:{ actions:[ { type:"xstate.assign", assignment:function(ctx){ return { n:ctx.n+1 }; } } ] },
+              HIT:{ actions:[ function(ctx){ ctx.hits++; } ] }, DROP:"idle" } }
+  }};
+  var m = makeMachine(cfg);
+  var pool = m.pool(50).start();
+  if (pool.length!==50) return fail("P23a","length "+pool.length);
+  if (pool.send(3, "CONN")!=="up") return fail("P23a","send did not transition");
+  pool.send(3, "DATA"); pool.send(3, "DATA");
+  if (pool.value(4)!=="idle") return fail("P23a","other instance changed");
+  if (pool.context(3).n!==2 || pool.context(4).n!==0) return fail("P23a","contexts not independent");
+  pool.send(4, "CONN"); pool.send(4, "HIT");
+  if (pool.context(4).hits!==1) return fail("P23a","in-place write lost");
+  if (pool.context(5).hits!==0 || cfg.context.hits!==0 || m.initialState().context.hits!==0) return fail("P23a","in-place write leaked");
+  pool.stop(3);
+  if (pool.send(3, "DROP")!==undefined || pool.status(3)!==2) return fail("P23a","stopped instance still accepted events");
+  return pass("P23a","pool instances independent");
+}
+
+// P24a: declarative guards (native) pick the same candidate compiled and interpretive
+function T_P24a_Native_Guards() {
+  function cfg() { return { id:"p24", initial:"A", context:{ lim:5, mode:"fast" }, states:{
+    A:{ on:{ EV:[
+      { target:"LOW", cond:{ lt:["evt.v", 10], gte:["evt.v", 0] } },
+      { target:"LIM", cond:{ gt:["evt.v", "ctx.lim"], eq:["ctx.mode", "fast"] } },
+      { target:"KEY", cond:{ in:["evt.k", ["a","b"]] } }
+    ] } },
+    LOW:{}, LIM:{}, KEY:{}
+  }}; }
+  var evs = [ { type:"EV", v:4 }, { type:"EV", v:12.5 }, { type:"EV", v:-1, k:"b" }, { type:"EV", v:"x" }, { type:"EV" } ];
+  var want = [ "LOW", "LIM", "KEY", "A", "A" ];
+  var modes = [ undefined, { compile:false } ];
+  for (var m=0;m<modes.length;m++) {
+    var mach = makeMachine(cfg(), modes[m]);
+    for (var i=0;i<evs.length;i++) {
+      var s = mach.interpret().start();
+      s.send(evs[i]);
+      if (s.state.value!==want[i]) return fail("P24a",(m?"interpretive":"compiled")+" event "+i+" -> "+s.state.value);
+    }
+  }
+  return pass("P24a","native guards agree in both modes");
+}
+
+// P25a: native assign ops update the context like the equivalent functions
+function T_P25a_Native_Assign_Ops() {
+  var modes = [ undefined, { compile:false } ];
+  for (var m=0;m<modes.length;m++) {
+    var s = makeMachine({ id:"p25", initial:"A", context:{ n:1, left:10, last:"none" }, states:{
+      A:{ on:{ EV:{ actions:[ { type:"xstate.assign", assignment:{
+        n:{ $inc:2 }, left:{ $dec:1 }, busy:{ $set:true }, last:{ $event:"value" }, fresh:{ $inc:1 } } } ] } } }
+    }}, modes[m]).interpret().start();
+    s.send({ type:"EV", value:42 }); s.send({ type:"EV" });
+    var c = s.state.context, where = m ? "interpretive" : "compiled";
+    if (c.n!==5 || c.left!==8 || c.fresh!==2) return fail("P25a",where+" $inc/$dec: "+c.n+","+c.left+","+c.fresh);
+    if (c.busy!==true || c.last!==42) return fail("P25a",where+" $set/$event: "+c.busy+","+c.last);
+  }
+  return pass("P25a","native assign ops agree in both modes");
+}
+
+// P26a: nested states: initial chain, LCA exit/entry order, bubbling, matches()
+function T_P26a_Nested_States() {
+  var log = [];
+  function tr(l) { return function(){ log.push(l); }; }
+  var m = makeMachine({ id:"p26", initial:"on", states:{
+    on:{ initial:"idle", entry:[tr("enOn")], exit:[tr("exOn")], on:{ OFF:"off" },
+      states:{
+        idle:{ exit:[tr("exIdle")], on:{ GO:"busy" } },
+        busy:{ entry:[tr("enBusy")], on:{ PING:{ cond:{ eq:["evt.x", 1] }, actions:[tr("ping")] } } }
+      } },
+    off:{ entry:[tr("enOff")], on:{ ON:"on.busy" } }
+  }});
+  var s = m.interpret().start();
+  if (s.state.value!=="on.idle" || log.join()!=="enOn") return fail("P26a","initial "+s.state.value+" "+log.join());
+  log=[]; s.send("GO");
+  if (s.state.value!=="on.busy" || log.join()!=="exIdle,enBusy") return fail("P26a","sibling: "+log.join());
+  log=[]; s.send({ type:"PING", x:2 }); s.send("OFF");
+  if (s.state.value!=="off" || log.join()!=="exOn,enOff") return fail("P26a","bubble/exit order: "+log.join());
+  log=[]; s.send("ON");
+  if (!s.state.matches("on") || log.join()!=="enOn,enBusy") return fail("P26a","absolute target: "+log.join());
+  var threw=false;
+  try { makeMachine({ id:"p26i", initial:"A", states:{ A:{ states:{ AA:{} } } } }, { compile:false }); } catch(e){ threw=true; }
+  if (!threw) return fail("P26a","nested accepted with compile:false");
+  return pass("P26a","nested states compiled flat");
+}
+
+// P26b: an ancestor's after timer keeps running across transitions between its children
+function T_P26b_Nested_After() {
+  return asyncTest(function(done){
+    var m = makeMachine({ id:"p26b", initial:"on", states:{
+      on:{ initial:"a", after:{ 80:"off" }, states:{ a:{ on:{ T:"b" } }, b:{ on:{ T:"a" } } } },
+      off:{}
+    }});
+    var s = m.interpret().start();
+    var n = 0;
+    var iv = setInterval(function(){ s.send("T"); if (++n>=5) clearInterval(iv); }, 10);
+    setTimeout(function(){
+      if (s.state.value!=="off") return done(fail("P26b","ancestor timer restarted by child moves ("+s.state.value+")"));
+      done(pass("P26b","ancestor timer ran across 5 child transitions"));
+    }, 120);
+  }, 500);
+}
+
+// P27a: on["*"] catch-all: explicit first, guard fallthrough, unknown names, nested ranking
+function T_P27a_Wildcard() {
+  var modes = [undefined, { compile:false }];
+  for (var m=0;m<modes.length;m++) {
+    var log = [], where = m ? "interpretive" : "compiled";
+    var s = makeMachine({ id:"p27", initial:"idle", states:{
+      idle:{ on:{ GO:"run", NOPE:{ target:"run", cond:{ eq:["evt.ok", true] } },
+        "*":{ target:"err", actions:[ function(){ log.push("any"); } ] } } },
+      run:{ on:{ STOP:"idle" } },
+      err:{ on:{ "*":{ actions:[ function(c, e){ log.push(e.type); } ] }, RESET:"idle" } }
+    }}, modes[m]).interpret().start();
+    s.send("GO");
+    if (s.state.value!=="run" || log.length) return fail("P27a",where+" explicit edge: "+s.state.value);
+    s.send("BOGUS"); s.send("STOP"); s.send({ type:"NOPE", ok:false });
+    if (s.state.value!=="err" || log.join()!=="any") return fail("P27a",where+" guard fallthrough: "+log.join());
+    s.send("WHATEVER"); s.send("GO"); s.send("RESET");
+    if (s.state.value!=="idle" || log.join()!=="any,WHATEVER,GO") return fail("P27a",where+" catch-all: "+log.join());
+  }
+  var seen = [];
+  var n = makeMachine({ id:"p27n", initial:"p", states:{
+    p:{ on:{ X:{ actions:[ function(){ seen.push("pX"); } ] } },
+      states:{ a:{ on:{ "*":{ actions:[ function(){ seen.push("aAny"); } ] } } } } }
+  }}).interpret().start();
+  n.send("X");
+  if (seen.join()!=="aAny") return fail("P27a","nested: child * should outrank parent: "+seen.join());
+  return pass("P27a","wildcard transitions agree in both modes");
+}
+
+// P28a: FSM.Bus routes an event only to services whose current state handles it
+function T_P28a_Event_Bus() {
+  if (typeof FSM==="undefined" || !FSM.Bus) return skip("P28a","no FSM.Bus in this build");
+  var ticks = 0;
+  var m = makeMachine({ id:"p28", initial:"idle", states:{
+    idle:{ on:{ BTN:"busy" } },
+    busy:{ on:{ BTN:"idle", TICK:{ actions:[ function(){ ticks++; } ] } } }
+  }});
+  var bus = new FSM.Bus(), s = [];
+  for (var i=0;i<4;i++) { s.push(m.interpret().start()); bus.add(s[i]); }
+  if (bus.send("TICK")!==0) return fail("P28a","TICK reached idle services");
+  s[1].send("BTN");
+  if (bus.send("TICK")!==1 || ticks!==1) return fail("P28a","index did not follow a direct send");
+  if (bus.send("BTN")!==4 || s[1].state.value!=="idle" || s[2].state.value!=="busy") return fail("P28a","broadcast");
+  s[3].stop(); bus.remove(s[2]);
+  if (bus.send("TICK")!==1 || bus.length!==3) return fail("P28a","stop/remove: "+bus.length);
+  var threw=false;
+  try { new FSM.Bus().add(s[0]); } catch(e){ threw=true; }
+  if (!threw) return fail("P28a","service added to two buses");
+  return pass("P28a","bus index follows transitions");
+}
+
+// P29a: machine.analyze(): reachability, per-state events, counts; { strip:true }
+function T_P29a_Analyze() {
+  var cfg = { id:"p29", initial:"idle", states:{
+    idle:{ on:{ GO:[ { target:"run", cond:{ eq:["ctx.ok", true] } }, "run", "idle" ] } },
+    run:{ on:{ STOP:{ target:"idle", actions:[ function(){}, function(){} ] } } },
+    orphan:{ on:{ LOST:"idle" } }
+  }};
+  var r = makeMachine(cfg).analyze();
+  if (r.states.join()!=="idle,run" || r.unreachable.join()!=="orphan") return fail("P29a","reachability: "+r.states+" / "+r.unreachable);
+  if (r.events.run.join()!=="STOP" || r.events.orphan!==undefined || r.deadEvents.join()!=="LOST") return fail("P29a","events");
+  if (r.transitions!==4 || r.guards!==1 || r.actions!==2 || r.shadowed!==1) return fail("P29a","counts "+r.transitions+","+r.guards+","+r.actions+","+r.shadowed);
+  if (!(r.blocks.config>0 && r.blocks.table>0 && r.blocks.service>0)) return fail("P29a","blocks");
+  var ri = makeMachine(cfg, { compile:false }).analyze();
+  if (ri.unreachable.join()!=="orphan") return fail("P29a","interpretive analysis");
+  var ms = new Machine(cfg, { strip:true }), rs = ms.analyze();
+  if (rs.unreachable.length || rs.stripped.join()!=="orphan" || rs.deadEvents.length) return fail("P29a","strip: "+rs.stripped);
+  var s = ms.interpret().start(); s.send("GO"); s.send("STOP");
+  if (s.state.value!=="idle") return fail("P29a","stripped machine runs");
+  return pass("P29a","analysis and strip agree");
+}
+
+// =========================
+// Runner
+// =========================
+
+function runAllPerf() {
+  var tests = [
+    ["P1a", T_P1a_Compiled_Matches_Interpretive],
+    ["P1b", T_P1b_Send_Uses_Current_State],
+    ["P1c", T_P1c_Guard_Sees_Service_Context],
+    ["P1d", T_P1d_Pure_Transition_Compiled],
+    ["P2a", T_P2a_Matches_Shared_Native],
+    ["P3a", T_P3a_NoMatch_Keeps_State_Object],
+    ["P3b", T_P3b_NotifyUnchanged_False],
+    ["P4a", T_P4a_Status_Numeric],
+    ["P5a", T_P5a_RefreshActions],
+    ["P5b", T_P5b_Service_Actions_Override],
+    ["P6a", T_P6a_Partitioned_Order],
+    ["P7a", T_P7a_Validate_Once],
+    ["P8a", T_P8a_Shared_Initial_State],
+    ["P9a", T_P9a_Immutable_Context],
+    ["P10a", T_P10a_Reuse_State],
+    ["P11a", T_P11a_Run_To_Completion],
+    ["P11b", T_P11b_SendBatch],
+    ["P12a", T_P12a_Unsubscribe_During_Notify],
+    ["P12b", T_P12b_Coalesce],
+    ["P13a", T_P13a_Native_Unsubscribe],
+    ["P14a", T_P14a_Interned_Event],
+    ["P15a", T_P15a_Long_Names],
+    ["P16a", T_P16a_After_Timers],
+    ["P16b", T_P16b_Self_Target_Rearms],
+    ["P17a", T_P17a_Pending_Work_Idle],
+    ["P17b", T_P17b_Cleared_Timers],
+    ["P18a", T_P18a_Profile_Stats],
+    ["P20a", T_P20a_Trace_Ring],
+    ["P21a", T_P21a_Snapshot_Restore],
+    ["P22a", T_P22a_Compact_Config],
+    ["P22b", T_P22b_Compact_Memory],
+    ["P23a", T_P23a_Service_Pool],
+    ["P24a", T_P24a_Native_Guards],
+    ["P25a", T_P25a_Native_Assign_Ops],
+    ["P26a", T_P26a_Nested_States],
+    ["P26b", T_P26b_Nested_After],
+    ["P27a", T_P27a_Wildcard],
+    ["P28a", T_P28a_Event_Bus],
+    ["P29a", T_P29a_Analyze]
+  ];
+
+  var results = [], out=[];
+
+  function addSummary() {
+    out.push(""); out.push("=== SUMMARY (Perf) ===");
+    for (var i=0;i<results.length;i++) {
+      var r=results[i]; var status=r.skipped?"SKIP":(r.ok?"PASS":"FAIL");
+      if (!XFSM_TS_CFG.FAIL_ONLY || r.skipped || !r.ok)
+        out.push(status+" "+r.id+" : "+_san(r.msg));
+    }
+    out.push(""); out.push("=== CSV (TestID,Result,Message) ===");
+    for (var j=0;j<results.length;j++) { var c=results[j]; var res=c.skipped?"SKIP":(c.ok?"PASS":"FAIL"); out.push(c.id+","+res+","+_san(c.msg)); }
+    out.push("=== END ===");
+  }
+
+  var i=0;
+  function scheduleNext(){ setTimeout(function(){ runOne(); }, 0); }
+  function pushResult(id, r){ if(!r||r.ok===undefined) r={ ok:false, msg:"No structured result" }; r.id=id; results.push(r); }
+
+  function runOne(){
+    if (i>=tests.length) { addSummary(); _drain(out,0); return; }
+    var id=tests[i][0], fn=tests[i][1];
+    var r; try{ r=fn(); }
+    catch(e){ pushResult(id,{ ok:false, msg:"Exception: "+(e&&e.message?e.message:(""+e)) }); i++; scheduleNext(); return; }
+    if (r && r.__async__ && typeof r.__start__==="function") {
+      var doneCalled=false; var to=setTimeout(function(){ if(doneCalled) return; doneCalled=true; pushResult(id,{ ok:false, msg:"Timeout (async)" }); i++; scheduleNext(); }, r.__timeout__|0);
+      r.__start__(function(res){ if(doneCalled) return; doneCalled=true; clearTimeout(to); pushResult(id,res); i++; scheduleNext(); });
+    } else { pushResult(id,r); i++; scheduleNext(); }
+  }
+
+  runOne();
+}
+
+// Execute
+runAllPerf();
@@ -278,19 +278,17 @@ function T_REQ_FSM_10_11() {
 }
 
 function T_REQ_FSM_12() {
-  // Nested states must be rejected (dev behavior)
+  // Nested states need the compiled table: rejected with { compile:false },
+  // flattened to dotted leaf names when compiled
+  var cfg = { id:"t12", initial:"A", states:{ A:{ initial:"AA", states:{ AA:{} } } } };
   var threw = false;
-  try {
-    makeMachine({
-      id:"t12",
-      initial:"A",
-      states:{
-        A:{ states:{ AA:{} } } // illegal for v4 FSM
-      }
-    });
-  } catch(e) { threw = true; }
-  if (threw) return pass("REQ-FSM-12", "nested states rejected");
-  return fail("REQ-FSM-12", "nested states allowed (should be rejected)");
+  try { makeMachine(cfg, { compile:false }); } catch(e) { threw = true; }
+  if (!threw) return fail("REQ-FSM-12", "nested states allowed with compile:false (should be rejected)");
+  var m;
+  try { m = makeMachine(cfg); } catch(e) { return fail("REQ-FSM-12", "compiled nested machine rejected: "+e); }
+  var s = m.interpret().start();
+  if (s.state.value!=="A.AA" || !s.state.matches("A")) return fail("REQ-FSM-12", "compiled nesting not entered: "+s.state.value);
+  return pass("REQ-FSM-12", "nested states rejected interpretive, accepted compiled");
 }
 
 function T_REQ_FSM_13() {